@@ -0,0 +1,48 @@
+#!/bin/bash
+# Profile guided dispatch benchmark
+# Builds bench/counter.sm without and with --profile-use and times both.
+#
+# Usage: bench/profile_bench.sh [mode] [steps]
+# Needs a built smc (./smc_d -b <mode>), llc and clang on PATH.
+
+set -e  # Exit on error
+
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+PROJECT_ROOT=$(pwd)
+MODE="${1:-release}"
+STEPS="${2:-200000000}"
+SMC="${PROJECT_ROOT}/build/${MODE}/smc"
+MACHINE="${PROJECT_ROOT}/bench/counter.sm"
+OUT=$(mktemp -d)
+trap 'rm -rf "${OUT}"' EXIT
+
+# compile <name> <smc flags...>: IR -> native binary ${OUT}/<name>
+function compile() {
+    local name="$1"
+    shift
+    "${SMC}" "${MACHINE}" --no-trace -o "${OUT}/${name}.ll" "$@" > /dev/null
+    llc -O2 -split-machine-functions "${OUT}/${name}.ll" -o "${OUT}/${name}.s"
+    clang "${OUT}/${name}.s" -o "${OUT}/${name}"
+}
+
+# run <name> <steps>: feeds steps and tape size on stdin
+function run() {
+    printf "%s\n64\n" "$2" | "${OUT}/$1" > /dev/null
+}
+
+echo -e "${BLUE}Collecting profile...${NC}"
+compile instrumented --profile-generate="${OUT}/counter.prof"
+(cd "${OUT}" && run instrumented 1000000)
+cat "${OUT}/counter.prof"
+
+compile plain
+compile pgo --profile-use="${OUT}/counter.prof"
+
+for name in plain pgo; do
+    echo -e "${BLUE}${name}: ${STEPS} steps${NC}"
+    time run "${name}" "${STEPS}"
+done
+echo -e "${GREEN}Done.${NC}"
@@ -0,0 +1,41 @@
+#!/bin/bash
+# Compile server latency benchmark
+# Compiles bench/counter.sm to IR through a --serve daemon and prints the
+# latency percentiles, then times the same compile as one process each.
+#
+# Usage: bench/server_bench.sh [mode] [requests] [clients]
+# Needs a built smc (./smc_d -b <mode>).
+
+set -e  # Exit on error
+
+GREEN='\033[0;32m'
+BLUE='\033[0;34m'
+NC='\033[0m' # No Color
+
+PROJECT_ROOT=$(pwd)
+MODE="${1:-release}"
+REQUESTS="${2:-1000}"
+CLIENTS="${3:-4}"
+SMC="${PROJECT_ROOT}/build/${MODE}/smc"
+MACHINE="${PROJECT_ROOT}/bench/counter.sm"
+OUT=$(mktemp -d)
+SOCKET="${OUT}/smc.sock"
+SERVER=""
+trap '[ -n "${SERVER}" ] && kill "${SERVER}"; rm -rf "${OUT}"' EXIT
+
+"${SMC}" --serve="${SOCKET}" &
+SERVER=$!
+while [ ! -S "${SOCKET}" ]; do sleep 0.05; done
+
+for clients in 1 "${CLIENTS}"; do
+    echo -e "${BLUE}server: ${REQUESTS} requests x ${clients} clients${NC}"
+    "${SMC}" --connect="${SOCKET}" "${MACHINE}" --no-trace \
+        --repeat="${REQUESTS}" --clients="${clients}"
+done
+
+PROCESSES=$((REQUESTS < 100 ? REQUESTS : 100))
+echo -e "${BLUE}process per compile: ${PROCESSES} compiles${NC}"
+time (for _ in $(seq "${PROCESSES}"); do
+    "${SMC}" "${MACHINE}" --no-trace -o "${OUT}/a.ll" > /dev/null
+done)
+echo -e "${GREEN}Done.${NC}"
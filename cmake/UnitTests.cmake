@@ -25,9 +25,67 @@ set(parser_TESTS_SRCS
     src/parser.cpp
     ${COMMON_TEST_SRCS}
 )
+
+set(machine_TESTS_SRCS
+    tests/machine_test.cpp
+    src/lexer.cpp
+    src/parser.cpp
+    src/machine.cpp
+    src/cppBackend.cpp
+    ${COMMON_TEST_SRCS}
+)
+
+set(optimizer_TESTS_SRCS
+    tests/optimizer_test.cpp
+    src/lexer.cpp
+    src/parser.cpp
+    src/machine.cpp
+    src/optimizer.cpp
+    src/stats.cpp
+    src/interpreter.cpp
+    src/runTape.cpp
+    ${COMMON_TEST_SRCS}
+)
+
+set(interpreter_TESTS_SRCS
+    tests/interpreter_test.cpp
+    src/lexer.cpp
+    src/parser.cpp
+    src/machine.cpp
+    src/optimizer.cpp
+    src/stats.cpp
+    src/interpreter.cpp
+    src/runTape.cpp
+    src/checkpoint.cpp
+    src/task.cpp
+    src/nondet.cpp
+    ${COMMON_TEST_SRCS}
+)
+
+set(server_TESTS_SRCS
+    tests/server_test.cpp
+    src/lexer.cpp
+    src/parser.cpp
+    src/machine.cpp
+    src/llvmBackend.cpp
+    src/cppBackend.cpp
+    src/optimizer.cpp
+    src/profile.cpp
+    src/stats.cpp
+    src/interpreter.cpp
+    src/runTape.cpp
+    src/timeReport.cpp
+    src/checkpoint.cpp
+    src/server.cpp
+    ${COMMON_TEST_SRCS}
+)
 set(all_TEST_TARGETS
     lexer
     parser
+    machine
+    optimizer
+    interpreter
+    server
 )
 
 set(all_TEST_TARGET_LIST)
@@ -53,6 +111,15 @@ foreach(test_target ${all_TEST_TARGETS})
       )
 endforeach()
 
+target_link_libraries(
+    server_test
+    LLVMCore
+    LLVMAnalysis
+    LLVMBitWriter
+    nlohmann_json::nlohmann_json
+    Threads::Threads
+)
+
 if(ENABLE_COVERAGE AND LLVM_PROFDATA AND LLVM_COV)
     message(STATUS "Enabling coverage reporting")
     message(STATUS "LLVM_PROFDATA: ${LLVM_PROFDATA}")
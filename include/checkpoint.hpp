@@ -0,0 +1,56 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+#include "interpreter.hpp"
+#include "machine.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace checkpoint {
+
+// A machine configuration part way through a run. The tape is kept
+// sparse: only runs of non-blank cells are stored, and within a run n > 1
+// equal cells are written once as <symbol>^n. States and symbols go
+// by name so a checkpoint can be resumed by the interpreter as well as
+// baked into freshly generated code. Single tape machines only.
+//
+// File format:
+//   smc-checkpoint 2
+//   steps <steps done>
+//   state <state>
+//   head <cell>
+//   tape <cells>
+//   run <first cell> <symbol> <symbol>^<count> ...
+class Checkpoint {
+  public:
+    struct Run {
+        uint64_t start;
+        std::vector<std::string> syms;
+    };
+
+    uint64_t steps = 0;
+    std::string state;
+    int64_t head = 0;
+    uint64_t tapeSize = 0;
+    std::vector<Run> runs;
+
+    static Checkpoint capture(const interpreter::Interpreter &interp);
+    // The furthest cell that is under the head or not blank
+    uint64_t frontier() const;
+    // Puts `interp` (same machine, any tape size that holds the runs) in
+    // this configuration.
+    void restore(interpreter::Interpreter &interp) const;
+    void save(const std::string &filename) const;
+};
+
+Checkpoint load_checkpoint(const std::string &filename);
+
+// Checkpoints of a run are numbered `<prefix>.<steps>.ckpt`
+std::string fileFor(const std::string &prefix, uint64_t steps);
+// The checkpoint with the most steps that are not past `step`
+std::optional<std::string> nearest(const std::string &prefix, uint64_t step);
+
+} // namespace checkpoint
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef CPP_BACKEND_HPP
+#define CPP_BACKEND_HPP 1
+#include "machine.hpp"
+#include "parser.hpp"
+#include <memory>
+#include <string>
+
+namespace cppBackend {
+// Emits a self contained C++20 header describing the machine as constexpr
+// tables, together with a `smc::run<Machine>(tape, steps)` template that the
+// host compiler specializes per machine. Needs no LLVM at the use site.
+class CppBackend {
+  private:
+    std::unique_ptr<parser::Parser> parser;
+
+  public:
+    std::string header;
+    // What gets lowered. Optimization passes rewrite this before getHeader().
+    machine::Machine machine;
+    CppBackend(std::unique_ptr<parser::Parser> inparser)
+        : parser(std::move(inparser)) {
+        parser->parse();
+        machine = machine::fromParseTree(parser->tree);
+    };
+
+    // Get header. `name` becomes the machine struct in `smc::machines`.
+    void getHeader(const std::string &name);
+};
+} // namespace cppBackend
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef INTERPRETER_HPP
+#define INTERPRETER_HPP
+#include "machine.hpp"
+#include "optimizer.hpp"
+#include "runTape.hpp"
+#include "stats.hpp"
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace interpreter {
+
+enum class Status { Running, Halted, OutOfTape };
+
+std::ostream &operator<<(std::ostream &os, Status status);
+
+// Runs a machine on the host with the semantics of the generated code:
+// blank tapes of fixed size, every head on cell 0 and one step per
+// dispatch. A missing rule halts; an action list that would leave a tape
+// stops the run before touching any of them.
+class Interpreter {
+  private:
+    machine::Machine machine;
+    // action list of every rule in its fused form, one per tape:
+    // ops[rule * tapes + tape]
+    std::vector<optimizer::FusedSteps> ops;
+    // target state of every rule
+    std::vector<unsigned> next;
+    // self-loops taken in one stretch, by state (optimizer::sweeps)
+    std::vector<optimizer::Sweep> sweeps;
+
+    Status runSingle(uint64_t maxSteps, stats::Stats *stats);
+    Status runMulti(uint64_t maxSteps, stats::Stats *stats);
+
+  public:
+    // one tape and head per tape of the machine, tape 1 first
+    std::vector<std::vector<int32_t>> tapes;
+    std::vector<int64_t> heads;
+    unsigned state;
+    uint64_t steps = 0;
+    Status status = Status::Running;
+
+    Interpreter(const machine::Machine &m, uint64_t tapeSize);
+
+    // Runs until `maxSteps` more steps are done or the machine stops.
+    // Every step is recorded in `stats` when given, with the head of
+    // tape 1.
+    Status run(uint64_t maxSteps, stats::Stats *stats = nullptr);
+
+    const machine::Machine &getMachine() const { return machine; }
+};
+
+// The Interpreter with its tape kept as runs of equal symbols
+// (runTape::RunTape), for long runs that leave long uniform stretches:
+// memory follows the number of runs instead of the tape size, and a sweep
+// crosses a whole run in one go. Single tape machines, no stats.
+class RunInterpreter {
+  private:
+    machine::Machine machine;
+    std::vector<optimizer::FusedSteps> ops;
+    std::vector<unsigned> next;
+    std::vector<optimizer::Sweep> sweeps;
+
+  public:
+    runTape::RunTape tape;
+    unsigned state;
+    uint64_t steps = 0;
+    Status status = Status::Running;
+
+    RunInterpreter(const machine::Machine &m, uint64_t tapeSize);
+
+    // Runs until `maxSteps` more steps are done or the machine stops,
+    // exactly like Interpreter::run.
+    Status run(uint64_t maxSteps);
+
+    const machine::Machine &getMachine() const { return machine; }
+};
+
+} // namespace interpreter
+
+#endif
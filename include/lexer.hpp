@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <ostream>
 #include <stdexcept>
@@ -22,6 +23,8 @@ enum TokenType {
     STATES = 201,
     SYMBOLS = 202,
     TRANSITIONS = 203,
+    TAPES = 204,
+    FUNCTIONS = 205,
     // Contextual Keywords
     R = 104,
     L = 105,
@@ -110,6 +113,8 @@ class Lexer {
     std::vector<char> source;
     char curr_char;
     Location cursor;
+    // index in the whole source of source[0], for lexers of a piece of it
+    uint32_t base = 0;
 
     void skip_whitespace() {
         while (curr_char == ' ' or curr_char == '\t') {
@@ -157,6 +162,27 @@ class Lexer {
         curr_char = source[0];
     };
 
+    // The text of a piece of a source that starts at `start`, a line
+    // start or the first token of a line.
+    Lexer(std::vector<char> piece, const std::string &srcfile,
+          const Location &start)
+        : source(std::move(piece)), cursor(start), base(start.index),
+          srcfile(srcfile) {
+        source.push_back('\0');
+        curr_char = source[0];
+    };
+
+    // Lexers for consecutive pieces of the source from `from` to its end,
+    // cut at line starts: at most `pieces` of them, of at least `minBytes`
+    // each. Tokens keep their locations in the whole source.
+    std::vector<std::unique_ptr<Lexer>>
+    split(const Location &from, unsigned pieces, size_t minBytes) const;
+    // Continues lexing at `loc`, a location of this lexer's source.
+    void seek(const Location &loc) {
+        cursor = loc;
+        curr_char = source[cursor.index - base];
+    }
+
     // get's the char value at the current cursor
     char get_curr_char() const { return curr_char; };
     Location get_cursor() const { return cursor; }
@@ -170,7 +196,7 @@ class Lexer {
             cursor.col++;
         }
         // move to next character
-        curr_char = source[++cursor.index];
+        curr_char = source[++cursor.index - base];
     };
 
     // peeks ahead to look the character at position ahead of
@@ -179,7 +205,7 @@ class Lexer {
         // nothing to peek ahead
         if (curr_char == '\0')
             return '\0';
-        return source[cursor.index + 1];
+        return source[cursor.index + 1 - base];
     };
 
     // Token generation
@@ -197,7 +223,8 @@ class Lexer {
         // match directly
         switch (curr_char) {
         case '\0':
-            next_char();
+            // stay on the terminator so that reading past the end keeps
+            // producing EOF instead of running off the source buffer
             return Token("\0", TokenType::EOF_TOKEN, srcfile,
                          {token_loc, token_loc + 1});
         case '\n':
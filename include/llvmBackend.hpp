@@ -1,20 +1,117 @@
 #ifndef LLVM_BACKEND_HPP
 #define LLVM_BACKEND_HPP 1
+#include "checkpoint.hpp"
+#include "machine.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
+
+namespace llvm {
+class LLVMContext;
+}
 
 namespace llvmBackend {
+// Knobs for getIr(). The defaults give the fastest code.
+class CodegenOptions {
+  public:
+    // Lower action lists in their fused form (see optimizer::fuseSteps):
+    // one index update per transition and one wide store per run of
+    // adjacent writes instead of a load/store pair per step.
+    bool fuseActions = true;
+    // printf the step, head, symbol and state on every step
+    bool trace = true;
+    // run self-loops that leave the tape alone (optimizer::sweeps) as one
+    // vectorized scan instead of a dispatch per cell. Single tape switch
+    // loops without trace, profile counts, stats or periodic checkpoints.
+    bool sweeps = true;
+    // without a profile, lay out the case blocks of the steps loop state
+    // by state in optimizer::layoutStates order instead of rule order, so
+    // states of one loop sit next to each other in the binary
+    bool layout = true;
+    // a (state, symbol) pair without a transition halts the machine: the
+    // loop exits early and reports the halting step, state and tape extent
+    bool halt = false;
+    // instrument every dispatch case and write its hit count to this file
+    // on exit (see profile::Profile for the format)
+    std::string profileGenerate;
+    // lay out the steps loop for the recorded counts
+    std::optional<profile::Profile> profileUse;
+    // count cases and track head positions, write them as JSON to this
+    // file on exit (same layout as stats::toJson)
+    std::string stats;
+    // write the configuration to `<checkpointPrefix>.<steps>.ckpt` every
+    // `checkpointEvery` steps (0: never) and when the loop ends
+    std::string checkpointPrefix;
+    uint64_t checkpointEvery = 0;
+    // start from this configuration instead of a blank tape; the tape
+    // must be at least as large as the checkpointed one
+    std::optional<checkpoint::Checkpoint> resume;
+    // size the tape from the number of steps with optimizer::tapeExtent
+    // instead of asking for it
+    bool exactTape = false;
+    // The switch loop checks the step budget once per `unroll` steps: it
+    // runs that many copies of its body back to back while the budget
+    // allows, and enters the chain part way for the last few steps. Code
+    // size grows with the copies; 1 checks every step.
+    unsigned unroll = 1;
+    // How the steps loop finds the rule of a (state, symbols) case.
+    enum class Dispatch {
+        // Table for machines with more than `tableStates` states, when the
+        // other options allow it; Switch otherwise
+        Auto,
+        // a switch into compiled code, one block per class of equal rules
+        Switch,
+        // the machine as packed constant tables walked by one generic
+        // loop: compile time barely grows with the machine, no per rule
+        // code. No profile guided layout, checkpoints or partitions.
+        Table,
+    };
+    Dispatch dispatch = Dispatch::Auto;
+    unsigned tableStates = 4096;
+    // split the steps loop over up to this many modules, one per group of
+    // strongly connected states (see optimizer::partitionStates), built on
+    // a pool of threads; 1 keeps the whole loop in main
+    unsigned partitions = 1;
+    // bitcode with a ThinLTO summary instead of textual IR, for every
+    // module
+    bool bitcode = false;
+    // target of every module. ThinLTO links a module only into objects of
+    // the same triple and data layout, so these must match the host.
+    std::string targetTriple = "arm64-apple-macosx13.0.0";
+    std::string dataLayout = "e-m:o-i64:64-i128:128-n32:64-S128";
+    // non-empty: instead of a program with main, a re-entrant
+    // `<library>_run` over a tape the caller passes in, without globals or
+    // I/O, and its C header in LllvmBackend::header. Every symbol of the
+    // module starts with the prefix, so several machines link into one
+    // shared library.
+    std::string library;
+};
+
 class LllvmBackend {
   private:
     std::unique_ptr<parser::Parser> parser;
 
   public:
+    // textual IR, or bitcode with options.bitcode
     std::string ir;
+    // the group modules of a partitioned loop, to be linked with `ir`
+    std::vector<std::string> partIrs;
+    // the C header of a library (options.library)
+    std::string header;
+    // What gets lowered. Optimization passes rewrite this before getIr().
+    machine::Machine machine;
+    CodegenOptions options;
+    // Context to build `ir` in, owned by the caller: a long lived one
+    // saves setting up a fresh context per machine. nullptr: getIr() makes
+    // its own. Partition groups always get contexts of their own.
+    llvm::LLVMContext *context = nullptr;
     LllvmBackend(std::unique_ptr<parser::Parser> inparser)
         : parser(std::move(inparser)) {
         parser->parse();
-        ;
+        machine = machine::fromParseTree(parser->tree);
     };
 
     void dumpParseTree(nlohmann::json &j) { parser::to_json(j, parser->tree); }
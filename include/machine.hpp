@@ -0,0 +1,84 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+#include "parser.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace machine {
+
+// Index based view of a ParseTree. Backends that don't want to deal with
+// names and conditions lower from this instead of the raw tree.
+class Machine {
+  public:
+    static constexpr int32_t NO_RULE = -1;
+
+    std::vector<std::string> symbols; // "X" (blank) is always last
+    std::vector<std::string> states;
+    unsigned initialState = 0;
+    // Transitions of the source program, in declaration order
+    std::vector<parser::Transition> rules;
+    // Tapes read in every step. A step dispatches on the combination of
+    // the symbols under all heads, see combo().
+    unsigned tapes = 1;
+    // (state * numCombos() + combo) -> index into `rules` or NO_RULE. With
+    // a single tape the combination is just the symbol.
+    std::vector<int32_t> dispatch;
+
+    std::unordered_map<std::string, unsigned> sym2idx;
+    std::unordered_map<std::string, unsigned> state2idx;
+
+    unsigned numSymbols() const { return symbols.size(); }
+    unsigned numStates() const { return states.size(); }
+    unsigned blank() const { return symbols.size() - 1; }
+    // numSymbols() ^ tapes
+    unsigned numCombos() const {
+        unsigned n = 1;
+        for (unsigned t = 0; t < tapes; ++t)
+            n *= numSymbols();
+        return n;
+    }
+    // Symbol on `tape` in a combination; tape 1 varies fastest, so
+    // combo = sym1 + sym2 * numSymbols() + ...
+    unsigned comboSymbol(unsigned combo, unsigned tape) const {
+        for (unsigned t = 0; t < tape; ++t)
+            combo /= numSymbols();
+        return combo % numSymbols();
+    }
+
+    // The symbol, or the tuple "(a, b)" on multi tape machines
+    std::string comboName(unsigned combo) const;
+
+    int32_t ruleFor(unsigned state, unsigned combo) const {
+        return dispatch[state * numCombos() + combo];
+    }
+    unsigned symbolIndex(const std::string &sym) const;
+    unsigned stateIndex(const std::string &state) const;
+
+    // Turns `state` into a halting state: every symbol read in it has no
+    // rule, so the machine stops as soon as it gets there.
+    void makeHaltState(const std::string &state);
+};
+
+// Resolves conditions the same way the LLVM backend does: an OR condition
+// beats a Star on the same state and otherwise the first transition wins.
+// On multi tape machines the condition with fewer Star tapes wins.
+Machine fromParseTree(const parser::ParseTree &tree);
+
+// Every rule that matches a case, where `dispatch` keeps only the one that
+// wins: the choices of a nondeterministic run. Cases without a rule in
+// `dispatch` (halt states) get none.
+class Branches {
+  public:
+    // the rules of case (state * numCombos() + combo) are
+    // rules[start[case]], ..., rules[start[case + 1] - 1], in declaration
+    // order
+    std::vector<uint32_t> start;
+    std::vector<uint32_t> rules;
+};
+Branches branches(const Machine &m);
+
+} // namespace machine
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef NONDET_HPP
+#define NONDET_HPP
+#include "machine.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace nondet {
+
+// How a search ended
+enum class Verdict {
+    // a branch entered an accepting state
+    Accepted,
+    // every branch halted, left the tape, entered a rejecting state or
+    // came back to a configuration seen before
+    Rejected,
+    // branches were still alive at the step bound or when the set of
+    // seen configurations was full
+    Undecided,
+};
+
+std::ostream &operator<<(std::ostream &os, Verdict verdict);
+
+class Options {
+  public:
+    std::vector<std::string> accept;
+    std::vector<std::string> reject;
+    // cells of every tape
+    uint64_t tapeSize = 64;
+    // steps of the longest branch
+    uint64_t maxSteps = 0;
+    // distinct configurations to remember, which bounds memory: the seen
+    // set takes 16 bytes per configuration, a level never holds more of
+    // them and its children are at most as many times the most rules a
+    // (state, symbols) case picks from. What a configuration costs on top
+    // is said at Config.
+    uint64_t maxConfigs = uint64_t(1) << 20;
+    // threads expanding a level, 0: one per core
+    unsigned threads = 0;
+};
+
+// A set of 64 bit fingerprints of fixed capacity that any number of
+// threads insert into at once: open addressing over atomics, linear
+// probing, no locks and no deletes.
+class FingerprintSet {
+  private:
+    std::unique_ptr<std::atomic<uint64_t>[]> slots;
+    uint64_t mask;
+    uint64_t limit;
+    std::atomic<uint64_t> count{0};
+
+  public:
+    enum class Insert { Added, Present, Full };
+    // room for `capacity` fingerprints at a load of at most one half
+    explicit FingerprintSet(uint64_t capacity);
+    Insert insert(uint64_t fingerprint);
+    bool contains(uint64_t fingerprint) const;
+    uint64_t size() const { return count; }
+};
+
+// The tapes of a configuration are a tree: PAGE_CELLS cells to a page
+// and FANOUT children to an inner node. Configurations share nodes until
+// one of them writes below a node it does not own alone, and then copies
+// the path down to the page (copy on write). Copying a configuration
+// therefore copies its root, and a write copies one page and the nodes
+// above it, a few hundred bytes per tree level.
+constexpr unsigned PAGE_BITS = 6;
+constexpr unsigned FANOUT_BITS = 4;
+constexpr unsigned PAGE_CELLS = 1u << PAGE_BITS;
+constexpr unsigned FANOUT = 1u << FANOUT_BITS;
+using Page = std::array<int32_t, PAGE_CELLS>;
+
+// One configuration of a run. The tapes lie one after another, tape t
+// starts at cell t * tapeSize. `tapeHash` is the Zobrist hash of the
+// non-blank cells, kept up to date on every write.
+class Config {
+  public:
+    // an inner node, whose children are pages at depth 1 and inner nodes
+    // further up
+    using Node = std::array<std::shared_ptr<void>, FANOUT>;
+    // a page for depth 0
+    std::shared_ptr<void> root;
+    unsigned depth = 0;
+    std::vector<int64_t> heads;
+    unsigned state;
+    uint64_t tapeHash = 0;
+
+    // the child of an inner node at `level` (depth - 1 for the root's)
+    // that holds cell `at`
+    static unsigned slot(uint64_t at, unsigned level) {
+        return (at >> (PAGE_BITS + FANOUT_BITS * level)) % FANOUT;
+    }
+
+    int32_t cell(uint64_t at) const {
+        const void *node = root.get();
+        for (unsigned level = depth; level-- > 0;)
+            node = (*static_cast<const Node *>(node))[slot(at, level)].get();
+        return (*static_cast<const Page *>(node))[at % PAGE_CELLS];
+    }
+};
+
+class Result {
+  public:
+    Verdict verdict = Verdict::Undecided;
+    // steps of the accepting branch, or levels expanded otherwise
+    uint64_t steps = 0;
+    // distinct configurations seen, and the largest level
+    uint64_t configs = 0;
+    uint64_t widest = 0;
+    // branches that halted, left a tape or were rejected
+    uint64_t dead = 0;
+    // the accepting configuration: state, heads and every tape
+    unsigned state = 0;
+    std::vector<int64_t> heads;
+    std::vector<std::vector<int32_t>> tapes;
+};
+
+// Explores every branch of `m` (machine::branches) breadth first, from
+// blank tapes with every head on cell 0, until a branch enters an
+// accepting state, no branch is left or a bound is hit. Configurations
+// with the fingerprint of one seen before are dropped; collisions of the
+// 64 bit fingerprint go unnoticed. Levels are expanded in parallel, and
+// children that meet are merged in the order of their parents, so the
+// result does not depend on the number of threads.
+Result search(const machine::Machine &m, const Options &options);
+
+} // namespace nondet
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+#include "machine.hpp"
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+namespace optimizer {
+
+class MinimizeReport {
+  public:
+    uint32_t statesBefore = 0;
+    uint32_t statesAfter = 0;
+    uint32_t symbolsBefore = 0;
+    uint32_t symbolsAfter = 0;
+    uint32_t unreachableStates = 0;
+    uint32_t mergedStates = 0;
+    uint32_t tapes = 1;
+
+    uint64_t dispatchBefore() const {
+        return dispatchCells(statesBefore, symbolsBefore);
+    }
+    uint64_t dispatchAfter() const {
+        return dispatchCells(statesAfter, symbolsAfter);
+    }
+
+  private:
+    uint64_t dispatchCells(uint64_t states, uint64_t symbols) const {
+        for (uint32_t t = 0; t < tapes; ++t)
+            states *= symbols;
+        return states;
+    }
+};
+
+std::ostream &operator<<(std::ostream &os, const MinimizeReport &report);
+
+// Shrinks the machine before codegen:
+//  1. drops states not reachable from the initial state and symbols that can
+//     never be on the tape (only the blank and printed symbols can be read),
+//  2. merges equivalent states by partition refinement over
+//     (symbol -> actions, next state).
+// Observable behaviour on a blank tape is unchanged.
+MinimizeReport minimize(machine::Machine &m);
+
+// Net effect of an action list: the last symbol printed on every touched
+// cell (relative to the head on entry) followed by a single head move.
+// R/L runs fold into `move`, L-R pairs cancel, overwritten prints and X
+// steps disappear.
+class FusedSteps {
+  public:
+    // offset -> symbol index
+    std::map<int32_t, unsigned> writes;
+    int32_t move = 0;
+    // furthest cells the original list visits, for bounds checks
+    int32_t minOffset = 0;
+    int32_t maxOffset = 0;
+
+    // Writes to adjacent cells, each a candidate for one wide store.
+    struct Run {
+        int32_t offset;
+        std::vector<unsigned> syms;
+    };
+    std::vector<Run> runs() const;
+};
+
+// Strongly connected components of the state graph (an edge for every
+// rule), successors first: no state reaches a component listed after its
+// own.
+std::vector<std::vector<unsigned>>
+stronglyConnected(const machine::Machine &m);
+
+// Splits the states into at most `parts` groups of whole components,
+// balanced by dispatch cases and in topological order. Returns the group
+// of every state.
+std::vector<unsigned> partitionStates(const machine::Machine &m,
+                                      unsigned parts);
+
+// Code layout order of the states without a profile. Components come
+// sources first (those reachable from the initial state before the rest),
+// so a run mostly moves forward. Within a component the states form
+// chains: each state is followed by the unplaced state it hands off to
+// on the most dispatch cases, the static stand-in for the hottest edge.
+std::vector<unsigned> layoutStates(const machine::Machine &m);
+
+// Rules with the same next state and the same effect on every tape (as
+// fused by fuseSteps) share a class, numbered from 0 in rule order.
+// Returns the class of every rule; backends lower one block per class.
+std::vector<unsigned> ruleClasses(const machine::Machine &m);
+
+// Self-loops of a state on a single tape machine that leave the cell as
+// it is and all move the head by the same amount: the head runs across
+// cells holding these symbols in one stretch, without changing anything
+// but the step count. move is 0 for a state without such loops.
+class Sweep {
+  public:
+    int32_t move = 0;
+    // by symbol index: the cell keeps the head in the loop
+    std::vector<bool> symbols;
+    // furthest cells a step of the loop visits, relative to the head
+    int32_t minOffset = 0;
+    int32_t maxOffset = 0;
+};
+
+// One entry per state. Empty for multi tape machines.
+std::vector<Sweep> sweeps(const machine::Machine &m);
+
+// Bound on the cells one tape needs for a run of n steps: the furthest
+// cell right of the start (cell 0) a head can touch, plus one. The smaller
+// of two lines in n.
+class TapeBound {
+  public:
+    // longest path through the components of the state graph: acyclic
+    // parts, components that never move right and sweeps over written
+    // cells add a constant, anything else up to its largest move per step
+    uint64_t fixed = 1;
+    uint64_t perStep = 0;
+    // furthest any reachable rule gets right of its head, per step
+    uint64_t reach = 0;
+
+    uint64_t cells(uint64_t steps) const;
+    // the same number of cells whatever the number of steps
+    bool bounded() const { return perStep == 0 || reach == 0; }
+};
+
+class TapeExtent {
+  public:
+    // one per tape of the machine
+    std::vector<TapeBound> tapes;
+
+    // cells of the largest tape after `steps` steps
+    uint64_t cells(uint64_t steps) const;
+    bool bounded() const;
+};
+
+std::ostream &operator<<(std::ostream &os, const TapeExtent &extent);
+
+// Static bound on how far right the heads can get from a blank tape with
+// every head on cell 0. Moves left of cell 0 are not checked.
+TapeExtent tapeExtent(const machine::Machine &m);
+
+// Fuses the actions of `steps` on `tape`, other tapes are ignored.
+FusedSteps fuseSteps(const machine::Machine &m,
+                     const std::vector<parser::TransitionStep> &steps,
+                     unsigned tape = 0);
+
+} // namespace optimizer
+
+#endif
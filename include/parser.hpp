@@ -9,6 +9,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -20,20 +21,40 @@ struct OR {
     std::vector<std::string> sym;
 };
 
-using Condition = std::variant<Star, OR>;
+// What a single tape has to show
+using TapeCondition = std::variant<Star, OR>;
+// Multi tape machines match one condition per tape, tape 1 first
+struct Tuple {
+    std::vector<TapeCondition> tapes;
+};
+
+using Condition = std::variant<Star, OR, Tuple>;
+void to_json(json &j, const TapeCondition &cond);
+void to_json(json &j, const Tuple &tuple);
 void to_json(json &j, const Condition &cond);
 
-struct R {};
-struct L {};
-struct X {};
+// Actions work on one tape: 0 is tape 1, the only one of single tape
+// machines.
+struct R {
+    unsigned tape = 0;
+};
+struct L {
+    unsigned tape = 0;
+};
+struct X {
+    unsigned tape = 0;
+};
 struct P {
     std::string sym;
+    unsigned tape = 0;
 };
 void to_json(json &j, const R &r);
 void to_json(json &j, const L &l);
 void to_json(json &j, const X &x);
 void to_json(json &j, const P &p);
 using TransitionStep = std::variant<R, L, X, P>;
+// Tape an action works on, 0 based
+unsigned tapeOf(const TransitionStep &step);
 
 void to_json(json &j, const TransitionStep &step);
 // TODO : See if we can specify a concept (C++ 20)
@@ -46,6 +67,8 @@ class Transition {
     Condition condition;
     std::vector<TransitionStep> steps;
     std::string finalState;
+    // line in the .sm source, 0 if the transition was built by hand
+    uint32_t line = 0;
 
     Transition()
         : initialState(""), condition(OR{{}}), steps({}), finalState(""){};
@@ -53,14 +76,56 @@ class Transition {
 
 void to_json(json &j, const Transition &tr);
 
+// A state or symbol as written in an m-function call: a plain name, or an
+// m-function applied to arguments, f(C, B, a)
+struct Term {
+    std::string name;
+    std::vector<Term> args;
+};
+// "f(C,B,a)", the name of the states an expanded call starts in
+std::string to_string(const Term &term);
+
+// A parameterized table, Turing's m-function. Body transitions start in
+// the function itself (its name) or in one of its local states, every
+// other plain state of the body. They end in a parameter, a local state
+// or another call; parameters also stand in for symbols.
+struct MFunction {
+    std::string name;
+    std::vector<std::string> params;
+    std::vector<Transition> body;
+    // target of every body transition, its finalState is the text
+    std::vector<Term> targets;
+    uint32_t line = 0;
+};
+void to_json(json &j, const MFunction &fn);
+
 class ParseTree {
   public:
+    static constexpr unsigned MAX_TAPES = 8;
+
     std::vector<std::string> states;
     std::string initial_state;
     std::vector<std::string> symbols;
     std::vector<Transition> transitions;
+    unsigned tapes = 1;
+    std::vector<MFunction> functions;
+    // m-function calls the transitions end in
+    std::vector<Term> calls;
+
+    // Most states the calls may expand to, and the longest chain of
+    // instances creating instances. Stops recursion that keeps building
+    // new arguments.
+    static constexpr unsigned MAX_INSTANCE_STATES = 1 << 20;
+    static constexpr unsigned MAX_INSTANCE_DEPTH = 1 << 10;
 };
 
+// Expands the m-function calls of `tree`: a call resolves to one set of
+// states named after the call, "f(b,0)" for the entry and "f(b,0).loop"
+// for a local state. Calls that resolve to the same arguments share
+// their states, however many callers they have. Appends the states and
+// transitions of every instance.
+void expand_functions(ParseTree &tree);
+
 void to_json(json &j, const ParseTree &tree);
 
 template <typename T> using optionalFnType = std::optional<std::function<T>>;
@@ -73,6 +138,12 @@ class Parser {
 
   public:
     ParseTree tree;
+    // TRANSITIONS sections are parsed on up to `parseThreads` threads (0:
+    // one per core), in pieces of at least `pieceBytes`. Smaller sections
+    // are parsed in one go.
+    unsigned parseThreads = 0;
+    size_t pieceBytes = 1 << 18;
+
     Parser(std::unique_ptr<lexer::Lexer> lexer) : lexer(std::move(lexer)) {
         nextToken(); // initialize peek_token
         nextToken(); // initialize curr_token
@@ -207,8 +278,22 @@ class Parser {
         symbols_list();
     }
 
+    /* TAPES_DECLARATION := "TAPES" ":" NUMBER */
+    void tapes_declaration() {
+        consume(lexer::TokenType::TAPES);
+        consume(lexer::TokenType::COLON);
+        std::string count;
+        auto storeCount = [&](const lexer::Token &tok) { count = tok.token; };
+        consume(lexer::TokenType::IDENT, storeCount);
+        if (count.size() > 1 || count < "1" ||
+            count > std::to_string(ParseTree::MAX_TAPES))
+            abort("TAPES must be a number from 1 to " +
+                  std::to_string(ParseTree::MAX_TAPES) + ", got " + count);
+        tree.tapes = std::stoul(count);
+    }
+
     // IDENT OR X ( symbol for empty tape)
-    Condition parse_or_conditions() {
+    OR parse_or_conditions() {
         std::vector<std::string> syms;
         std::string sym;
         auto storeSym = [&](const lexer::Token &tok) { sym = tok.token; };
@@ -233,8 +318,8 @@ class Parser {
         return OR{syms};
     }
 
-    /* CONDITION := STAR | OR_CONDITIONS */
-    Condition parse_condition() {
+    /* TAPE_CONDITION := STAR | OR_CONDITIONS */
+    TapeCondition parse_tape_condition() {
         //  STAR
         if (try_consume(lexer::TokenType::STAR))
             return Star{};
@@ -243,21 +328,69 @@ class Parser {
         return parse_or_conditions();
     }
 
-    /* ACTION := R | L | X | PRINT */
+    /* CONDITION := TAPE_CONDITION | TUPLE */
+    Condition parse_condition() {
+        //  TUPLE := '(' (TAPE_CONDITION ',')* TAPE_CONDITION ')'
+        if (try_consume(lexer::TokenType::LeftParen)) {
+            Tuple tuple;
+            tuple.tapes.push_back(parse_tape_condition());
+            while (try_consume(lexer::TokenType::COMMA))
+                tuple.tapes.push_back(parse_tape_condition());
+            consume(lexer::TokenType::RightParen);
+            if (tuple.tapes.size() != tree.tapes)
+                abort("Condition names " + std::to_string(tuple.tapes.size()) +
+                      " tapes, the machine has " + std::to_string(tree.tapes));
+            return tuple;
+        }
+        if (tree.tapes > 1)
+            abort("Expected one condition per tape: (c1, ..., c" +
+                  std::to_string(tree.tapes) + ")");
+        return std::visit([](auto &&cond) -> Condition { return cond; },
+                          parse_tape_condition());
+    }
+
+    // Tape qualified actions lex as one identifier, the action letter
+    // followed by the tape number (R2, P2). Returns the action kind and the
+    // 0 based tape; plain actions work on tape 1.
+    std::pair<lexer::TokenType, unsigned>
+    action_kind(const lexer::Token &tok) {
+        if (tok.kind != lexer::TokenType::IDENT)
+            return {tok.kind, 0};
+        auto kind = lexer::Token::check_if_keyword(tok.token.substr(0, 1));
+        const auto digits = tok.token.substr(1);
+        bool isAction = kind == lexer::TokenType::R ||
+                        kind == lexer::TokenType::L ||
+                        kind == lexer::TokenType::X ||
+                        kind == lexer::TokenType::P;
+        if (!isAction || digits.size() != 1 || digits < "1" || digits > "9")
+            abort("Unknown action token: " + tok.token);
+        unsigned tape = std::stoul(digits);
+        if (tape > tree.tapes)
+            abort("Action " + tok.token + " names tape " + digits +
+                  ", the machine has " + std::to_string(tree.tapes));
+        return {kind.value(), tape - 1};
+    }
+
+    /* ACTION := (R | L | X) TAPE? | PRINT */
     TransitionStep parse_action() {
         const auto tok = curr_token;
+        const auto [kind, tape] = action_kind(tok);
 
         //  Simple one‑letter actions
-        if (tok.kind == lexer::TokenType::R ||
-            tok.kind == lexer::TokenType::L ||
-            tok.kind == lexer::TokenType::X) {
-            consume(tok.kind);                     // consume R/L/X
-            return fromTokenAndValue(tok).value(); // safe: kind already matched
+        if (kind == lexer::TokenType::R || kind == lexer::TokenType::L ||
+            kind == lexer::TokenType::X) {
+            consume(tok.kind); // consume R/L/X
+            auto keyword = tok;
+            keyword.kind = kind;
+            // safe: kind already matched
+            auto step = fromTokenAndValue(keyword).value();
+            std::visit([tape = tape](auto &st) { st.tape = tape; }, step);
+            return step;
         }
 
-        //  PRINT := P '(' SYMBOL ')'
-        if (tok.kind == lexer::TokenType::P) {
-            consume(lexer::TokenType::P);         // P
+        //  PRINT := P TAPE? '(' SYMBOL ')'
+        if (kind == lexer::TokenType::P) {
+            consume(tok.kind);                    // P
             consume(lexer::TokenType::LeftParen); // (
             std::string sym;
             auto storeSym = [&](const lexer::Token &t) { sym = t.token; };
@@ -268,7 +401,7 @@ class Parser {
                 abort("Expected IDENT or X token");
             }
             consume(lexer::TokenType::RightParen); // )
-            return P{sym};
+            return P{sym, tape};
         }
 
         abort("Unknown action token: " + tok.token);
@@ -286,9 +419,30 @@ class Parser {
         return steps;
     }
 
-    /* TRANSITION := MATCH_STATE CONDITION ',' ACTION_LIST ',' FINAL_STATE */
-    Transition parse_transition() {
+    /* TERM := IDENT (LEFT_PAREN TERM (COMMA TERM)* RIGHT_PAREN)? */
+    Term parse_term() {
+        Term term;
+        auto storeName = [&](const lexer::Token &tok) {
+            term.name = tok.token;
+        };
+        if (currHasType(lexer::TokenType::X))
+            consume(lexer::TokenType::X, storeName);
+        else
+            consume(lexer::TokenType::IDENT, storeName);
+        if (!try_consume(lexer::TokenType::LeftParen))
+            return term;
+        term.args.push_back(parse_term());
+        while (try_consume(lexer::TokenType::COMMA))
+            term.args.push_back(parse_term());
+        consume(lexer::TokenType::RightParen);
+        return term;
+    }
+
+    /* TRANSITION := MATCH_STATE CONDITION ',' ACTION_LIST ',' FINAL_STATE
+       FINAL_STATE := TERM */
+    Transition parse_transition(Term &target) {
         Transition tr;
+        tr.line = curr_token.range.start.line;
 
         //  MATCH_STATE
         auto storeState = [&](const lexer::Token &tok) {
@@ -307,11 +461,9 @@ class Parser {
 
         consume(lexer::TokenType::COMMA);
 
-        //  FINAL_STATE
-        auto storeFinal = [&](const lexer::Token &tok) {
-            tr.finalState = tok.token;
-        };
-        consume(lexer::TokenType::IDENT, storeFinal);
+        //  FINAL_STATE, a state or an m-function call
+        target = parse_term();
+        tr.finalState = to_string(target);
 
         return tr;
     }
@@ -324,24 +476,80 @@ class Parser {
             if (!currHasType(lexer::TokenType::IDENT))
                 break;
 
-            tree.transitions.push_back(parse_transition());
+            Term target;
+            tree.transitions.push_back(parse_transition(target));
+            if (!target.args.empty())
+                tree.calls.push_back(target);
             // Each transition line ends with at least one NEWLINE
             skip_newlines();
         }
     }
 
+    // transition_list() of every piece of the rest of the source on a
+    // thread of its own; false, having parsed nothing, when the rest
+    // makes a single piece. Transitions span one line, so pieces cut at
+    // line starts parse alone. Errors are those of the first piece that
+    // fails, at the locations transition_list() would report.
+    bool parallel_transition_list();
+
+    /* FUNCTION := IDENT LEFT_PAREN IDENT (COMMA IDENT)* RIGHT_PAREN COLON
+                   NEWLINE (TRANSITION NEWLINE)* */
+    void function_definition() {
+        MFunction fn;
+        fn.line = curr_token.range.start.line;
+        std::string name;
+        auto storeName = [&](const lexer::Token &tok) { name = tok.token; };
+        consume(lexer::TokenType::IDENT, storeName);
+        fn.name = name;
+        consume(lexer::TokenType::LeftParen);
+        consume(lexer::TokenType::IDENT, storeName);
+        fn.params.push_back(name);
+        while (try_consume(lexer::TokenType::COMMA)) {
+            consume(lexer::TokenType::IDENT, storeName);
+            fn.params.push_back(name);
+        }
+        consume(lexer::TokenType::RightParen);
+        consume(lexer::TokenType::COLON);
+        consume(lexer::TokenType::NEWLINE);
+        skip_newlines();
+        // body lines start with a state and a comma, the next header with
+        // a name and a parenthesis
+        while (currHasType(lexer::TokenType::IDENT) &&
+               peekHasType(lexer::TokenType::COMMA)) {
+            Term target;
+            fn.body.push_back(parse_transition(target));
+            fn.targets.push_back(target);
+            skip_newlines();
+        }
+        if (fn.body.empty())
+            abort("m-function " + fn.name + " has no transitions");
+        tree.functions.push_back(fn);
+    }
+
+    /* FUNCTIONS_DECLARATION := "FUNCTIONS" ':' NEWLINE FUNCTION* */
+    void functions_declaration() {
+        consume(lexer::TokenType::FUNCTIONS);
+        consume(lexer::TokenType::COLON);
+        consume(lexer::TokenType::NEWLINE);
+        skip_newlines();
+        while (currHasType(lexer::TokenType::IDENT))
+            function_definition();
+    }
+
     /* TRANSITION_DECLARATION := "TRANSITIONS" ':' NEWLINE TRANSITION_LIST */
     void transition_declaration() {
         consume(lexer::TokenType::TRANSITIONS);
         consume(lexer::TokenType::COLON);
         consume(lexer::TokenType::NEWLINE);
         skip_newlines(); // allow blank lines before list
-        transition_list();
+        if (!parallel_transition_list())
+            transition_list();
     }
 
     /*──────────────────────────────  TOP‑LEVEL *
      * ──────────────────────────────────*/
     /*  PROGRAM := STATE_DECLARATION NEWLINE SYMBOL_DECLARATION NEWLINE
+     (TAPES_DECLARATION NEWLINE)? FUNCTIONS_DECLARATION?
      TRANSITION_DECLARATION */
     void parse() {
         skip_newlines(); // tolerate leading blank lines
@@ -354,11 +562,23 @@ class Parser {
         consume(lexer::TokenType::NEWLINE);
         skip_newlines();
 
+        if (currHasType(lexer::TokenType::TAPES)) {
+            tapes_declaration();
+            consume(lexer::TokenType::NEWLINE);
+            skip_newlines();
+        }
+
+        if (currHasType(lexer::TokenType::FUNCTIONS))
+            functions_declaration();
+
         transition_declaration();
         skip_newlines();
 
         // Program should end here
         consume(lexer::TokenType::EOF_TOKEN);
+
+        if (!tree.calls.empty())
+            expand_functions(tree);
     }
 };
 
@@ -0,0 +1,36 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace profile {
+
+// Execution counts per (state, symbol) case, as written by a program built
+// with --profile-generate. Keyed by name rather than index so a profile
+// stays valid across passes that renumber states (e.g. minimization).
+//
+// File format, one case per line, '#' starts a comment:
+//   <state> <symbol> <count>
+class Profile {
+  public:
+    std::map<std::pair<std::string, std::string>, uint64_t> counts;
+
+    uint64_t count(const std::string &state, const std::string &sym) const {
+        auto it = counts.find({state, sym});
+        return it == counts.end() ? 0 : it->second;
+    }
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (const auto &[_, c] : counts)
+            sum += c;
+        return sum;
+    }
+};
+
+Profile load_profile(const std::string &filename);
+
+} // namespace profile
+
+#endif
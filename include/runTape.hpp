@@ -0,0 +1,60 @@
+#ifndef RUN_TAPE_HPP
+#define RUN_TAPE_HPP
+#include <cstdint>
+#include <vector>
+
+namespace runTape {
+
+// A tape of fixed size kept as runs of equal symbols, for machines that
+// leave long stretches of one symbol behind them (binary counters,
+// Turing's sequence printers). Memory follows the number of runs, not the
+// number of cells.
+//
+// The runs form a gap buffer around the run under the head: `left` holds
+// the runs before it and `right` those after it, nearest last. Stepping
+// into the next run, a write and the merges it causes are O(1); neighbour
+// runs always differ in their symbol.
+class RunTape {
+  public:
+    struct Run {
+        int32_t sym;
+        uint64_t count;
+        bool operator==(const Run &other) const = default;
+    };
+
+  private:
+    std::vector<Run> left;
+    std::vector<Run> right;
+    Run cur;
+    // the head is cell `pos` of `cur`
+    uint64_t pos = 0;
+    int64_t headCell = 0;
+    uint64_t cells;
+
+  public:
+    // `size` cells of `blank`, head on cell 0
+    RunTape(uint64_t size, int32_t blank)
+        : cur{blank, size}, cells(size) {}
+
+    uint64_t size() const { return cells; }
+    int64_t head() const { return headCell; }
+    int32_t read() const { return cur.sym; }
+    // cells after the head in the direction of `by` that belong to its
+    // run
+    uint64_t runAhead(int64_t by) const {
+        return by > 0 ? cur.count - 1 - pos : pos;
+    }
+    uint64_t numRuns() const { return left.size() + 1 + right.size(); }
+
+    void write(int32_t sym);
+    // Moves the head `by` cells; it must stay on the tape.
+    void move(int64_t by);
+
+    // the runs from cell 0 on
+    std::vector<Run> runs() const;
+    std::vector<int32_t> dense() const;
+};
+
+} // namespace runTape
+
+#endif
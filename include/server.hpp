@@ -0,0 +1,90 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+#include "llvmBackend.hpp"
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+
+namespace server {
+
+// A compile daemon on a Unix domain socket. Clients write one JSON request
+// per line and read one JSON reply per line, in order, on as many
+// connections as they like. Requests run on a pool of worker threads that
+// each keep an LLVMContext warm, so a compile pays for neither process
+// start up nor a fresh context.
+//
+// Request:
+//   "path": "<file.sm>" | "source": "<.sm text>"
+//   "emit": "ir" (default) | "bc" | "cpp" | "lib" | "run"
+//   "name": header name of cpp, symbol prefix of lib
+//   "minimize": bool, "haltStates": [<state>...]
+//   "codegen": {fuse, trace, sweeps, layout, halt, exactTape,
+//               dispatch, tableStates, unroll, partitions,
+//               targetTriple, dataLayout}, defaults as on the command
+//               line
+//   "steps", "tape": steps and tape cells of run (tape defaults to 64),
+//               at most Options::maxSteps and maxTapeCells
+// Reply: {"ok": false, "error"} or {"ok": true} and
+//   ir:   "ir", "parts" (partition modules)
+//   bc:   "bc", "parts", base64 encoded
+//   cpp:  "header"
+//   lib:  "ir", "header"
+//   run:  "status", "steps", "state", "heads", "tapes" (symbol names)
+class Options {
+  public:
+    std::string socketPath;
+    // worker threads, 0: one per core
+    unsigned workers = 0;
+    // connections served at once, each on a thread of its own; more wait
+    // in the listen backlog
+    unsigned maxConnections = 64;
+    // Constants and types a context creates live as long as the context,
+    // so a worker starts a fresh one after this many requests.
+    unsigned recycleAfter = 256;
+    // Bounds of a run request, which ties up a worker for its steps and
+    // sends every cell back. Larger requests get an error reply.
+    uint64_t maxSteps = uint64_t(1) << 30;
+    uint64_t maxTapeCells = uint64_t(1) << 20;
+};
+
+nlohmann::json toJson(const llvmBackend::CodegenOptions &options);
+// Fields missing from `j` keep their defaults.
+llvmBackend::CodegenOptions codegenFromJson(const nlohmann::json &j);
+
+// Runs one request, building IR in `ctx`. Errors, requests past the
+// bounds of `limits` included, become the reply.
+nlohmann::json handle(const nlohmann::json &request, llvm::LLVMContext &ctx,
+                      const Options &limits);
+
+// Serves requests until SIGINT or SIGTERM, then hangs up on every
+// connection, waits for the requests already running and removes the
+// socket. A stale socket left at the path by an earlier server is
+// replaced.
+void serve(const Options &options);
+
+// One connection to a server.
+class Client {
+  private:
+    int fd = -1;
+    std::string buffer;
+
+  public:
+    explicit Client(const std::string &socketPath);
+    ~Client();
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+
+    nlohmann::json call(const nlohmann::json &request);
+};
+
+// Sends `request` `count` times on each of `clients` connections at once
+// and reports the latency of a round trip as seen by the client:
+// {"requests", "clients", "errors", "p50Us", "p90Us", "p99Us", "maxUs",
+// "perSecond"}
+nlohmann::json bench(const std::string &socketPath,
+                     const nlohmann::json &request, uint64_t count,
+                     unsigned clients);
+
+} // namespace server
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+#include "machine.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <nlohmann/json.hpp>
+#include <vector>
+
+namespace stats {
+
+// Where a run spends its steps: hits per dispatch case (indexed like
+// Machine::dispatch) and the head positions (of tape 1) it visited. Owned
+// by a single thread, so recording a step is a few plain increments.
+class Stats {
+  public:
+    static constexpr uint32_t NUM_BUCKETS = 64;
+
+    std::vector<uint64_t> caseHits;
+    int64_t minHead = std::numeric_limits<int64_t>::max();
+    int64_t maxHead = std::numeric_limits<int64_t>::min();
+    // head position -> bucket (head / bucketWidth), the first and last
+    // buckets take whatever lies left and right of the tape
+    uint64_t bucketWidth = 1;
+    std::vector<uint64_t> headHistogram;
+
+    Stats() = default;
+    Stats(const machine::Machine &m, uint64_t tapeSize)
+        : caseHits(m.dispatch.size(), 0),
+          bucketWidth(std::max<uint64_t>(
+              1, (tapeSize + NUM_BUCKETS - 1) / NUM_BUCKETS)),
+          headHistogram(NUM_BUCKETS, 0) {}
+
+    void hit(uint32_t dispatchIdx, int64_t head) {
+        ++caseHits[dispatchIdx];
+        minHead = std::min(minHead, head);
+        maxHead = std::max(maxHead, head);
+        ++headHistogram[head < 0 ? 0
+                                 : std::min<uint64_t>(head / bucketWidth,
+                                                      NUM_BUCKETS - 1)];
+    }
+    uint64_t steps() const;
+    // Adds `other` into this; both must describe the same machine and tape.
+    void merge(const Stats &other);
+};
+
+// {"steps", "cases": [{state, symbol, rule, line, hits}], "head": {min, max,
+// bucketWidth, histogram}}. Cases without a rule are left out; `line`
+// points back into the .sm source.
+nlohmann::json toJson(const machine::Machine &m, const Stats &stats);
+
+} // namespace stats
+
+#endif
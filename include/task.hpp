@@ -0,0 +1,73 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+#include "interpreter.hpp"
+#include "machine.hpp"
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <vector>
+
+namespace task {
+
+// A run of the interpreter as a C++20 coroutine, for schedulers that
+// interleave many long runs on a few threads. Every resume() takes one
+// slice of steps and suspends again; the configuration stays in the
+// coroutine frame in between, and after the run as long as the task
+// lives. Move only: destroying a task ends its run wherever it is.
+class MachineTask {
+  public:
+    struct promise_type {
+        // the by-value Interpreter parameter of run(). Parameter copies
+        // live as long as the frame, so this outlasts the coroutine body.
+        interpreter::Interpreter *interp;
+        std::exception_ptr error;
+
+        promise_type(interpreter::Interpreter &interp, uint64_t, uint64_t)
+            : interp(&interp) {}
+        MachineTask get_return_object() {
+            return MachineTask(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        // nothing runs before the first resume()
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    MachineTask(MachineTask &&other) noexcept;
+    MachineTask &operator=(MachineTask &&other) noexcept;
+    MachineTask(const MachineTask &) = delete;
+    MachineTask &operator=(const MachineTask &) = delete;
+    ~MachineTask();
+
+    // Runs the next slice. False once the run is over: the machine
+    // stopped or took every step it was given.
+    bool resume();
+    bool done() const { return !coro || coro.done(); }
+    // the configuration after the last slice
+    const interpreter::Interpreter &interpreter() const {
+        return *coro.promise().interp;
+    }
+
+  private:
+    explicit MachineTask(std::coroutine_handle<promise_type> coro)
+        : coro(coro) {}
+    std::coroutine_handle<promise_type> coro;
+};
+
+// Runs `interp` from its current configuration for at most `maxSteps`
+// more steps, `slice` of them per resume().
+MachineTask run(interpreter::Interpreter interp, uint64_t maxSteps,
+                uint64_t slice);
+// The same for `m` on blank tapes of `tapeSize` cells.
+MachineTask run(const machine::Machine &m, uint64_t tapeSize,
+                uint64_t maxSteps, uint64_t slice);
+
+// Resumes the tasks in turn, one slice each, until all of them are done.
+// Returns the number of slices run.
+uint64_t roundRobin(std::vector<MachineTask> &tasks);
+
+} // namespace task
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TIME_REPORT_HPP
+#define TIME_REPORT_HPP
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace timeReport {
+
+// One timed region of the compiler. Numbers include nested phases.
+class Phase {
+  public:
+    std::string name;
+    uint32_t depth = 0;
+    // since the report was enabled
+    double startUs = 0;
+    double wallUs = 0;
+    double cpuUs = 0;
+    // operator new calls and requested bytes inside the phase
+    uint64_t allocs = 0;
+    uint64_t allocBytes = 0;
+    // process high water mark when the phase ended
+    uint64_t peakRssKb = 0;
+};
+
+class TimeReport {
+  public:
+    bool enabled = false;
+    std::chrono::steady_clock::time_point origin;
+    uint32_t depth = 0;
+    // in the order the phases started
+    std::vector<Phase> phases;
+
+    // also starts counting allocations, which costs nothing before
+    void enable();
+};
+
+// The process wide report. Phases are recorded from the main thread only.
+TimeReport &get();
+
+// Times the enclosing block as a phase of get(); a no-op unless the report
+// is enabled.
+class Scope {
+  private:
+    int64_t index = -1;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart = 0;
+    uint64_t allocsStart = 0;
+    uint64_t bytesStart = 0;
+
+  public:
+    Scope(const std::string &name);
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+};
+
+// Aligned table, nested phases indented
+std::ostream &operator<<(std::ostream &os, const TimeReport &report);
+// {"phases": [{name, depth, startUs, wallUs, cpuUs, allocs, allocBytes,
+// peakRssKb}]}
+nlohmann::json toJson(const TimeReport &report);
+// Chrome trace-event format, one complete ("X") event per phase. Opens in
+// chrome://tracing and Perfetto.
+nlohmann::json toChromeTrace(const TimeReport &report);
+
+} // namespace timeReport
+
+#endif
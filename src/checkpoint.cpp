@@ -0,0 +1,171 @@
+#include "checkpoint.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+#include <stdexcept>
+
+namespace checkpoint {
+
+namespace fs = std::filesystem;
+
+static void requireSingleTape(const machine::Machine &m) {
+    if (m.tapes != 1)
+        throw std::runtime_error(
+            "[CHECKPOINT]: Checkpoints hold a single tape, the machine has " +
+            std::to_string(m.tapes));
+}
+
+Checkpoint Checkpoint::capture(const interpreter::Interpreter &interp) {
+    const auto &m = interp.getMachine();
+    requireSingleTape(m);
+    const auto &tape = interp.tapes[0];
+    Checkpoint ckpt;
+    ckpt.steps = interp.steps;
+    ckpt.state = m.states[interp.state];
+    ckpt.head = interp.heads[0];
+    ckpt.tapeSize = tape.size();
+    for (uint64_t i = 0; i < tape.size(); ++i) {
+        if (unsigned(tape[i]) == m.blank())
+            continue;
+        auto &runs = ckpt.runs;
+        if (runs.empty() || runs.back().start + runs.back().syms.size() != i)
+            runs.push_back({i, {}});
+        runs.back().syms.push_back(m.symbols[tape[i]]);
+    }
+    return ckpt;
+}
+
+uint64_t Checkpoint::frontier() const {
+    uint64_t out = std::max<int64_t>(head, 0);
+    for (const auto &run : runs)
+        out = std::max<uint64_t>(out, run.start + run.syms.size() - 1);
+    return out;
+}
+
+void Checkpoint::restore(interpreter::Interpreter &interp) const {
+    const auto &m = interp.getMachine();
+    requireSingleTape(m);
+    auto &tape = interp.tapes[0];
+    std::fill(tape.begin(), tape.end(), m.blank());
+    for (const auto &run : runs) {
+        if (run.start + run.syms.size() > tape.size())
+            throw std::runtime_error("[CHECKPOINT]: Tape of " +
+                                     std::to_string(tape.size()) +
+                                     " cells is too small for the checkpoint");
+        for (size_t i = 0; i < run.syms.size(); ++i)
+            tape[run.start + i] = m.symbolIndex(run.syms[i]);
+    }
+    interp.state = m.stateIndex(state);
+    interp.heads[0] = head;
+    interp.steps = steps;
+    interp.status = interpreter::Status::Running;
+}
+
+void Checkpoint::save(const std::string &filename) const {
+    std::stringstream ss;
+    ss << "smc-checkpoint 2\n";
+    ss << "steps " << steps << "\n";
+    ss << "state " << state << "\n";
+    ss << "head " << head << "\n";
+    ss << "tape " << tapeSize << "\n";
+    for (const auto &run : runs) {
+        ss << "run " << run.start;
+        for (size_t i = 0, j; i < run.syms.size(); i = j) {
+            for (j = i + 1; j < run.syms.size() && run.syms[j] == run.syms[i];)
+                ++j;
+            ss << " " << run.syms[i];
+            if (j - i > 1)
+                ss << "^" << j - i;
+        }
+        ss << "\n";
+    }
+    // a crash while writing must not destroy the previous checkpoint
+    dump_string_to_file(filename + ".tmp", ss.str());
+    fs::rename(filename + ".tmp", filename);
+}
+
+Checkpoint load_checkpoint(const std::string &filename) {
+    std::stringstream ss(read_file_to_string(filename));
+    auto fail = [&](uint32_t lineNo, const std::string &msg) {
+        return std::runtime_error("[CHECKPOINT]: " + filename + ":" +
+                                  std::to_string(lineNo) + ": " + msg);
+    };
+    Checkpoint ckpt;
+    std::string line;
+    uint32_t lineNo = 0;
+    // version 1 has no <symbol>^n, it reads the same otherwise
+    if (!std::getline(ss, line) ||
+        (line != "smc-checkpoint 1" && line != "smc-checkpoint 2"))
+        throw fail(1, "expected 'smc-checkpoint 2'");
+    for (lineNo = 2; std::getline(ss, line); ++lineNo) {
+        std::stringstream ls(line);
+        std::string key;
+        if (!(ls >> key))
+            continue;
+        bool ok = true;
+        if (key == "steps") {
+            ok = bool(ls >> ckpt.steps);
+        } else if (key == "state") {
+            ok = bool(ls >> ckpt.state);
+        } else if (key == "head") {
+            ok = bool(ls >> ckpt.head);
+        } else if (key == "tape") {
+            ok = bool(ls >> ckpt.tapeSize);
+        } else if (key == "run") {
+            Checkpoint::Run run;
+            ok = bool(ls >> run.start);
+            for (std::string sym; ok && ls >> sym;) {
+                uint64_t count = 1;
+                if (auto caret = sym.find('^'); caret != std::string::npos) {
+                    std::stringstream cs(sym.substr(caret + 1));
+                    ok = bool(cs >> count) && cs.eof() && count > 0 &&
+                         count <= ckpt.tapeSize;
+                    sym.resize(caret);
+                }
+                run.syms.insert(run.syms.end(), count, sym);
+            }
+            ckpt.runs.push_back(run);
+        } else {
+            throw fail(lineNo, "unknown key '" + key + "'");
+        }
+        if (!ok)
+            throw fail(lineNo, "expected a value after '" + key + "'");
+    }
+    if (ckpt.state.empty())
+        throw fail(lineNo, "missing 'state'");
+    return ckpt;
+}
+
+std::string fileFor(const std::string &prefix, uint64_t steps) {
+    return prefix + "." + std::to_string(steps) + ".ckpt";
+}
+
+std::optional<std::string> nearest(const std::string &prefix, uint64_t step) {
+    fs::path dir = fs::path(prefix).parent_path();
+    std::string stem = fs::path(prefix).filename().string() + ".";
+    std::optional<std::string> best;
+    uint64_t bestSteps = 0;
+    if (dir.empty())
+        dir = ".";
+    if (!fs::is_directory(dir))
+        return best;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(stem, 0) != 0 || entry.path().extension() != ".ckpt")
+            continue;
+        auto digits = name.substr(stem.size(),
+                                  name.size() - stem.size() - 5);
+        if (digits.empty() ||
+            digits.find_first_not_of("0123456789") != std::string::npos)
+            continue;
+        uint64_t steps = std::stoull(digits);
+        if (steps <= step && (!best || steps >= bestSteps)) {
+            best = entry.path().string();
+            bestSteps = steps;
+        }
+    }
+    return best;
+}
+
+} // namespace checkpoint
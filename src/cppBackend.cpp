@@ -0,0 +1,245 @@
+#include "cppBackend.hpp"
+#include "machine.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace cppBackend {
+
+// Shared by every generated header, guarded so several machines can be
+// included into the same translation unit.
+static const char *runtime = R"(#ifndef SMC_RUNTIME_DEFINED
+#define SMC_RUNTIME_DEFINED
+namespace smc {
+// One tape operation: optional print followed by an optional head move.
+struct Op {
+    std::int8_t move;      // -1: L, 0: stay, 1: R
+    std::int32_t print;    // symbol index or -1
+    std::uint8_t tape = 0; // 0 based, multi tape machines only
+};
+
+enum class Status : std::uint8_t { Running, Halted, OutOfTape };
+
+struct Result {
+    std::uint64_t steps;
+    std::int32_t state;
+    std::size_t head;
+    Status status;
+};
+
+// Whether every cell rule `rule` visits on tape `t` lies on a tape of
+// `len` cells, checked before the rule touches the tape.
+template <class M>
+constexpr bool reaches(std::int32_t rule, std::size_t t, std::size_t head,
+                       std::size_t len) {
+    const std::int32_t lo = M::minOffset[rule * M::tapes + t];
+    const std::int32_t hi = M::maxOffset[rule * M::tapes + t];
+    return head >= std::size_t(-lo) && head + hi < len;
+}
+
+// Runs machine M for at most `steps` steps. `tape` is any random access
+// container of symbol indices (std::array works in constant expressions).
+// The machine halts when no transition matches (state, symbol). A rule
+// that would leave the tape is not applied at all.
+template <class M, class Tape>
+constexpr Result run(Tape &tape, std::uint64_t steps, std::size_t head = 0,
+                     std::int32_t state = M::initial) {
+    const std::size_t len = std::size(tape);
+    if (head >= len)
+        return {0, state, head, Status::OutOfTape};
+    for (std::uint64_t n = 0; n < steps; ++n) {
+        const std::int32_t rule =
+            M::dispatch[state * M::numSymbols + tape[head]];
+        if (rule < 0)
+            return {n, state, head, Status::Halted};
+        if (!reaches<M>(rule, 0, head, len))
+            return {n, state, head, Status::OutOfTape};
+        for (std::int32_t i = M::opBegin[rule]; i < M::opBegin[rule + 1];
+             ++i) {
+            const Op op = M::ops[i];
+            if (op.print >= 0)
+                tape[head] = op.print;
+            head += op.move;
+        }
+        state = M::next[rule];
+    }
+    return {steps, state, head, Status::Running};
+}
+
+// Multi tape form of run(): `tapes` holds M::tapes tapes of the same
+// length and `heads` a head for each. The rule is picked by the symbols
+// under all heads, tape 1 varying fastest. Result::head is the head of
+// tape 1.
+template <class M, class Tapes, class Heads>
+constexpr Result runTapes(Tapes &tapes, Heads &heads, std::uint64_t steps,
+                          std::int32_t state = M::initial) {
+    const std::size_t len = std::size(tapes[0]);
+    for (std::size_t t = 0; t < M::tapes; ++t)
+        if (std::size_t(heads[t]) >= len)
+            return {0, state, heads[0], Status::OutOfTape};
+    for (std::uint64_t n = 0; n < steps; ++n) {
+        std::int32_t combo = 0;
+        for (std::size_t t = M::tapes; t-- > 0;)
+            combo = combo * M::numSymbols + tapes[t][heads[t]];
+        const std::int32_t rule = M::dispatch[state * M::numCombos + combo];
+        if (rule < 0)
+            return {n, state, heads[0], Status::Halted};
+        for (std::size_t t = 0; t < M::tapes; ++t)
+            if (!reaches<M>(rule, t, heads[t], len))
+                return {n, state, heads[0], Status::OutOfTape};
+        for (std::int32_t i = M::opBegin[rule]; i < M::opBegin[rule + 1];
+             ++i) {
+            const Op op = M::ops[i];
+            auto &head = heads[op.tape];
+            if (op.print >= 0)
+                tapes[op.tape][head] = op.print;
+            head += op.move;
+        }
+        state = M::next[rule];
+    }
+    return {steps, state, heads[0], Status::Running};
+}
+
+// Fills the tape with the blank symbol of M.
+template <class M, class Tape> constexpr void clear(Tape &tape) {
+    for (auto &cell : tape)
+        cell = M::blank;
+}
+} // namespace smc
+#endif
+)";
+
+static std::string sanitize(const std::string &name) {
+    std::string out;
+    for (char c : name)
+        out += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+    if (out.empty() || std::isdigit(static_cast<unsigned char>(out[0])))
+        out = "m_" + out;
+    return out;
+}
+
+template <class T> static std::vector<std::string> strings(const T &elems) {
+    std::vector<std::string> out;
+    for (const auto &e : elems) {
+        std::stringstream ss;
+        ss << e;
+        out.push_back(ss.str());
+    }
+    return out;
+}
+
+static std::vector<std::string> quoted(const std::vector<std::string> &elems) {
+    std::vector<std::string> out;
+    for (const auto &e : elems)
+        out.push_back('"' + e + '"');
+    return out;
+}
+
+void CppBackend::getHeader(const std::string &name) {
+    const auto &m = machine;
+    const std::string id = sanitize(name);
+    std::string guard = "SMC_MACHINE_" + id + "_HPP";
+    for (auto &c : guard)
+        c = std::toupper(static_cast<unsigned char>(c));
+
+    // Flatten every rule's steps into one op array, X steps vanish here.
+    std::vector<std::string> ops;
+    std::vector<int32_t> opBegin;
+    std::vector<int32_t> next;
+    // furthest cells each rule visits on each tape, relative to the head
+    std::vector<int32_t> minOffset;
+    std::vector<int32_t> maxOffset;
+    for (const auto &T : m.rules) {
+        opBegin.push_back(ops.size());
+        std::vector<int32_t> head(m.tapes, 0);
+        const size_t reach = minOffset.size();
+        minOffset.resize(reach + m.tapes, 0);
+        maxOffset.resize(reach + m.tapes, 0);
+        next.push_back(m.stateIndex(T.finalState));
+        auto lower = overloaded{
+            [&](const parser::L &) { return std::string("{-1, -1"); },
+            [&](const parser::R &) { return std::string("{1, -1"); },
+            [&](const parser::X &) { return std::string(); },
+            [&](const parser::P &p) {
+                return "{0, " + std::to_string(m.symbolIndex(p.sym));
+            },
+        };
+        for (const auto &st : T.steps) {
+            auto op = std::visit(lower, st);
+            if (op.empty())
+                continue;
+            unsigned tape = parser::tapeOf(st);
+            head[tape] += std::holds_alternative<parser::L>(st)   ? -1
+                          : std::holds_alternative<parser::R>(st) ? 1
+                                                                  : 0;
+            minOffset[reach + tape] =
+                std::min(minOffset[reach + tape], head[tape]);
+            maxOffset[reach + tape] =
+                std::max(maxOffset[reach + tape], head[tape]);
+            ops.push_back(op + (tape ? ", " + std::to_string(tape) : "") +
+                          "}");
+        }
+    }
+    opBegin.push_back(ops.size());
+
+    Indent in1(4);
+    Indent in2(8);
+    std::stringstream os;
+    os << Line("// Generated by smc - do not edit.");
+    os << Line("#ifndef " + guard);
+    os << Line("#define " + guard);
+    os << Line("#include <array>");
+    os << Line("#include <cstddef>");
+    os << Line("#include <cstdint>");
+    os << Line("#include <iterator>");
+    os << Line();
+    os << runtime;
+    os << Line();
+    os << Line("namespace smc::machines {");
+    os << Line("struct " + id + " {");
+    auto constant = [&](const std::string &decl, size_t value) {
+        os << Line(in1, "static constexpr std::int32_t " + decl + " = " +
+                            std::to_string(value) + ";");
+    };
+    constant("numStates", m.numStates());
+    constant("numSymbols", m.numSymbols());
+    constant("tapes", m.tapes);
+    constant("numCombos", m.numCombos());
+    constant("blank", m.blank());
+    constant("initial", m.initialState);
+    auto array = [&](const std::string &type, const std::string &decl,
+                     const std::vector<std::string> &elems) {
+        os << Line(in1, "static constexpr std::array<" + type + ", " +
+                            std::to_string(elems.size()) + "> " + decl +
+                            " = {{");
+        // keep generated lines short, big machines have big tables
+        const size_t perLine = 8;
+        for (size_t i = 0; i < elems.size(); i += perLine) {
+            std::string text;
+            for (size_t j = i; j < std::min(i + perLine, elems.size()); ++j)
+                text += elems[j] + (j + 1 == elems.size() ? "" : ", ");
+            os << Line(in2, text.substr(0, text.find_last_not_of(' ') + 1));
+        }
+        os << Line(in1, "}};");
+    };
+    array("const char *", "symbols", quoted(m.symbols));
+    array("const char *", "states", quoted(m.states));
+    array("smc::Op", "ops", ops);
+    array("std::int32_t", "opBegin", strings(opBegin));
+    array("std::int32_t", "next", strings(next));
+    // rule major: minOffset[rule * tapes + tape], see reaches()
+    array("std::int32_t", "minOffset", strings(minOffset));
+    array("std::int32_t", "maxOffset", strings(maxOffset));
+    // state major: dispatch[state * numCombos + combo], see runTapes()
+    array("std::int32_t", "dispatch", strings(m.dispatch));
+    os << Line("};");
+    os << Line("} // namespace smc::machines");
+    os << Line("#endif");
+    header = os.str();
+}
+
+} // namespace cppBackend
@@ -0,0 +1,178 @@
+#include "interpreter.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace interpreter {
+
+using machine::Machine;
+
+std::ostream &operator<<(std::ostream &os, Status status) {
+    switch (status) {
+    case Status::Running:
+        return os << "running";
+    case Status::Halted:
+        return os << "halted";
+    case Status::OutOfTape:
+        return os << "out of tape";
+    }
+    return os;
+}
+
+Interpreter::Interpreter(const Machine &m, uint64_t tapeSize)
+    : machine(m), tapes(m.tapes, std::vector<int32_t>(tapeSize, m.blank())),
+      heads(m.tapes, 0), state(m.initialState) {
+    for (const auto &T : machine.rules) {
+        for (unsigned t = 0; t < machine.tapes; ++t)
+            ops.push_back(optimizer::fuseSteps(machine, T.steps, t));
+        next.push_back(machine.stateIndex(T.finalState));
+    }
+    sweeps = optimizer::sweeps(machine);
+}
+
+Status Interpreter::run(uint64_t maxSteps, stats::Stats *stats) {
+    if (machine.tapes == 1)
+        return runSingle(maxSteps, stats);
+    return runMulti(maxSteps, stats);
+}
+
+Status Interpreter::runSingle(uint64_t maxSteps, stats::Stats *stats) {
+    auto &tape = tapes[0];
+    auto &head = heads[0];
+    const int64_t size = tape.size();
+    for (uint64_t i = 0; i < maxSteps; ++i) {
+        if (head < 0 || head >= size)
+            return status = Status::OutOfTape;
+        const unsigned idx = state * machine.numSymbols() + tape[head];
+        const auto rule = machine.dispatch[idx];
+        if (rule == Machine::NO_RULE)
+            return status = Status::Halted;
+        const auto &op = ops[rule];
+        if (head + op.minOffset < 0 || head + op.maxOffset >= size)
+            return status = Status::OutOfTape;
+        // a sweep: run to the first cell that leaves the loop without
+        // going through the dispatch for every cell
+        if (const auto &sw = sweeps[state];
+            !stats && sw.move && sw.symbols[tape[head]]) {
+            head += sw.move;
+            uint64_t taken = 1;
+            while (i + taken < maxSteps && head + sw.minOffset >= 0 &&
+                   head + sw.maxOffset < size && sw.symbols[tape[head]]) {
+                head += sw.move;
+                ++taken;
+            }
+            steps += taken;
+            i += taken - 1;
+            continue;
+        }
+        if (stats)
+            stats->hit(idx, head);
+        for (auto [offset, sym] : op.writes)
+            tape[head + offset] = sym;
+        head += op.move;
+        state = next[rule];
+        ++steps;
+    }
+    return status = Status::Running;
+}
+
+Status Interpreter::runMulti(uint64_t maxSteps, stats::Stats *stats) {
+    const unsigned k = machine.tapes;
+    const unsigned numSymbols = machine.numSymbols();
+    const unsigned numCombos = machine.numCombos();
+    const int64_t size = tapes[0].size();
+    for (uint64_t i = 0; i < maxSteps; ++i) {
+        unsigned combo = 0;
+        for (unsigned t = k; t-- > 0;) {
+            if (heads[t] < 0 || heads[t] >= size)
+                return status = Status::OutOfTape;
+            combo = combo * numSymbols + tapes[t][heads[t]];
+        }
+        const unsigned idx = state * numCombos + combo;
+        const auto rule = machine.dispatch[idx];
+        if (rule == Machine::NO_RULE)
+            return status = Status::Halted;
+        const auto *op = &ops[rule * k];
+        for (unsigned t = 0; t < k; ++t)
+            if (heads[t] + op[t].minOffset < 0 ||
+                heads[t] + op[t].maxOffset >= size)
+                return status = Status::OutOfTape;
+        if (stats)
+            stats->hit(idx, heads[0]);
+        for (unsigned t = 0; t < k; ++t) {
+            for (auto [offset, sym] : op[t].writes)
+                tapes[t][heads[t] + offset] = sym;
+            heads[t] += op[t].move;
+        }
+        state = next[rule];
+        ++steps;
+    }
+    return status = Status::Running;
+}
+
+RunInterpreter::RunInterpreter(const Machine &m, uint64_t tapeSize)
+    : machine(m), tape(tapeSize, m.blank()), state(m.initialState) {
+    if (m.tapes != 1)
+        throw std::runtime_error("[INTERPRETER]: Run length tapes need a "
+                                 "single tape machine");
+    for (const auto &T : machine.rules) {
+        ops.push_back(optimizer::fuseSteps(machine, T.steps));
+        next.push_back(machine.stateIndex(T.finalState));
+    }
+    sweeps = optimizer::sweeps(machine);
+}
+
+Status RunInterpreter::run(uint64_t maxSteps) {
+    const int64_t size = tape.size();
+    for (uint64_t i = 0; i < maxSteps; ++i) {
+        const int64_t head = tape.head();
+        if (head < 0 || head >= size)
+            return status = Status::OutOfTape;
+        const unsigned idx = state * machine.numSymbols() + tape.read();
+        const auto rule = machine.dispatch[idx];
+        if (rule == Machine::NO_RULE)
+            return status = Status::Halted;
+        const auto &op = ops[rule];
+        if (head + op.minOffset < 0 || head + op.maxOffset >= size)
+            return status = Status::OutOfTape;
+        // a sweep: every step that starts in the run under the head at
+        // once, the steps Interpreter::run takes one by one
+        if (const auto &sw = sweeps[state];
+            sw.move && sw.symbols[tape.read()]) {
+            const int64_t stride = std::abs(sw.move);
+            // heads a step of the loop may start from
+            const int64_t lo = -sw.minOffset;
+            const int64_t hi = size - 1 - sw.maxOffset;
+            tape.move(sw.move);
+            uint64_t taken = 1;
+            while (i + taken < maxSteps) {
+                const int64_t h = tape.head();
+                if (h < lo || h > hi || !sw.symbols[tape.read()])
+                    break;
+                const uint64_t room =
+                    (sw.move > 0 ? hi - h : h - lo) / stride;
+                const uint64_t k =
+                    std::min({tape.runAhead(sw.move) / stride, room,
+                              maxSteps - i - taken - 1}) +
+                    1;
+                tape.move(k * sw.move);
+                taken += k;
+            }
+            steps += taken;
+            i += taken - 1;
+            continue;
+        }
+        int32_t at = 0;
+        for (auto [offset, sym] : op.writes) {
+            tape.move(offset - at);
+            tape.write(sym);
+            at = offset;
+        }
+        tape.move(op.move - at);
+        state = next[rule];
+        ++steps;
+    }
+    return status = Status::Running;
+}
+
+} // namespace interpreter
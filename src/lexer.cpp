@@ -1,4 +1,5 @@
 #include "lexer.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <map>
 #include <optional>
@@ -12,6 +13,8 @@ const std::map<std::string, TokenType> tokenMap = {
     {"STATES", TokenType::STATES},
     {"SYMBOLS", TokenType::SYMBOLS},
     {"TRANSITIONS", TokenType::TRANSITIONS},
+    {"TAPES", TokenType::TAPES},
+    {"FUNCTIONS", TokenType::FUNCTIONS},
     {"R", TokenType::R},
     {"L", TokenType::L},
     {"X", TokenType::X},
@@ -33,6 +36,8 @@ const std::map<TokenType, std::string> tokenToString = {
     {TokenType::STATES, "STATES"},
     {TokenType::SYMBOLS, "SYMBOLS"},
     {TokenType::TRANSITIONS, "TRANSITIONS"},
+    {TokenType::TAPES, "TAPES"},
+    {TokenType::FUNCTIONS, "FUNCTIONS"},
     {TokenType::R, "R"},
     {TokenType::L, "L"},
     {TokenType::X, "X"},
@@ -112,6 +117,31 @@ Token::check_if_keyword(const std::string &token_text) {
     }
     return std::nullopt;
 }
+std::vector<std::unique_ptr<Lexer>>
+Lexer::split(const Location &from, unsigned pieces, size_t minBytes) const {
+    // offsets into `source`, whose terminator is not part of the text
+    const auto text = source.begin();
+    const size_t end = source.size() - 1;
+    size_t begin = std::min<size_t>(from.index - base, end);
+    const size_t target = std::max<size_t>(
+        {minBytes, 1, (end - begin + pieces - 1) / std::max(pieces, 1u)});
+    std::vector<std::unique_ptr<Lexer>> out;
+    Location start = from;
+    while (begin < end) {
+        // one past the newline that ends the line the cut falls in
+        auto cut = std::find(text + std::min(end, begin + target) - 1,
+                             text + end, '\n');
+        if (cut != text + end)
+            ++cut;
+        out.push_back(std::make_unique<Lexer>(
+            std::vector<char>(text + begin, cut), srcfile, start));
+        const auto lines = std::count(text + begin, cut, '\n');
+        begin = cut - text;
+        start = Location(begin + base, start.line + lines, 1);
+    }
+    return out;
+}
+
 void log_info(const std::string &message) {
     std::cout << "[INFO] Lexer: " << message << std::endl;
 };
@@ -1,6 +1,23 @@
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "stats.hpp"
+#include "timeReport.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DataLayout.h>
 #include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/ProfileSummary.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/Support/FormatVariadic.h>
 #include <llvm/Support/raw_ostream.h>
@@ -10,10 +27,13 @@
 #include <llvm/ir/LLVMContext.h>
 #include <llvm/ir/Module.h>
 #include <llvmBackend.hpp>
+#include <map>
+#include <optional>
 #include <ostream>
+#include <set>
 #include <sstream>
 #include <string>
-#include <unordered_set>
+#include <thread>
 #include <variant>
 
 namespace llvmBackend {
@@ -46,15 +66,1233 @@ static void buildPrintf(IRBuilder<> &B, Function *printfFn, llvm::StringRef fmt,
     B.CreateCall(printfFn, args);
 }
 
-void LllvmBackend::getIr() {
-    LLVMContext ctx;
-    Module mod("tape_machine_fixed", ctx);
+/// Constant array of C strings, indexed like `names`. Reused when several
+/// writers ask for the same table.
+static llvm::GlobalVariable *
+nameTable(Module &mod, llvm::ArrayRef<llvm::Constant *> names,
+          const std::string &name) {
+    if (auto *table = mod.getNamedGlobal(name))
+        return table;
+    auto *ty = llvm::ArrayType::get(names.front()->getType(), names.size());
+    return new llvm::GlobalVariable(mod, ty, true, GlobalValue::PrivateLinkage,
+                                    llvm::ConstantArray::get(ty, names), name);
+}
+
+/// Write the non-zero entries of `counts` (one i64 per dispatch case,
+/// numbered symIdx * #states + stateIdx) to `path` in the profile::Profile
+/// text format.
+static void buildProfileWrite(IRBuilder<> &B, Module &mod, Function *fn,
+                              llvm::GlobalVariable *counts,
+                              llvm::ArrayRef<llvm::Constant *> stateNames,
+                              llvm::ArrayRef<llvm::Constant *> symNames,
+                              const std::string &path) {
+    auto &ctx = B.getContext();
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
+    auto *ptrTy = B.getPtrTy();
+    auto fopenFn = mod.getOrInsertFunction(
+        "fopen", FunctionType::get(ptrTy, {ptrTy, ptrTy}, false));
+    auto fprintfFn = mod.getOrInsertFunction(
+        "fprintf", FunctionType::get(i32, {ptrTy, ptrTy}, true));
+    auto fcloseFn = mod.getOrInsertFunction(
+        "fclose", FunctionType::get(i32, {ptrTy}, false));
+    auto *stateTable = nameTable(mod, stateNames, "state_names");
+    auto *symTable = nameTable(mod, symNames, "symbol_names");
+    const unsigned totalStates = stateNames.size();
+    const unsigned totalCases = stateNames.size() * symNames.size();
+
+    BasicBlock *open = B.GetInsertBlock();
+    BasicBlock *loop = BasicBlock::Create(ctx, "profile_loop", fn);
+    BasicBlock *body = BasicBlock::Create(ctx, "profile_body", fn);
+    BasicBlock *write = BasicBlock::Create(ctx, "profile_write", fn);
+    BasicBlock *next = BasicBlock::Create(ctx, "profile_next", fn);
+    BasicBlock *close = BasicBlock::Create(ctx, "profile_close", fn);
+    BasicBlock *done = BasicBlock::Create(ctx, "profile_done", fn);
+
+    auto *file = B.CreateCall(fopenFn, {B.CreateGlobalString(path),
+                                        B.CreateGlobalString("w")});
+    B.CreateCondBr(B.CreateIsNull(file), done, loop);
+
+    B.SetInsertPoint(loop);
+    auto *caseNo = B.CreatePHI(i32, 2, "profile_case");
+    caseNo->addIncoming(B.getInt32(0), open);
+    B.CreateCondBr(B.CreateICmpULT(caseNo, B.getInt32(totalCases)), body,
+                   close);
+
+    B.SetInsertPoint(body);
+    auto *count = B.CreateLoad(
+        i64, B.CreateGEP(counts->getValueType(), counts,
+                         {B.getInt32(0), caseNo}));
+    B.CreateCondBr(B.CreateICmpEQ(count, B.getInt64(0)), next, write);
+
+    B.SetInsertPoint(write);
+    auto *q = B.CreateURem(caseNo, B.getInt32(totalStates));
+    auto *s = B.CreateUDiv(caseNo, B.getInt32(totalStates));
+    auto *stateName = B.CreateLoad(
+        ptrTy, B.CreateGEP(stateTable->getValueType(), stateTable,
+                           {B.getInt32(0), q}));
+    auto *symName = B.CreateLoad(
+        ptrTy, B.CreateGEP(symTable->getValueType(), symTable,
+                           {B.getInt32(0), s}));
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString("%s %s %llu\n"),
+                             stateName, symName, count});
+    B.CreateBr(next);
+
+    B.SetInsertPoint(next);
+    caseNo->addIncoming(B.CreateAdd(caseNo, B.getInt32(1)), next);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(close);
+    B.CreateCall(fcloseFn, {file});
+    B.CreateBr(done);
+
+    B.SetInsertPoint(done);
+}
+
+/// `void smc_checkpoint(ptr tape, i64 cells, i64 steps, i32 state,
+/// i64 head)`: writes the configuration to `<prefix>.<steps>.ckpt` in the
+/// checkpoint::Checkpoint format, through a temporary file and rename() so
+/// that a crash never leaves a torn checkpoint behind.
+static Function *buildCheckpointFn(Module &mod, const machine::Machine &m,
+                                   const std::string &prefix) {
+    auto &ctx = mod.getContext();
     IRBuilder<> B(ctx);
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
+    auto *ptrTy = B.getPtrTy();
+    auto *fn = Function::Create(
+        FunctionType::get(B.getVoidTy(), {ptrTy, i64, i64, i32, i64}, false),
+        GlobalValue::InternalLinkage, "smc_checkpoint", mod);
+    fn->addFnAttr(llvm::Attribute::Cold);
+    fn->addFnAttr(llvm::Attribute::NoInline);
+    auto *tape = fn->getArg(0);
+    auto *cells = fn->getArg(1);
+    auto *steps = fn->getArg(2);
+    auto *state = fn->getArg(3);
+    auto *head = fn->getArg(4);
+
+    auto snprintfFn = mod.getOrInsertFunction(
+        "snprintf", FunctionType::get(i32, {ptrTy, i64, ptrTy}, true));
+    auto fopenFn = mod.getOrInsertFunction(
+        "fopen", FunctionType::get(ptrTy, {ptrTy, ptrTy}, false));
+    auto fprintfFn = mod.getOrInsertFunction(
+        "fprintf", FunctionType::get(i32, {ptrTy, ptrTy}, true));
+    auto fcloseFn = mod.getOrInsertFunction(
+        "fclose", FunctionType::get(i32, {ptrTy}, false));
+    auto renameFn = mod.getOrInsertFunction(
+        "rename", FunctionType::get(i32, {ptrTy, ptrTy}, false));
 
-    Triple triple("arm64-apple-macosx13.0.0");
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *header = BasicBlock::Create(ctx, "header", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "tape_loop", fn);
+    BasicBlock *body = BasicBlock::Create(ctx, "tape_body", fn);
+    BasicBlock *runCheck = BasicBlock::Create(ctx, "run_check", fn);
+    BasicBlock *runStart = BasicBlock::Create(ctx, "run_start", fn);
+    BasicBlock *symbol = BasicBlock::Create(ctx, "symbol", fn);
+    BasicBlock *same = BasicBlock::Create(ctx, "same", fn);
+    BasicBlock *repeat = BasicBlock::Create(ctx, "repeat", fn);
+    BasicBlock *next = BasicBlock::Create(ctx, "next", fn);
+    BasicBlock *close = BasicBlock::Create(ctx, "close", fn);
+    BasicBlock *done = BasicBlock::Create(ctx, "done", fn);
+
+    B.SetInsertPoint(entry);
+    std::vector<llvm::Constant *> stateNames, symNames;
+    for (const auto &name : m.states)
+        stateNames.push_back(B.CreateGlobalString(name, "ckpt_state_" + name));
+    for (const auto &name : m.symbols)
+        symNames.push_back(B.CreateGlobalString(name, "ckpt_sym_" + name));
+    auto *stateTable = nameTable(mod, stateNames, "ckpt_state_names");
+    auto *symTable = nameTable(mod, symNames, "ckpt_symbol_names");
+    const unsigned blank = m.blank();
+    const unsigned pathMax = 4096;
+    auto *path = B.CreateAlloca(llvm::ArrayType::get(B.getInt8Ty(), pathMax));
+    auto *tmp = B.CreateAlloca(llvm::ArrayType::get(B.getInt8Ty(), pathMax));
+    B.CreateCall(snprintfFn, {path, B.getInt64(pathMax),
+                              B.CreateGlobalString("%s.%llu.ckpt"),
+                              B.CreateGlobalString(prefix), steps});
+    B.CreateCall(snprintfFn, {tmp, B.getInt64(pathMax),
+                              B.CreateGlobalString("%s.tmp"), path});
+    auto *file = B.CreateCall(fopenFn, {tmp, B.CreateGlobalString("w")});
+    B.CreateCondBr(B.CreateIsNull(file), done, header);
+
+    B.SetInsertPoint(header);
+    auto *stateName = B.CreateLoad(
+        ptrTy, B.CreateGEP(stateTable->getValueType(), stateTable,
+                           {B.getInt32(0), state}));
+    B.CreateCall(fprintfFn,
+                 {file,
+                  B.CreateGlobalString("smc-checkpoint 2\nsteps %llu\n"
+                                       "state %s\nhead %lld\ntape %llu"),
+                  steps, stateName, head, cells});
+    B.CreateBr(loop);
+
+    // one "run <start> <sym>..." line per stretch of non-blank cells
+    B.SetInsertPoint(loop);
+    auto *idx = B.CreatePHI(i64, 3, "idx");
+    idx->addIncoming(B.getInt64(0), header);
+    B.CreateCondBr(B.CreateICmpULT(idx, cells), body, close);
+
+    B.SetInsertPoint(body);
+    auto *cell = B.CreateLoad(i32, B.CreateGEP(i32, tape, {idx}));
+    BasicBlock *nonBlank = BasicBlock::Create(ctx, "non_blank", fn, runCheck);
+    B.CreateCondBr(B.CreateICmpEQ(cell, B.getInt32(blank)), next, nonBlank);
+
+    B.SetInsertPoint(nonBlank);
+    B.CreateCondBr(B.CreateICmpEQ(idx, B.getInt64(0)), runStart, runCheck);
+
+    B.SetInsertPoint(runCheck);
+    auto *prevIdx = B.CreateSub(idx, B.getInt64(1));
+    auto *prev = B.CreateLoad(i32, B.CreateGEP(i32, tape, {prevIdx}));
+    B.CreateCondBr(B.CreateICmpEQ(prev, B.getInt32(blank)), runStart, symbol);
+
+    B.SetInsertPoint(runStart);
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString("\nrun %lld"), idx});
+    B.CreateBr(symbol);
+
+    // a stretch of n > 1 equal cells goes out as <symbol>^n
+    B.SetInsertPoint(symbol);
+    auto *symName = B.CreateLoad(
+        ptrTy, B.CreateGEP(symTable->getValueType(), symTable,
+                           {B.getInt32(0), cell}));
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString(" %s"), symName});
+    auto *afterSym = B.CreateAdd(idx, B.getInt64(1));
+    B.CreateBr(same);
+
+    B.SetInsertPoint(same);
+    auto *end = B.CreatePHI(i64, 2, "end");
+    end->addIncoming(afterSym, symbol);
+    BasicBlock *sameBody = BasicBlock::Create(ctx, "same_body", fn, repeat);
+    B.CreateCondBr(B.CreateICmpULT(end, cells), sameBody, repeat);
+
+    B.SetInsertPoint(sameBody);
+    auto *other = B.CreateLoad(i32, B.CreateGEP(i32, tape, {end}));
+    end->addIncoming(B.CreateAdd(end, B.getInt64(1)), sameBody);
+    B.CreateCondBr(B.CreateICmpEQ(other, cell), same, repeat);
+
+    B.SetInsertPoint(repeat);
+    auto *count = B.CreateSub(end, idx);
+    BasicBlock *printCount = BasicBlock::Create(ctx, "print_count", fn, next);
+    BasicBlock *skip = BasicBlock::Create(ctx, "skip", fn, next);
+    B.CreateCondBr(B.CreateICmpUGT(count, B.getInt64(1)), printCount, skip);
+
+    B.SetInsertPoint(printCount);
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString("^%llu"), count});
+    B.CreateBr(skip);
+
+    B.SetInsertPoint(skip);
+    idx->addIncoming(end, skip);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(next);
+    idx->addIncoming(B.CreateAdd(idx, B.getInt64(1)), next);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(close);
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString("\n")});
+    B.CreateCall(fcloseFn, {file});
+    B.CreateCall(renameFn, {tmp, path});
+    B.CreateBr(done);
+
+    B.SetInsertPoint(done);
+    B.CreateRetVoid();
+    return fn;
+}
+
+/// Emits the action list of `T` at the insertion point. `h` and `c` hold
+/// the head pointer and the cached cell of every tape on entry and are
+/// updated to their values after the transition. A cell goes back to memory
+/// only when its head moves off it.
+static void lowerActions(IRBuilder<> &B, const machine::Machine &m,
+                         const Transition &T, bool fuse, std::vector<BV> &h,
+                         std::vector<BV> &c) {
+    auto &ctx = B.getContext();
+    auto *i32 = B.getInt32Ty();
+    auto moveHead = [&](unsigned t, int32_t offset) {
+        B.CreateStore(c[t], h[t]);
+        h[t] = B.CreateGEP(i32, h[t], {B.getInt32(offset)});
+        c[t] = B.CreateLoad(i32, h[t]);
+    };
+    auto TransitionAction = overloaded{
+        [&](const parser::L &l) { moveHead(l.tape, -1); },
+        [&](const parser::R &r) { moveHead(r.tape, 1); },
+        [&](const parser::X) {
+            // noop
+        },
+        [&](const parser::P &p) {
+            c[p.tape] = llvm::ConstantInt::get(i32, m.symbolIndex(p.sym));
+        },
+    };
+    if (!fuse) {
+        for (TransitionStep st : T.steps) {
+            std::visit(TransitionAction, st);
+        }
+        return;
+    }
+    // fused, tape by tape: one store per run of adjacent cells other than
+    // the cached one (a vector store for runs longer than one), then at most
+    // one write back and one reload
+    for (unsigned t = 0; t < m.tapes; ++t) {
+        auto fused = optimizer::fuseSteps(m, T.steps, t);
+        bool cellStored = false;
+        for (const auto &run : fused.runs()) {
+            int32_t last = run.offset + int32_t(run.syms.size()) - 1;
+            bool coversHead = run.offset <= 0 && 0 <= last;
+            if (coversHead)
+                c[t] = llvm::ConstantInt::get(i32, run.syms[-run.offset]);
+            if (run.syms.size() == 1 && coversHead)
+                continue;
+            cellStored |= coversHead;
+            auto *gep = B.CreateGEP(i32, h[t], {B.getInt32(run.offset)});
+            if (run.syms.size() == 1) {
+                B.CreateStore(llvm::ConstantInt::get(i32, run.syms[0]), gep);
+                continue;
+            }
+            std::vector<uint32_t> elems(run.syms.begin(), run.syms.end());
+            auto *wide = llvm::ConstantDataVector::get(ctx, elems);
+            B.CreateAlignedStore(wide, gep, llvm::Align(4));
+        }
+        if (fused.move != 0) {
+            if (!cellStored)
+                B.CreateStore(c[t], h[t]);
+            h[t] = B.CreateGEP(i32, h[t], {B.getInt32(fused.move)});
+            c[t] = B.CreateLoad(i32, h[t]);
+        }
+    }
+}
+
+/// Head position telemetry of the generated program, see stats::Stats.
+struct HeadStats {
+    llvm::GlobalVariable *min;
+    llvm::GlobalVariable *max;
+    llvm::GlobalVariable *histogram;
+    Value *bucketWidth;
+};
+
+/// Write case hits and head stats to `path` as JSON, in the layout of
+/// stats::toJson. The case list is unrolled at compile time so the state,
+/// symbol, rule and source line of every case are baked into the format
+/// strings.
+static void buildStatsWrite(IRBuilder<> &B, Module &mod, Function *fn,
+                            const machine::Machine &m,
+                            llvm::GlobalVariable *counts,
+                            const HeadStats &head, Value *steps,
+                            const std::string &path) {
+    auto &ctx = B.getContext();
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
+    auto *ptrTy = B.getPtrTy();
+    auto fopenFn = mod.getOrInsertFunction(
+        "fopen", FunctionType::get(ptrTy, {ptrTy, ptrTy}, false));
+    auto fprintfFn = mod.getOrInsertFunction(
+        "fprintf", FunctionType::get(i32, {ptrTy, ptrTy}, true));
+    auto fcloseFn = mod.getOrInsertFunction(
+        "fclose", FunctionType::get(i32, {ptrTy}, false));
+    const unsigned totalStates = m.numStates();
+
+    BasicBlock *open = BasicBlock::Create(ctx, "stats_open", fn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "stats_hist_loop", fn);
+    BasicBlock *body = BasicBlock::Create(ctx, "stats_hist_body", fn);
+    BasicBlock *close = BasicBlock::Create(ctx, "stats_close", fn);
+    BasicBlock *done = BasicBlock::Create(ctx, "stats_done", fn);
+
+    auto *file = B.CreateCall(fopenFn, {B.CreateGlobalString(path),
+                                        B.CreateGlobalString("w")});
+    B.CreateCondBr(B.CreateIsNull(file), done, open);
+
+    B.SetInsertPoint(open);
+    B.CreateCall(fprintfFn,
+                 {file, B.CreateGlobalString("{\"steps\": %llu, \"cases\": ["),
+                  steps});
+    const char *sep = "";
+    for (unsigned q = 0; q < m.numStates(); ++q) {
+        for (unsigned c = 0; c < m.numCombos(); ++c) {
+            auto r = m.ruleFor(q, c);
+            if (r == machine::Machine::NO_RULE)
+                continue;
+            auto fmt = llvm::formatv(
+                "{0}{{\"state\": \"{1}\", \"symbol\": \"{2}\", "
+                "\"rule\": {3}, \"line\": {4}, \"hits\": %llu}",
+                sep, m.states[q], m.comboName(c), r, m.rules[r].line);
+            auto *hits = B.CreateLoad(
+                i64, B.CreateConstInBoundsGEP2_32(counts->getValueType(),
+                                                  counts, 0,
+                                                  c * totalStates + q));
+            B.CreateCall(fprintfFn,
+                         {file, B.CreateGlobalString(fmt.str()), hits});
+            sep = ", ";
+        }
+    }
+    // min > max: no step recorded, null as in stats::toJson
+    auto *min = B.CreateLoad(i64, head.min);
+    auto *max = B.CreateLoad(i64, head.max);
+    auto *range = B.CreateSelect(
+        B.CreateICmpSGT(min, max),
+        B.CreateGlobalString("], \"head\": {\"min\": null, \"max\": null, "),
+        B.CreateGlobalString("], \"head\": {\"min\": %lld, \"max\": %lld, "));
+    B.CreateCall(fprintfFn, {file, range, min, max});
+    B.CreateCall(fprintfFn,
+                 {file,
+                  B.CreateGlobalString("\"bucketWidth\": %llu, "
+                                       "\"histogram\": ["),
+                  head.bucketWidth});
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(loop);
+    auto *bucket = B.CreatePHI(i32, 2, "stats_bucket");
+    bucket->addIncoming(B.getInt32(0), open);
+    B.CreateCondBr(
+        B.CreateICmpULT(bucket, B.getInt32(stats::Stats::NUM_BUCKETS)), body,
+        close);
+
+    B.SetInsertPoint(body);
+    auto *count = B.CreateLoad(
+        i64, B.CreateGEP(head.histogram->getValueType(), head.histogram,
+                         {B.getInt32(0), bucket}));
+    auto *comma = B.CreateSelect(B.CreateICmpEQ(bucket, B.getInt32(0)),
+                                 B.CreateGlobalString(""),
+                                 B.CreateGlobalString(", "));
+    B.CreateCall(fprintfFn,
+                 {file, B.CreateGlobalString("%s%llu"), comma, count});
+    bucket->addIncoming(B.CreateAdd(bucket, B.getInt32(1)), body);
+    B.CreateBr(loop);
+
+    B.SetInsertPoint(close);
+    B.CreateCall(fprintfFn, {file, B.CreateGlobalString("]}}\n")});
+    B.CreateCall(fcloseFn, {file});
+    B.CreateBr(done);
+
+    B.SetInsertPoint(done);
+}
+
+/// Static layout of the steps loop, for builds without a profile: the
+/// blocks of a copy's cases follow its merge block state by state, in
+/// `stateOrder` (optimizer::layoutStates). A block shared by several
+/// states stays with the first of them.
+static void applyLayout(BasicBlock *afterSwitch,
+                        const std::vector<BasicBlock *> &caseBlocks,
+                        const std::vector<unsigned> &stateOrder,
+                        unsigned totalStates) {
+    std::set<BasicBlock *> moved;
+    BasicBlock *cursor = afterSwitch;
+    for (unsigned q : stateOrder)
+        for (unsigned num = q; num < caseBlocks.size(); num += totalStates)
+            if (caseBlocks[num] && moved.insert(caseBlocks[num]).second) {
+                caseBlocks[num]->moveAfter(cursor);
+                cursor = caseBlocks[num];
+            }
+}
+
+/// Profile guided layout of the steps loop:
+///  - branch weights on the dispatch switch and the loop condition,
+///  - hot cases placed right behind the switch, each followed by the
+///    hottest case of the state it hands off to,
+///  - never taken cases sunk to the end of the function.
+/// The entry count and profile summary let `llc -split-machine-functions`
+/// move the cold cases into a separate .text.split section.
+static void applyProfile(Module &mod, Function *fn, llvm::SwitchInst *sw,
+                         BasicBlock *stepsLoop, BasicBlock *afterSwitch,
+                         const std::vector<BasicBlock *> &caseBlocks,
+                         const std::vector<uint64_t> &caseCounts,
+                         const std::vector<int64_t> &caseNext,
+                         unsigned totalStates) {
+    auto &ctx = mod.getContext();
+    llvm::MDBuilder MDB(ctx);
+    const uint64_t maxCount =
+        std::max<uint64_t>(1, *std::max_element(caseCounts.begin(),
+                                                caseCounts.end()));
+    uint64_t total = 0;
+    for (auto c : caseCounts)
+        total += c;
+    // branch weights are 32 bit
+    const uint64_t scale = maxCount / UINT32_MAX + 1;
+    auto weight = [&](uint64_t c) -> uint32_t {
+        return c == 0 ? 0 : std::max<uint64_t>(1, c / scale);
+    };
+
+    // the default destination takes the cases without a block
+    uint64_t defaultCount = 0;
+    for (unsigned num = 0; num < caseBlocks.size(); ++num)
+        if (!caseBlocks[num])
+            defaultCount += caseCounts[num];
+    std::vector<uint32_t> weights{weight(defaultCount)};
+    for (auto &c : sw->cases())
+        weights.push_back(weight(caseCounts[c.getCaseValue()->getZExtValue()]));
+    sw->setMetadata(LLVMContext::MD_prof, MDB.createBranchWeights(weights));
+    stepsLoop->getTerminator()->setMetadata(
+        LLVMContext::MD_prof,
+        MDB.createBranchWeights(weight(std::max<uint64_t>(total, 1)), 1));
+
+    // chain hot cases: hottest unplaced case, then the hottest unplaced
+    // case of its next state, and so on. Cases share blocks, a block stays
+    // where its hottest case put it.
+    std::vector<bool> placed(caseBlocks.size(), false);
+    std::set<BasicBlock *> moved;
+    BasicBlock *cursor = sw->getParent();
+    auto place = [&](unsigned num) {
+        placed[num] = true;
+        if (!moved.insert(caseBlocks[num]).second)
+            return;
+        caseBlocks[num]->moveAfter(cursor);
+        cursor = caseBlocks[num];
+    };
+    std::vector<unsigned> byCount(caseBlocks.size());
+    for (unsigned num = 0; num < byCount.size(); ++num)
+        byCount[num] = num;
+    std::stable_sort(byCount.begin(), byCount.end(),
+                     [&](unsigned a, unsigned b) {
+                         return caseCounts[a] > caseCounts[b];
+                     });
+    for (unsigned start : byCount) {
+        if (placed[start] || caseCounts[start] == 0 || !caseBlocks[start])
+            continue;
+        for (int64_t num = start; num >= 0;) {
+            place(num);
+            // the merge block sits behind the hottest case
+            if (!moved.count(afterSwitch)) {
+                moved.insert(afterSwitch);
+                afterSwitch->moveAfter(cursor);
+                cursor = afterSwitch;
+            }
+            int64_t best = -1;
+            if (caseNext[num] >= 0)
+                for (unsigned s = 0; s * totalStates < caseBlocks.size();
+                     ++s) {
+                    unsigned cand = s * totalStates + caseNext[num];
+                    if (!placed[cand] && caseBlocks[cand] &&
+                        caseCounts[cand] > 0 &&
+                        (best < 0 || caseCounts[cand] > caseCounts[best]))
+                        best = cand;
+                }
+            num = best;
+        }
+    }
+    for (unsigned num = 0; num < caseBlocks.size(); ++num)
+        if (caseBlocks[num] && moved.insert(caseBlocks[num]).second)
+            caseBlocks[num]->moveAfter(&fn->back());
+
+    // the function runs once; block counts follow from the weights
+    fn->setEntryCount(1);
+    std::vector<uint64_t> sorted;
+    for (auto c : caseCounts)
+        if (c)
+            sorted.push_back(c);
+    std::sort(sorted.rbegin(), sorted.rend());
+    llvm::SummaryEntryVector detailed;
+    for (uint32_t cutoff : {10000, 100000, 200000, 300000, 400000, 500000,
+                            600000, 700000, 800000, 900000, 950000, 990000,
+                            999000, 999900, 999990, 999999}) {
+        // smallest count among the hottest cases covering `cutoff` ppm
+        uint64_t covered = 0, minCount = 0;
+        uint32_t numCounts = 0;
+        for (auto c : sorted) {
+            if (covered * 1000000 >= uint64_t(cutoff) * total)
+                break;
+            covered += c;
+            minCount = c;
+            ++numCounts;
+        }
+        detailed.push_back({cutoff, minCount, numCounts});
+    }
+    llvm::ProfileSummary summary(
+        llvm::ProfileSummary::PSK_Instr, detailed, total + 1, maxCount,
+        maxCount, 1, sorted.size() + 1, 1);
+    mod.setProfileSummary(summary.getMD(ctx), llvm::ProfileSummary::PSK_Instr);
+}
+
+/// `i64 smc_sweep_<stride>(ptr head, i64 limit, i32 mask, ptr begin,
+/// ptr end)`: how many of the cells head + stride, head + 2 * stride, ...
+/// (at most `limit`) in a row hold a symbol in `mask`, bit i for symbol i.
+/// Tests eight cells per iteration: one vector load of the cells they
+/// span, a shuffle picking every stride-th one and a mask test, with
+/// cttz finding the first cell that fails. Near the tape ends it falls
+/// back to one cell at a time.
+static Function *buildSweepFn(Module &mod, int32_t stride) {
+    constexpr unsigned LANES = 8;
+    auto &ctx = mod.getContext();
+    const std::string name = "smc_sweep_" + std::string(stride < 0 ? "m" : "") +
+                             std::to_string(std::abs(stride));
+    if (auto *fn = mod.getFunction(name))
+        return fn;
+    IRBuilder<> B(ctx);
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
+    auto *i8 = B.getInt8Ty();
+    auto *ptrTy = B.getPtrTy();
+    auto *fn = Function::Create(
+        FunctionType::get(i64, {ptrTy, i64, i32, ptrTy, ptrTy}, false),
+        GlobalValue::InternalLinkage, name, mod);
+    auto *head = fn->getArg(0);
+    auto *limit = fn->getArg(1);
+    auto *mask = fn->getArg(2);
+    auto *begin = fn->getArg(3);
+    auto *end = fn->getArg(4);
+    auto block = [&](const char *label) {
+        return BasicBlock::Create(ctx, label, fn);
+    };
+    BasicBlock *entry = block("entry");
+    BasicBlock *vecLoop = block("vec_loop");
+    BasicBlock *vecBounds = block("vec_bounds");
+    BasicBlock *vecBody = block("vec_body");
+    BasicBlock *vecExit = block("vec_exit");
+    BasicBlock *scalarLoop = block("scalar_loop");
+    BasicBlock *scalarBody = block("scalar_body");
+    BasicBlock *done = block("done");
+    // the cell `j` strides past the head
+    auto cellAt = [&](BV j) {
+        return B.CreateGEP(i32, head, {B.CreateMul(j, B.getInt64(stride))});
+    };
+
+    B.SetInsertPoint(entry);
+    B.CreateBr(vecLoop);
+
+    B.SetInsertPoint(vecLoop);
+    auto *n = B.CreatePHI(i64, 2, "n");
+    n->addIncoming(B.getInt64(0), entry);
+    B.CreateCondBr(B.CreateICmpULE(B.CreateAdd(n, B.getInt64(LANES)), limit),
+                   vecBounds, scalarLoop);
+
+    // the eight cells span `width` cells of memory from `lo`
+    B.SetInsertPoint(vecBounds);
+    const unsigned width = LANES * std::abs(stride);
+    auto *lo = cellAt(B.CreateAdd(n, B.getInt64(stride > 0 ? 1 : LANES)));
+    auto *hi = B.CreateGEP(i32, lo, {B.getInt32(width)});
+    B.CreateCondBr(B.CreateAnd(B.CreateICmpUGE(lo, begin),
+                               B.CreateICmpULE(hi, end)),
+                   vecBody, scalarLoop);
+
+    B.SetInsertPoint(vecBody);
+    auto *span = B.CreateAlignedLoad(llvm::FixedVectorType::get(i32, width),
+                                     lo, llvm::MaybeAlign(4), "span");
+    std::vector<int> lanes;
+    for (unsigned j = 1; j <= LANES; ++j)
+        lanes.push_back(stride > 0 ? stride * (j - 1)
+                                   : -stride * (LANES - j));
+    auto *cells = B.CreateShuffleVector(span, lanes, "cells");
+    auto *bits = B.CreateShl(B.CreateVectorSplat(LANES, B.getInt32(1)), cells);
+    auto *in = B.CreateICmpNE(
+        B.CreateAnd(bits, B.CreateVectorSplat(LANES, mask)),
+        llvm::Constant::getNullValue(bits->getType()));
+    auto *found = B.CreateBitCast(in, i8, "found");
+    n->addIncoming(B.CreateAdd(n, B.getInt64(LANES)), vecBody);
+    B.CreateCondBr(B.CreateICmpEQ(found, B.getInt8(0xff)), vecLoop, vecExit);
+
+    B.SetInsertPoint(vecExit);
+    auto *first = B.CreateIntrinsic(llvm::Intrinsic::cttz, {i8},
+                                    {B.CreateNot(found), B.getTrue()});
+    B.CreateRet(B.CreateAdd(n, B.CreateZExt(first, i64)));
+
+    B.SetInsertPoint(scalarLoop);
+    auto *m = B.CreatePHI(i64, 3, "m");
+    m->addIncoming(n, vecLoop);
+    m->addIncoming(n, vecBounds);
+    B.CreateCondBr(B.CreateICmpULT(m, limit), scalarBody, done);
+
+    B.SetInsertPoint(scalarBody);
+    auto *next = B.CreateAdd(m, B.getInt64(1));
+    auto *cell = B.CreateLoad(i32, cellAt(next), "cell");
+    auto *inLoop = B.CreateTrunc(B.CreateLShr(mask, cell), B.getInt1Ty());
+    m->addIncoming(next, scalarBody);
+    B.CreateCondBr(inLoop, scalarLoop, done);
+
+    B.SetInsertPoint(done);
+    B.CreateRet(m);
+    return fn;
+}
+
+/// Target of every generated module. The data layout is spelled out as
+/// ThinLTO does not derive it from the triple.
+static void setTarget(Module &mod, const CodegenOptions &options) {
+    auto layout = llvm::DataLayout::parse(options.dataLayout);
+    if (!layout)
+        throw std::runtime_error("[LLVM]: Bad data layout " +
+                                 options.dataLayout + ": " +
+                                 llvm::toString(layout.takeError()));
+    Triple triple(options.targetTriple);
     mod.setTargetTriple(triple);
+    mod.setDataLayout(*layout);
+}
 
+/// The module as textual IR or, with `bitcode`, as bitcode that carries a
+/// ThinLTO summary index, so that `clang -flto=thin` can import and
+/// inline across it without parsing text.
+static std::string serialize(Module &mod, bool bitcode) {
+    std::string out;
+    llvm::raw_string_ostream os(out);
+    if (!bitcode) {
+        mod.print(os, nullptr);
+        return os.str();
+    }
+    llvm::ProfileSummaryInfo psi(mod);
+    auto index = llvm::buildModuleSummaryIndex(mod, nullptr, &psi);
+    llvm::WriteBitcodeToFile(mod, os, /*ShouldPreserveUseListOrder*/ false,
+                             &index);
+    return os.str();
+}
+
+/// Symbol name of the step function of group `g` of a partitioned loop.
+static std::string groupName(unsigned g) {
+    return "smc_group_" + std::to_string(g);
+}
+
+/// void smc_group_<g>(ptr tape, ptr head..., i32 cell..., i32 state,
+///                    i64 step, i64 num_steps, ptr end)
+/// Every group function has this type, which is what lets a group
+/// `musttail` call the next one.
+static FunctionType *groupFnType(LLVMContext &ctx, unsigned tapes) {
+    auto *ptr = PointerType::get(ctx, 0);
+    auto *i32 = Type::getInt32Ty(ctx);
+    auto *i64 = Type::getInt64Ty(ctx);
+    std::vector<Type *> params{ptr};
+    params.insert(params.end(), tapes, ptr);
+    params.insert(params.end(), tapes, i32);
+    params.insert(params.end(), {i32, i64, i64, ptr});
+    return FunctionType::get(Type::getVoidTy(ctx), params, false);
+}
+
+/// Registers of the machine when a partitioned run ends, written by the
+/// group that ends it: { [k x ptr] heads, [k x i32] cells, i32 state,
+/// i64 step, i1 halted }. The cells are not written back yet.
+static llvm::StructType *runEndType(LLVMContext &ctx, unsigned tapes) {
+    auto *i32 = Type::getInt32Ty(ctx);
+    return llvm::StructType::get(
+        ctx, {llvm::ArrayType::get(PointerType::get(ctx, 0), tapes),
+              llvm::ArrayType::get(i32, tapes), i32, Type::getInt64Ty(ctx),
+              Type::getInt1Ty(ctx)});
+}
+
+/// The steps loop over the states of group `g` as function `name` of
+/// `mod`. It mirrors the loop of getIr(), except that a transition into
+/// another group ends in a `musttail` call of that group's function, so a
+/// run never grows the stack however often it crosses groups.
+static Function *emitGroup(Module &mod, const machine::Machine &m,
+                           const CodegenOptions &options,
+                           const std::vector<unsigned> &groupOf,
+                           const std::vector<unsigned> &ruleClass,
+                           const std::vector<unsigned> &stateOrder, unsigned g,
+                           const std::string &name,
+                           GlobalValue::LinkageTypes linkage) {
+    LLVMContext &ctx = mod.getContext();
+    IRBuilder<> B(ctx);
+
+    const unsigned numTapes = m.tapes;
+    const unsigned totalStates = m.numStates();
+    const unsigned totalCombos = m.numCombos();
     auto *i32 = B.getInt32Ty();
+    auto *fnTy = groupFnType(ctx, numTapes);
+    auto *fn = Function::Create(fnTy, linkage, name, mod);
+    Function *printfFn = nullptr;
+    if (options.trace)
+        printfFn = Function::Create(
+            FunctionType::get(i32, {B.getPtrTy()}, true),
+            Function::ExternalLinkage, "printf", mod);
+
+    auto *tapePtr = fn->getArg(0);
+    auto *startState = fn->getArg(2 * numTapes + 1);
+    auto *startStep = fn->getArg(2 * numTapes + 2);
+    auto *numSteps = fn->getArg(2 * numTapes + 3);
+    auto *end = fn->getArg(2 * numTapes + 4);
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", fn);
+    BasicBlock *stepsLoop = BasicBlock::Create(ctx, "steps_loop", fn);
+    BasicBlock *stepsBody = BasicBlock::Create(ctx, "steps_loop_body", fn);
+    BasicBlock *stepsExit = BasicBlock::Create(ctx, "steps_loop_end", fn);
+    BasicBlock *afterSwitch = BasicBlock::Create(ctx, "after_switch", fn);
+    BasicBlock *switchDefault = BasicBlock::Create(ctx, "switch_default", fn);
+    B.SetInsertPoint(entry);
+    B.CreateBr(stepsLoop);
+
+    B.SetInsertPoint(stepsLoop);
+    auto *cStep = B.CreatePHI(B.getInt64Ty(), 2, "step");
+    std::vector<llvm::PHINode *> heads, cells;
+    for (unsigned t = 0; t < numTapes; ++t) {
+        heads.push_back(B.CreatePHI(B.getPtrTy(), 2, "head"));
+        cells.push_back(B.CreatePHI(i32, 2, "cell"));
+        heads[t]->addIncoming(fn->getArg(1 + t), entry);
+        cells[t]->addIncoming(fn->getArg(1 + numTapes + t), entry);
+    }
+    auto *state = B.CreatePHI(i32, 2, "state");
+    cStep->addIncoming(startStep, entry);
+    state->addIncoming(startState, entry);
+    B.CreateCondBr(B.CreateICmpULT(cStep, numSteps, "step_limit_cond"),
+                   stepsBody, stepsExit);
+
+    B.SetInsertPoint(stepsBody);
+    if (options.trace) {
+        auto *bytes =
+            B.CreateSub(B.CreatePtrToInt(heads[0], B.getInt64Ty()),
+                        B.CreatePtrToInt(tapePtr, B.getInt64Ty()));
+        buildPrintf(B, printfFn, "Current step: %llu\n", {cStep});
+        buildPrintf(B, printfFn, "Current tape index: %lld\n",
+                    {B.CreateExactSDiv(bytes, B.getInt64(sizeof(int32_t)))});
+    }
+    BV combo = cells[numTapes - 1];
+    for (unsigned t = numTapes - 1; t-- > 0;)
+        combo = B.CreateAdd(B.CreateMul(combo, B.getInt32(m.numSymbols())),
+                            cells[t], "combo");
+    auto *caseNum = B.CreateAdd(B.CreateMul(combo, B.getInt32(totalStates)),
+                                state, "switch_case");
+    llvm::SwitchInst *sw = B.CreateSwitch(caseNum, switchDefault);
+
+    B.SetInsertPoint(afterSwitch);
+    auto *nextState = B.CreatePHI(i32, 0, "next_state");
+    std::vector<llvm::PHINode *> nextHeads, nextCells;
+    for (unsigned t = 0; t < numTapes; ++t) {
+        nextHeads.push_back(B.CreatePHI(B.getPtrTy(), 0, "next_head"));
+        nextCells.push_back(B.CreatePHI(i32, 0, "next_cell"));
+    }
+
+    // names for the trace, looked up at run time as blocks are shared
+    llvm::GlobalVariable *syms = nullptr, *names = nullptr;
+    if (options.trace) {
+        std::vector<llvm::Constant *> symStrings, stateStrings;
+        for (unsigned c = 0; c < totalCombos; ++c)
+            symStrings.push_back(B.CreateGlobalString(m.comboName(c)));
+        for (const auto &q : m.states)
+            stateStrings.push_back(B.CreateGlobalString(q));
+        syms = nameTable(mod, symStrings, "symbol_names");
+        names = nameTable(mod, stateStrings, "state_names");
+    }
+    auto emitCaseTrace = [&]() {
+        if (!options.trace)
+            return;
+        auto *sym = B.CreateLoad(B.getPtrTy(),
+                                 B.CreateGEP(syms->getValueType(), syms,
+                                             {B.getInt32(0), combo}));
+        auto *name = B.CreateLoad(B.getPtrTy(),
+                                  B.CreateGEP(names->getValueType(), names,
+                                              {B.getInt32(0), state}));
+        buildPrintf(B, printfFn, "Symbol: %s State: %s\n", {sym, name});
+    };
+
+    // cases in the order their blocks are laid out: state by state along
+    // `stateOrder` (optimizer::layoutStates), symbol by symbol without it
+    std::vector<std::pair<unsigned, unsigned>> cases;
+    if (!stateOrder.empty()) {
+        for (unsigned q : stateOrder)
+            for (unsigned s = 0; s < totalCombos; ++s)
+                cases.push_back({q, s});
+    } else {
+        for (unsigned s = 0; s < totalCombos; ++s)
+            for (unsigned q = 0; q < totalStates; ++q)
+                cases.push_back({q, s});
+    }
+
+    // one block per class of equal rules, as in getIr()
+    std::map<unsigned, BasicBlock *> classBlocks;
+    for (auto [q, s] : cases) {
+        auto rule = m.ruleFor(q, s);
+        if (groupOf[q] != g || rule == machine::Machine::NO_RULE)
+            continue;
+        auto &block = classBlocks[ruleClass[rule]];
+        if (block) {
+            sw->addCase(B.getInt32(s * totalStates + q), block);
+            continue;
+        }
+        const Transition &T = m.rules[rule];
+        block = BasicBlock::Create(
+            ctx, "rule_" + T.initialState + "_to_" + T.finalState, fn);
+        sw->addCase(B.getInt32(s * totalStates + q), block);
+        B.SetInsertPoint(block);
+        emitCaseTrace();
+        std::vector<BV> h(heads.begin(), heads.end());
+        std::vector<BV> c(cells.begin(), cells.end());
+        lowerActions(B, m, T, options.fuseActions, h, c);
+        unsigned next = m.stateIndex(T.finalState);
+        if (groupOf[next] != g) {
+            std::vector<BV> args{tapePtr};
+            args.insert(args.end(), h.begin(), h.end());
+            args.insert(args.end(), c.begin(), c.end());
+            args.insert(args.end(),
+                        {B.getInt32(next),
+                         B.CreateAdd(cStep, B.getInt64(1)), numSteps,
+                         end});
+            auto *call = B.CreateCall(
+                mod.getOrInsertFunction(groupName(groupOf[next]), fnTy),
+                args);
+            call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+            B.CreateRetVoid();
+            continue;
+        }
+        B.CreateBr(afterSwitch);
+        for (unsigned t = 0; t < numTapes; ++t) {
+            nextHeads[t]->addIncoming(h[t], block);
+            nextCells[t]->addIncoming(c[t], block);
+        }
+        nextState->addIncoming(B.getInt32(next), block);
+    }
+
+    B.SetInsertPoint(switchDefault);
+    if (options.halt) {
+        if (options.trace)
+            buildPrintf(B, printfFn, "Default Remainder: %llu\n", {cStep});
+        B.CreateBr(stepsExit);
+    } else {
+        emitCaseTrace();
+        B.CreateBr(afterSwitch);
+        for (unsigned t = 0; t < numTapes; ++t) {
+            nextHeads[t]->addIncoming(heads[t], switchDefault);
+            nextCells[t]->addIncoming(cells[t], switchDefault);
+        }
+        nextState->addIncoming(state, switchDefault);
+    }
+
+    if (nextState->getNumIncomingValues() == 0) {
+        // every step leaves the group, phis without values do not print
+        afterSwitch->eraseFromParent();
+    } else {
+        B.SetInsertPoint(afterSwitch);
+        cStep->addIncoming(B.CreateAdd(cStep, B.getInt64(1)), afterSwitch);
+        B.CreateBr(stepsLoop);
+        for (unsigned t = 0; t < numTapes; ++t) {
+            heads[t]->addIncoming(nextHeads[t], afterSwitch);
+            cells[t]->addIncoming(nextCells[t], afterSwitch);
+        }
+        state->addIncoming(nextState, afterSwitch);
+    }
+
+    B.SetInsertPoint(stepsExit);
+    llvm::PHINode *halted = B.CreatePHI(B.getInt1Ty(), 2, "halted");
+    halted->addIncoming(B.getFalse(), stepsLoop);
+    if (options.halt)
+        halted->addIncoming(B.getTrue(), switchDefault);
+    auto *endTy = runEndType(ctx, numTapes);
+    for (unsigned t = 0; t < numTapes; ++t) {
+        B.CreateStore(heads[t], B.CreateGEP(endTy, end, {B.getInt32(0),
+                                                         B.getInt32(0),
+                                                         B.getInt32(t)}));
+        B.CreateStore(cells[t], B.CreateGEP(endTy, end, {B.getInt32(0),
+                                                         B.getInt32(1),
+                                                         B.getInt32(t)}));
+    }
+    B.CreateStore(state, B.CreateStructGEP(endTy, end, 2));
+    B.CreateStore(cStep, B.CreateStructGEP(endTy, end, 3));
+    B.CreateStore(halted, B.CreateStructGEP(endTy, end, 4));
+    B.CreateRetVoid();
+    return fn;
+}
+
+/// Group `g` as a module of its own. Runs on a worker thread: everything
+/// lives in a context of its own.
+static std::string buildGroup(const machine::Machine &m,
+                              const CodegenOptions &options,
+                              const std::vector<unsigned> &groupOf,
+                              const std::vector<unsigned> &ruleClass,
+                              const std::vector<unsigned> &stateOrder,
+                              unsigned g) {
+    LLVMContext ctx;
+    Module mod("tape_machine_" + groupName(g), ctx);
+    setTarget(mod, options);
+    emitGroup(mod, m, options, groupOf, ruleClass, stateOrder, g,
+              groupName(g), Function::ExternalLinkage);
+    if (llvm::verifyModule(mod, &llvm::errs()))
+        throw std::runtime_error("generated module is invalid!");
+    return serialize(mod, options.bitcode);
+}
+
+/// int32_t <prefix>_run(int32_t *tape, int64_t len, int64_t *head,
+///                      int32_t *state, uint64_t max_steps, uint64_t *steps)
+/// The machine as a re-entrant function over a tape the caller owns, see
+/// libraryHeader(). The loop of a single group (emitGroup) runs in chunks
+/// of steps too short to reach either end of the tape; near an end single
+/// steps are checked against the cells their case touches first. Besides
+/// the function there are only constants, and no I/O.
+static std::string buildLibrary(const machine::Machine &m,
+                                const CodegenOptions &options,
+                                LLVMContext &ctx) {
+    if (m.tapes != 1)
+        throw std::runtime_error("[LLVM]: A library needs a single tape "
+                                 "machine");
+    if (options.trace || !options.profileGenerate.empty() ||
+        options.profileUse || !options.stats.empty() ||
+        !options.checkpointPrefix.empty() || options.resume ||
+        options.exactTape || options.partitions > 1 ||
+        options.dispatch == CodegenOptions::Dispatch::Table)
+        throw std::runtime_error("[LLVM]: A library does not support trace, "
+                                 "profiles, stats, checkpoints, exact tape, "
+                                 "partitions or table dispatch");
+    const std::string &prefix = options.library;
+    Module mod("tape_machine_" + prefix, ctx);
+    IRBuilder<> B(ctx);
+    setTarget(mod, options);
+
+    const unsigned totalStates = m.numStates();
+    const unsigned totalSyms = m.numSymbols();
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
+    auto *ptr = B.getPtrTy();
+    auto *loopFn = emitGroup(
+        mod, m, options, std::vector<unsigned>(totalStates, 0),
+        optimizer::ruleClasses(m),
+        options.layout ? optimizer::layoutStates(m) : std::vector<unsigned>{},
+        0, prefix + "_loop", GlobalValue::InternalLinkage);
+
+    // (state * symbols + symbol) -> lowest and highest cell offset the
+    // rule touches, the final head included
+    std::vector<uint32_t> reach(2 * totalStates * totalSyms, 0);
+    int64_t maxReach = 0;
+    for (unsigned q = 0; q < totalStates; ++q) {
+        for (unsigned s = 0; s < totalSyms; ++s) {
+            auto rule = m.ruleFor(q, s);
+            if (rule == machine::Machine::NO_RULE)
+                continue;
+            auto fused = optimizer::fuseSteps(m, m.rules[rule].steps, 0);
+            int32_t lo = std::min({fused.minOffset, fused.move, 0});
+            int32_t hi = std::max({fused.maxOffset, fused.move, 0});
+            reach[2 * (q * totalSyms + s)] = uint32_t(lo);
+            reach[2 * (q * totalSyms + s) + 1] = uint32_t(hi);
+            maxReach = std::max<int64_t>({maxReach, -int64_t(lo), hi});
+        }
+    }
+    auto *reachInit = llvm::ConstantDataArray::get(ctx, reach);
+    auto *reachTable = new llvm::GlobalVariable(
+        mod, reachInit->getType(), true, GlobalValue::PrivateLinkage,
+        reachInit, prefix + "_reach");
+    reachTable->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+
+    auto *runTy = FunctionType::get(i32, {ptr, i64, ptr, ptr, i64, ptr}, false);
+    auto *runFn = Function::Create(runTy, Function::ExternalLinkage,
+                                   prefix + "_run", mod);
+    auto *tapePtr = runFn->getArg(0);
+    auto *len = runFn->getArg(1);
+    auto *headPtr = runFn->getArg(2);
+    auto *statePtr = runFn->getArg(3);
+    auto *maxSteps = runFn->getArg(4);
+    auto *stepsPtr = runFn->getArg(5);
+    tapePtr->setName("tape");
+    len->setName("len");
+    headPtr->setName("head");
+    statePtr->setName("state");
+    maxSteps->setName("max_steps");
+    stepsPtr->setName("steps");
+
+    BasicBlock *entry = BasicBlock::Create(ctx, "entry", runFn);
+    BasicBlock *loop = BasicBlock::Create(ctx, "chunk_loop", runFn);
+    BasicBlock *chunk = BasicBlock::Create(ctx, "chunk", runFn);
+    BasicBlock *edge = BasicBlock::Create(ctx, "tape_edge", runFn);
+    BasicBlock *call = BasicBlock::Create(ctx, "run_chunk", runFn);
+    BasicBlock *exit = BasicBlock::Create(ctx, "exit", runFn);
+
+    B.SetInsertPoint(exit);
+    auto *status = B.CreatePHI(i32, 5, "status");
+    auto *exitHead = B.CreatePHI(i64, 5, "exit_head");
+    auto *exitState = B.CreatePHI(i32, 5, "exit_state");
+    auto *exitDone = B.CreatePHI(i64, 5, "exit_done");
+    auto exitFrom = [&](interpreter::Status st, BV h, BV q, BV done) {
+        status->addIncoming(B.getInt32(int32_t(st)), B.GetInsertBlock());
+        exitHead->addIncoming(h, B.GetInsertBlock());
+        exitState->addIncoming(q, B.GetInsertBlock());
+        exitDone->addIncoming(done, B.GetInsertBlock());
+    };
+
+    B.SetInsertPoint(entry);
+    auto *endTy = runEndType(ctx, 1);
+    auto *end = B.CreateAlloca(endTy, nullptr, "run_end");
+    auto *startHead = B.CreateLoad(i64, headPtr, "start_head");
+    auto *startState = B.CreateLoad(i32, statePtr, "start_state");
+    // a state past the last one would dispatch on another state's cases
+    BasicBlock *knownState =
+        BasicBlock::Create(ctx, "known_state", runFn, loop);
+    B.CreateCondBr(B.CreateICmpULT(startState, B.getInt32(totalStates)),
+                   knownState, exit);
+    exitFrom(interpreter::Status::Halted, startHead, startState,
+             B.getInt64(0));
+    B.SetInsertPoint(knownState);
+    B.CreateCondBr(B.CreateICmpULT(startHead, len), loop, exit);
+    exitFrom(interpreter::Status::OutOfTape, startHead, startState,
+             B.getInt64(0));
+
+    B.SetInsertPoint(loop);
+    auto *h = B.CreatePHI(i64, 2, "cur_head");
+    auto *q = B.CreatePHI(i32, 2, "cur_state");
+    auto *done = B.CreatePHI(i64, 2, "done");
+    h->addIncoming(startHead, knownState);
+    q->addIncoming(startState, knownState);
+    done->addIncoming(B.getInt64(0), knownState);
+    auto *remaining = B.CreateSub(maxSteps, done, "remaining");
+    B.CreateCondBr(B.CreateICmpEQ(remaining, B.getInt64(0)), exit, chunk);
+    exitFrom(interpreter::Status::Running, h, q, done);
+
+    // no step moves further than maxReach cells, so room / maxReach steps
+    // stay on the tape
+    B.SetInsertPoint(chunk);
+    auto *right = B.CreateSub(B.CreateSub(len, B.getInt64(1)), h);
+    auto *room = B.CreateSelect(B.CreateICmpULT(h, right), h, right, "room");
+    BV safe = remaining;
+    if (maxReach)
+        safe = B.CreateUDiv(room, B.getInt64(maxReach), "safe_steps");
+    auto umin = [&](BV a, BV b) {
+        return B.CreateSelect(B.CreateICmpULT(a, b), a, b);
+    };
+    safe = umin(safe, remaining);
+    B.CreateCondBr(B.CreateICmpEQ(safe, B.getInt64(0)), edge, call);
+
+    // one step, if its case stays on the tape; symbols the machine does
+    // not know have no rule and touch nothing
+    B.SetInsertPoint(edge);
+    auto *cell = B.CreateLoad(i32, B.CreateGEP(i32, tapePtr, {h}));
+    auto *known = B.CreateICmpULT(cell, B.getInt32(totalSyms));
+    auto *caseNum = B.CreateAdd(
+        B.CreateMul(B.CreateZExt(q, i64), B.getInt64(totalSyms)),
+        B.CreateZExt(cell, i64));
+    caseNum = B.CreateSelect(known, caseNum, B.getInt64(0), "edge_case");
+    auto reachAt = [&](unsigned half) {
+        auto *idx = B.CreateAdd(B.CreateMul(caseNum, B.getInt64(2)),
+                                B.getInt64(half));
+        auto *off = B.CreateLoad(
+            i32, B.CreateGEP(reachTable->getValueType(), reachTable,
+                             {B.getInt64(0), idx}));
+        return B.CreateSExt(B.CreateSelect(known, off, B.getInt32(0)), i64);
+    };
+    auto *lo = B.CreateAdd(h, reachAt(0), "lowest_cell");
+    auto *hi = B.CreateAdd(h, reachAt(1), "highest_cell");
+    auto *fits = B.CreateAnd(B.CreateICmpSGE(lo, B.getInt64(0)),
+                             B.CreateICmpSLT(hi, len));
+    B.CreateCondBr(fits, call, exit);
+    exitFrom(interpreter::Status::OutOfTape, h, q, done);
+
+    B.SetInsertPoint(call);
+    auto *k = B.CreatePHI(i64, 2, "chunk_steps");
+    k->addIncoming(safe, chunk);
+    k->addIncoming(B.getInt64(1), edge);
+    auto *cellPtr = B.CreateGEP(i32, tapePtr, {h});
+    B.CreateCall(loopFn, {tapePtr, cellPtr, B.CreateLoad(i32, cellPtr), q,
+                          B.getInt64(0), k, end});
+    auto *endHead = B.CreateLoad(
+        ptr, B.CreateGEP(endTy, end, {B.getInt32(0), B.getInt32(0),
+                                      B.getInt32(0)}));
+    auto *endCell = B.CreateLoad(
+        i32, B.CreateGEP(endTy, end, {B.getInt32(0), B.getInt32(1),
+                                      B.getInt32(0)}));
+    B.CreateStore(endCell, endHead);
+    auto *endState = B.CreateLoad(i32, B.CreateStructGEP(endTy, end, 2));
+    auto *endStep = B.CreateLoad(i64, B.CreateStructGEP(endTy, end, 3));
+    auto *halted =
+        B.CreateLoad(B.getInt1Ty(), B.CreateStructGEP(endTy, end, 4));
+    auto *bytes = B.CreateSub(B.CreatePtrToInt(endHead, i64),
+                              B.CreatePtrToInt(tapePtr, i64));
+    auto *nextHead =
+        B.CreateExactSDiv(bytes, B.getInt64(sizeof(int32_t)), "next_head");
+    auto *nextDone = B.CreateAdd(done, endStep);
+    B.CreateCondBr(halted, exit, loop);
+    exitFrom(interpreter::Status::Halted, nextHead, endState, nextDone);
+    h->addIncoming(nextHead, call);
+    q->addIncoming(endState, call);
+    done->addIncoming(nextDone, call);
+
+    B.SetInsertPoint(exit);
+    B.CreateStore(exitHead, headPtr);
+    B.CreateStore(exitState, statePtr);
+    B.CreateStore(exitDone, stepsPtr);
+    B.CreateRet(status);
+
+    if (llvm::verifyModule(mod, &llvm::errs()))
+        throw std::runtime_error("generated module is invalid!");
+    return serialize(mod, options.bitcode);
+}
+
+/// C string literal of `s`.
+static std::string cString(const std::string &s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+/// The header declaring what buildLibrary() defines. Guarded on the
+/// prefix, so the headers of several machines go into one translation
+/// unit.
+static std::string libraryHeader(const machine::Machine &m,
+                                 const std::string &prefix) {
+    std::string macro = prefix;
+    for (auto &c : macro)
+        c = std::toupper(static_cast<unsigned char>(c));
+    std::stringstream ss;
+    ss << "// Generated by smc: do not edit.\n"
+       << "#ifndef " << macro << "_H\n"
+       << "#define " << macro << "_H\n"
+       << "#include <stdint.h>\n\n"
+       << "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n"
+       << "#ifndef SMC_STATUS_DEFINED\n#define SMC_STATUS_DEFINED\n"
+       << "// Why a run returned\n"
+       << "enum smc_status {\n"
+       << "    SMC_RUNNING = 0,     // it took max_steps steps\n"
+       << "    SMC_HALTED = 1,      // no transition for the state and the\n"
+       << "                         // symbol under the head (--halt), or\n"
+       << "                         // *state is not a state\n"
+       << "    SMC_OUT_OF_TAPE = 2, // the next step would leave the tape\n"
+       << "};\n#endif\n\n";
+    ss << "// Cells hold symbol indices, states are indices as well.\n"
+       << "#define " << macro << "_NUM_SYMBOLS " << m.numSymbols() << "\n"
+       << "#define " << macro << "_BLANK " << m.blank() << "\n"
+       << "#define " << macro << "_NUM_STATES " << m.numStates() << "\n"
+       << "#define " << macro << "_INITIAL_STATE " << m.initialState
+       << "\n\n";
+    auto names = [&](const char *what, const std::vector<std::string> &all) {
+        ss << "static const char *const " << prefix << "_" << what
+           << "[] = {";
+        for (size_t i = 0; i < all.size(); ++i)
+            ss << (i ? ", " : "") << cString(all[i]);
+        ss << "};\n";
+    };
+    names("symbols", m.symbols);
+    names("states", m.states);
+    ss << "\n// Runs at most max_steps steps on tape[0, len), from cell *head "
+          "in state\n"
+       << "// *state, and leaves where it stopped in *head and *state and "
+          "the steps\n"
+       << "// taken in *steps. Touches nothing but its arguments: runs on "
+          "different\n"
+       << "// tapes may go on concurrently.\n"
+       << "int32_t " << prefix << "_run(int32_t *tape, int64_t len, "
+       << "int64_t *head,\n"
+       << std::string(prefix.size() + 13, ' ')
+       << "int32_t *state, uint64_t max_steps, uint64_t *steps);\n\n"
+       << "#ifdef __cplusplus\n}\n#endif\n\n"
+       << "#endif\n";
+    return ss.str();
+}
+
+void LllvmBackend::getIr() {
+    std::optional<LLVMContext> ownContext;
+    LLVMContext &ctx = context ? *context : ownContext.emplace();
+    if (!options.library.empty()) {
+        ir = buildLibrary(machine, options, ctx);
+        header = libraryHeader(machine, options.library);
+        return;
+    }
+    const unsigned numTapes = machine.tapes;
+    if (numTapes > 1 &&
+        (!options.profileGenerate.empty() || options.profileUse ||
+         !options.checkpointPrefix.empty() || options.resume))
+        throw std::runtime_error("[LLVM]: Profiles and checkpoints need a "
+                                 "single tape machine");
+    const bool partitioned = options.partitions > 1;
+    if (partitioned &&
+        (!options.profileGenerate.empty() || options.profileUse ||
+         !options.stats.empty() || !options.checkpointPrefix.empty()))
+        throw std::runtime_error("[LLVM]: Partitioned loops do not support "
+                                 "profiles, stats or checkpoints");
+    // the table loop has no blocks to lay out or registers to checkpoint
+    const bool tableOk = !partitioned && !options.profileUse &&
+                         options.checkpointPrefix.empty();
+    const bool table =
+        options.dispatch == CodegenOptions::Dispatch::Table ||
+        (options.dispatch == CodegenOptions::Dispatch::Auto && tableOk &&
+         machine.numStates() > options.tableStates);
+    if (table && !tableOk)
+        throw std::runtime_error("[LLVM]: Table dispatch does not support "
+                                 "partitions, profile guided layout or "
+                                 "checkpoints");
+
+    Module mod("tape_machine_fixed", ctx);
+    IRBuilder<> B(ctx);
+    setTarget(mod, options);
+
+    auto *i32 = B.getInt32Ty();
+    auto *i64 = B.getInt64Ty();
     auto *i8 = B.getInt8Ty();
     auto *i8Ptr = B.getPtrTy();
 
@@ -63,8 +1301,8 @@ void LllvmBackend::getIr() {
     auto *printfFn =
         Function::Create(printfTy, Function::ExternalLinkage, "printf", mod);
 
-    //  extern void* malloc(int);
-    auto *mallocTy = FunctionType::get(i8Ptr, {i32}, false);
+    //  extern void* malloc(size_t);
+    auto *mallocTy = FunctionType::get(i8Ptr, {i64}, false);
     auto *mallocFn =
         Function::Create(mallocTy, Function::ExternalLinkage, "malloc", mod);
 
@@ -80,50 +1318,105 @@ void LllvmBackend::getIr() {
     BasicBlock *entry = BasicBlock::Create(ctx, "entry", mainFn);
     B.SetInsertPoint(entry);
 
-    // local allocas
-    auto *numStepsPtr = B.CreateAlloca(i32, nullptr, "num_steps_ptr");
-    auto *arrSizePtr = B.CreateAlloca(i32, nullptr, "arr_size_ptr");
-    auto *currTapeIdx = B.CreateAlloca(i32, nullptr, "current_tape_index_ptr");
-    auto *currStepPtr = B.CreateAlloca(i32, nullptr, "current_step_ptr");
-    auto *currSymPtr = B.CreateAlloca(i32, nullptr, "current_symbol_index_ptr");
-    auto *currStatePtr =
-        B.CreateAlloca(i32, nullptr, "current_state_index_ptr");
-
-    // Initialize all allocas to zero
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currTapeIdx);
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currStepPtr);
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currSymPtr);
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currStatePtr);
+    // local allocas, 64 bit: runs of 10^12 steps over tapes of billions
+    // of cells are fair game
+    auto *numStepsPtr = B.CreateAlloca(i64, nullptr, "num_steps_ptr");
+    auto *arrSizePtr = B.CreateAlloca(i64, nullptr, "arr_size_ptr");
+    auto *currTapeIdx = B.CreateAlloca(i64, nullptr, "current_tape_index_ptr");
+
+    // Initialize all allocas to zero. Step, state, head and the current
+    // cell live in registers, see the steps-loop below.
+    B.CreateStore(llvm::ConstantInt::get(i64, 0), currTapeIdx);
 
     // ask user for num-steps & tape-size
     buildPrintf(B, printfFn, "Enter number of steps: ");
-    auto *scanfFmt = B.CreateGlobalString("%d", "scanf_fmt");
+    auto *scanfFmt = B.CreateGlobalString("%llu", "scanf_fmt");
     B.CreateCall(scanfFn, {scanfFmt, numStepsPtr});
 
-    buildPrintf(B, printfFn, "Enter array size: ");
-    B.CreateCall(scanfFn, {scanfFmt, arrSizePtr});
-
-    // malloc tape
-    auto *arrSize = B.CreateLoad(i32, arrSizePtr, "arr_size");
-    auto *tapePtr = B.CreateCall(mallocFn, {arrSize}, "tape_malloc");
+    if (options.exactTape) {
+        // the bound for the steps asked for, past whatever the checkpoint
+        // already wrote
+        auto extent = optimizer::tapeExtent(machine);
+        uint64_t start = 0;
+        if (options.resume)
+            start = options.resume->frontier();
+        auto *steps = B.CreateLoad(i64, numStepsPtr);
+        Value *cells = B.getInt64(1);
+        for (const auto &tape : extent.tapes) {
+            auto *bound = B.CreateMul(steps, B.getInt64(tape.perStep));
+            bound = B.CreateAdd(bound, B.getInt64(tape.fixed));
+            auto *naive = B.CreateMul(steps, B.getInt64(tape.reach));
+            naive = B.CreateAdd(naive, B.getInt64(1));
+            bound = B.CreateSelect(B.CreateICmpULT(naive, bound), naive,
+                                   bound);
+            cells = B.CreateSelect(B.CreateICmpUGT(bound, cells), bound,
+                                   cells);
+        }
+        cells = B.CreateAdd(cells, B.getInt64(start), "exact_cells");
+        // the bytes of every tape together must not wrap around
+        BasicBlock *fits = BasicBlock::Create(ctx, "tape_fits", mainFn);
+        BasicBlock *tooBig = BasicBlock::Create(ctx, "tape_too_big", mainFn);
+        uint64_t limit = INT64_MAX / sizeof(int32_t) / numTapes;
+        B.CreateCondBr(B.CreateICmpULE(cells, B.getInt64(limit)), fits,
+                       tooBig);
+        B.SetInsertPoint(tooBig);
+        buildPrintf(B, printfFn, "Tape of %lld cells does not fit\n",
+                    {cells});
+        B.CreateRet(B.getInt32(1));
+        B.SetInsertPoint(fits);
+        B.CreateStore(cells, arrSizePtr);
+        buildPrintf(B, printfFn, "Tape size: %llu cells\n", {cells});
+    } else {
+        buildPrintf(B, printfFn, "Enter array size: ");
+        B.CreateCall(scanfFn, {scanfFmt, arrSizePtr});
+    }
 
-    auto symbols = parser->tree.symbols;
-    symbols.push_back("X"); // "X" is always last
-    auto states = parser->tree.states;
-    auto initialState = parser->tree.initial_state;
-    auto transitions = parser->tree.transitions;
+    // malloc tape (arr_size cells of i32), multi tape machines put their
+    // tapes one after another in the same block. Heads are not checked
+    // against the tape ends: as a single tape head past either end leaves
+    // the block, a head that runs off tape t lands on tape t-1 or t+1.
+    auto *arrSize = B.CreateLoad(i64, arrSizePtr, "arr_size");
+    auto *tapeCells = numTapes == 1
+                          ? arrSize
+                          : B.CreateMul(arrSize, B.getInt64(numTapes),
+                                        "tape_cells");
+    auto *tapeBytes = B.CreateMul(tapeCells, B.getInt64(sizeof(int32_t)));
+    auto *tapePtr = B.CreateCall(mallocFn, {tapeBytes}, "tape_malloc");
 
-    // const-maps symbol/state → index
-    std::unordered_map<std::string, unsigned> sym2idx;
-    for (unsigned i = 0; i < symbols.size(); ++i)
-        sym2idx[symbols[i]] = i;
+    // head telemetry for --stats, the head starts on cell 0
+    HeadStats headStats{};
+    if (!options.stats.empty()) {
+        auto global = [&](llvm::Type *ty, const char *name,
+                          llvm::Constant *init) {
+            return new llvm::GlobalVariable(
+                mod, ty, false, GlobalValue::InternalLinkage, init, name);
+        };
+        // the sentinels of stats::Stats, so a run without steps reports
+        // no range and a resumed one the range it visited
+        headStats.min = global(i64, "stats_head_min",
+                               B.getInt64(std::numeric_limits<int64_t>::max()));
+        headStats.max = global(i64, "stats_head_max",
+                               B.getInt64(std::numeric_limits<int64_t>::min()));
+        auto *histTy = llvm::ArrayType::get(i64, stats::Stats::NUM_BUCKETS);
+        headStats.histogram = global(histTy, "stats_head_histogram",
+                                     llvm::Constant::getNullValue(histTy));
+        auto *width = B.CreateUDiv(
+            B.CreateAdd(arrSize, B.getInt64(stats::Stats::NUM_BUCKETS - 1)),
+            B.getInt64(stats::Stats::NUM_BUCKETS));
+        headStats.bucketWidth =
+            B.CreateSelect(B.CreateICmpEQ(width, B.getInt64(0)),
+                           B.getInt64(1), width, "stats_bucket_width");
+    }
 
-    std::unordered_map<std::string, unsigned> state2idx;
-    for (unsigned i = 0; i < states.size(); ++i)
-        state2idx[states[i]] = i;
+    const auto &symbols = machine.symbols; // "X" is always last
+    const auto &states = machine.states;
+    const auto &sym2idx = machine.sym2idx;
+    const auto &state2idx = machine.state2idx;
 
     const unsigned totalSyms = symbols.size();
     const unsigned totalStates = states.size();
+    // symbol combinations under the heads, totalSyms on a single tape
+    const unsigned totalCombos = machine.numCombos();
 
     // print helpful legend
     {
@@ -163,209 +1456,886 @@ void LllvmBackend::getIr() {
     // tape_fill_init:
     B.SetInsertPoint(tapeInit);
     {
-        auto *idx = B.CreateLoad(i32, currTapeIdx);
-        auto *cond = B.CreateICmpULT(idx, arrSize, "loop_cond");
+        auto *idx = B.CreateLoad(i64, currTapeIdx);
+        auto *cond = B.CreateICmpULT(idx, tapeCells, "loop_cond");
         B.CreateCondBr(cond, tapeBody, tapeDone);
     }
 
     // tape_fill_loop_body:
     B.SetInsertPoint(tapeBody);
     {
-        auto *idx = B.CreateLoad(i32, currTapeIdx);
+        auto *idx = B.CreateLoad(i64, currTapeIdx);
         auto *gep = B.CreateGEP(i32, tapePtr, {idx}, "tape_gep");
         B.CreateStore(llvm::ConstantInt::get(i32, xIdx), gep);
 
-        auto *inc = B.CreateAdd(idx, llvm::ConstantInt::get(i32, 1));
+        auto *inc = B.CreateAdd(idx, llvm::ConstantInt::get(i64, 1));
         B.CreateStore(inc, currTapeIdx);
         B.CreateBr(tapeInit);
     }
 
     // tape_fill_loop_end:
     B.SetInsertPoint(tapeDone);
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currTapeIdx);
 
-    //  3 : debugging print of tape contents
-    BasicBlock *pLoop = BasicBlock::Create(ctx, "print_loop", mainFn);
-    BasicBlock *pBody = BasicBlock::Create(ctx, "print_body", mainFn);
-    BasicBlock *pEnd = BasicBlock::Create(ctx, "print_end", mainFn);
-    B.CreateBr(pLoop);
-
-    B.SetInsertPoint(pLoop);
-    {
-        auto *idx = B.CreateLoad(i32, currTapeIdx);
-        auto *cond = B.CreateICmpULT(idx, arrSize);
-        B.CreateCondBr(cond, pBody, pEnd);
+    // resume: lay the checkpointed runs over the blank tape. A tape too
+    // short for the runs or the head stops the program, as
+    // Checkpoint::restore() does in the interpreter.
+    Value *startHead = tapePtr;
+    unsigned startState = machine.initialState;
+    uint64_t baseSteps = 0;
+    if (options.resume) {
+        const auto &ckpt = *options.resume;
+        uint64_t runsEnd = 0;
+        for (const auto &run : ckpt.runs)
+            runsEnd = std::max<uint64_t>(runsEnd, run.start + run.syms.size());
+        BasicBlock *runsFit = BasicBlock::Create(ctx, "resume_runs", mainFn);
+        BasicBlock *tooSmall = BasicBlock::Create(ctx, "resume_small", mainFn);
+        B.CreateCondBr(B.CreateICmpULE(B.getInt64(runsEnd), arrSize), runsFit,
+                       tooSmall);
+        B.SetInsertPoint(tooSmall);
+        buildPrintf(B, printfFn,
+                    "Tape of %llu cells is too small for the checkpoint, "
+                    "which needs %llu\n",
+                    {arrSize, B.getInt64(runsEnd)});
+        B.CreateRet(B.getInt32(1));
+        B.SetInsertPoint(runsFit);
+        for (const auto &run : ckpt.runs) {
+            std::vector<uint32_t> syms;
+            for (const auto &sym : run.syms)
+                syms.push_back(machine.symbolIndex(sym));
+            auto *data = new llvm::GlobalVariable(
+                mod, llvm::ArrayType::get(i32, syms.size()), true,
+                GlobalValue::PrivateLinkage,
+                llvm::ConstantDataArray::get(ctx, syms), "resume_run");
+            B.CreateMemCpy(B.CreateGEP(i32, tapePtr, {B.getInt64(run.start)}),
+                           llvm::MaybeAlign(4), data, llvm::MaybeAlign(4),
+                           syms.size() * sizeof(int32_t));
+        }
+        BasicBlock *headFits = BasicBlock::Create(ctx, "resume_head", mainFn);
+        BasicBlock *headOff = BasicBlock::Create(ctx, "resume_off", mainFn);
+        B.CreateCondBr(B.CreateICmpULT(B.getInt64(ckpt.head), arrSize),
+                       headFits, headOff);
+        B.SetInsertPoint(headOff);
+        buildPrintf(B, printfFn,
+                    "Checkpoint head at %lld is off the tape of %llu cells\n",
+                    {B.getInt64(ckpt.head), arrSize});
+        B.CreateRet(B.getInt32(1));
+        B.SetInsertPoint(headFits);
+        startHead = B.CreateGEP(i32, tapePtr, {B.getInt64(ckpt.head)});
+        startState = machine.stateIndex(ckpt.state);
+        baseSteps = ckpt.steps;
     }
-    B.SetInsertPoint(pBody);
-    {
-        auto *idx = B.CreateLoad(i32, currTapeIdx);
-        auto *gep = B.CreateGEP(i32, tapePtr, {idx});
-        auto *val = B.CreateLoad(i32, gep);
-        buildPrintf(B, printfFn, "Tape Content: %d\n", {val});
-        auto *inc = B.CreateAdd(idx, llvm::ConstantInt::get(i32, 1));
-        B.CreateStore(inc, currTapeIdx);
+
+    //  3 : debugging print of tape contents (before and after the run),
+    // tape by tape
+    auto emitTapeDump = [&]() {
+        BasicBlock *pLoop = BasicBlock::Create(ctx, "print_loop", mainFn);
+        BasicBlock *pBody = BasicBlock::Create(ctx, "print_body", mainFn);
+        BasicBlock *pEnd = BasicBlock::Create(ctx, "print_end", mainFn);
+        B.CreateStore(llvm::ConstantInt::get(i64, 0), currTapeIdx);
         B.CreateBr(pLoop);
+
+        B.SetInsertPoint(pLoop);
+        {
+            auto *idx = B.CreateLoad(i64, currTapeIdx);
+            auto *cond = B.CreateICmpULT(idx, tapeCells);
+            B.CreateCondBr(cond, pBody, pEnd);
+        }
+        B.SetInsertPoint(pBody);
+        {
+            auto *idx = B.CreateLoad(i64, currTapeIdx);
+            auto *gep = B.CreateGEP(i32, tapePtr, {idx});
+            auto *val = B.CreateLoad(i32, gep);
+            buildPrintf(B, printfFn, "Tape Content: %d\n", {val});
+            auto *inc = B.CreateAdd(idx, llvm::ConstantInt::get(i64, 1));
+            B.CreateStore(inc, currTapeIdx);
+            B.CreateBr(pLoop);
+        }
+        B.SetInsertPoint(pEnd);
+    };
+    emitTapeDump();
+
+    // tape index of a head, tape 1 starts at 0
+    auto headIndex = [&](BV h) {
+        auto *bytes = B.CreateSub(B.CreatePtrToInt(h, B.getInt64Ty()),
+                                  B.CreatePtrToInt(tapePtr, B.getInt64Ty()));
+        return B.CreateExactSDiv(bytes, B.getInt64(sizeof(int32_t)));
+    };
+    // after the loop, cells written back: dump the tapes and, in halt mode,
+    // report how the run ended
+    auto emitRunEnd = [&](BV endStep, BV endState, BV endHead, BV halted,
+                          llvm::ArrayRef<llvm::Constant *> stateStrings) {
+        buildPrintf(B, printfFn, "Reached end of steps loop.\n");
+        emitTapeDump();
+        if (halted) {
+            // tape extent: first and last non-blank cell, -1 if all blank
+            BasicBlock *pre = B.GetInsertBlock();
+            BasicBlock *loop = BasicBlock::Create(ctx, "extent_loop", mainFn);
+            BasicBlock *body = BasicBlock::Create(ctx, "extent_body", mainFn);
+            BasicBlock *done = BasicBlock::Create(ctx, "extent_end", mainFn);
+            B.CreateBr(loop);
+            B.SetInsertPoint(loop);
+            auto *idx = B.CreatePHI(i64, 2, "extent_idx");
+            auto *lo = B.CreatePHI(i64, 2, "extent_lo");
+            auto *hi = B.CreatePHI(i64, 2, "extent_hi");
+            idx->addIncoming(B.getInt64(0), pre);
+            lo->addIncoming(B.getInt64(-1), pre);
+            hi->addIncoming(B.getInt64(-1), pre);
+            B.CreateCondBr(B.CreateICmpULT(idx, arrSize), body, done);
+            B.SetInsertPoint(body);
+            auto *val = B.CreateLoad(i32, B.CreateGEP(i32, tapePtr, {idx}));
+            auto *used = B.CreateICmpNE(val, B.getInt32(xIdx));
+            auto *first = B.CreateAnd(used, B.CreateICmpSLT(lo, B.getInt64(0)));
+            idx->addIncoming(B.CreateAdd(idx, B.getInt64(1)), body);
+            lo->addIncoming(B.CreateSelect(first, idx, lo), body);
+            hi->addIncoming(B.CreateSelect(used, idx, hi), body);
+            B.CreateBr(loop);
+            B.SetInsertPoint(done);
+
+            auto *names = nameTable(mod, stateStrings, "state_names");
+            auto *stateName = B.CreateLoad(
+                i8Ptr, B.CreateGEP(names->getValueType(), names,
+                                   {B.getInt32(0), endState}));
+            auto *fmt = B.CreateSelect(
+                halted,
+                B.CreateGlobalString("Halted after %llu steps in state %s, "
+                                     "head at %lld, tape extent [%lld, "
+                                     "%lld]\n"),
+                B.CreateGlobalString("Step budget exhausted after %llu steps "
+                                     "in state %s, head at %lld, tape extent "
+                                     "[%lld, %lld]\n"));
+            // steps since the start of the run, a checkpoint's included
+            auto *stepsDone = B.CreateAdd(endStep, B.getInt64(baseSteps));
+            B.CreateCall(printfFn, {fmt, stepsDone, stateName,
+                                    headIndex(endHead), lo, hi});
+        }
+    };
+
+    //  4 : main steps-loop (state-machine core)
+    // Every head lives in a register as a pointer into its tape and the
+    // symbol under it as a cached value, both carried across iterations by
+    // phis. A cell is written back only when the head moves off it or when
+    // the loop exits; prints to other cells go straight to memory.
+    auto *numSteps = B.CreateLoad(i64, numStepsPtr, "num_steps");
+    std::vector<Value *> startHeads{startHead}, firstCells;
+    for (unsigned t = 1; t < numTapes; ++t)
+        startHeads.push_back(B.CreateGEP(i32, tapePtr,
+                                         {B.CreateMul(arrSize, B.getInt64(t))},
+                                         "tape_base"));
+    for (auto *h : startHeads)
+        firstCells.push_back(B.CreateLoad(i32, h, "first_cell"));
+
+    // block and global name part of a combination: "0" or "0_1"
+    auto comboLabel = [&](unsigned c) {
+        std::string label;
+        for (unsigned t = 0; t < numTapes; ++t)
+            label += (t ? "_" : "") + symbols[machine.comboSymbol(c, t)];
+        return label;
+    };
+    std::vector<llvm::Constant *> symStrings(totalCombos),
+        stateStrings(totalStates);
+    for (unsigned i = 0; i < totalCombos; ++i)
+        symStrings[i] = B.CreateGlobalString(machine.comboName(i),
+                                             "sym_" + comboLabel(i));
+    for (unsigned i = 0; i < totalStates; ++i)
+        stateStrings[i] = B.CreateGlobalString(states[i], "state_" + states[i]);
+
+    // instrumentation: one i64 counter per case
+    llvm::GlobalVariable *caseCounters = nullptr;
+    if (!options.profileGenerate.empty() || !options.stats.empty()) {
+        auto *ty =
+            llvm::ArrayType::get(B.getInt64Ty(), totalCombos * totalStates);
+        caseCounters = new llvm::GlobalVariable(
+            mod, ty, false, GlobalValue::InternalLinkage,
+            llvm::ConstantAggregateZero::get(ty), "case_counts");
+    }
+
+    // what every taken case does first: count the case and trace it, both
+    // looked up at run time as cases share their code
+    auto emitCaseEntry = [&](BV caseNum, BV combo, BV state) {
+        if (caseCounters) {
+            auto *slot = B.CreateGEP(caseCounters->getValueType(),
+                                     caseCounters, {B.getInt32(0), caseNum});
+            auto *hits = B.CreateLoad(B.getInt64Ty(), slot);
+            B.CreateStore(B.CreateAdd(hits, B.getInt64(1)), slot);
+        }
+        if (options.trace) {
+            auto *syms = nameTable(mod, symStrings, "symbol_names");
+            auto *names = nameTable(mod, stateStrings, "state_names");
+            auto *sym = B.CreateLoad(
+                i8Ptr, B.CreateGEP(syms->getValueType(), syms,
+                                   {B.getInt32(0), combo}));
+            auto *name = B.CreateLoad(
+                i8Ptr, B.CreateGEP(names->getValueType(), names,
+                                   {B.getInt32(0), state}));
+            buildPrintf(B, printfFn, "Symbol: %s State: %s\n", {sym, name});
+        }
+    };
+
+    // --stats head telemetry for the head of tape 1 after a step
+    auto emitHeadStats = [&](BV head) {
+        if (options.stats.empty())
+            return;
+        auto *idx = headIndex(head);
+        auto *min = B.CreateLoad(i64, headStats.min);
+        B.CreateStore(B.CreateSelect(B.CreateICmpSLT(idx, min), idx, min),
+                      headStats.min);
+        auto *max = B.CreateLoad(i64, headStats.max);
+        B.CreateStore(B.CreateSelect(B.CreateICmpSGT(idx, max), idx, max),
+                      headStats.max);
+        // left of the tape: bucket 0, right of it: the last bucket
+        auto *lastBucket = B.getInt64(stats::Stats::NUM_BUCKETS - 1);
+        auto *bucket = B.CreateUDiv(idx, headStats.bucketWidth);
+        bucket = B.CreateSelect(B.CreateICmpUGT(bucket, lastBucket),
+                                lastBucket, bucket);
+        bucket = B.CreateSelect(B.CreateICmpSLT(idx, B.getInt64(0)),
+                                B.getInt64(0), bucket);
+        auto *slot = B.CreateGEP(headStats.histogram->getValueType(),
+                                 headStats.histogram, {B.getInt64(0), bucket});
+        B.CreateStore(B.CreateAdd(B.CreateLoad(i64, slot), B.getInt64(1)),
+                      slot);
+    };
+
+    // ----- verify & return IR-string
+    // ----------------------------------------
+    auto finishModule = [&]() {
+        {
+            timeReport::Scope phase("verifyModule");
+            if (llvm::verifyModule(mod, &llvm::errs()))
+                throw std::runtime_error("generated module is invalid!");
+        }
+        timeReport::Scope phase(options.bitcode ? "writeBitcode"
+                                                : "printModule");
+        ir = serialize(mod, options.bitcode);
+    };
+
+    // Partitioned: the loop lives in one module per group of states (see
+    // buildGroup), main calls the group of the start state and picks up
+    // the registers where the run ended.
+    if (partitioned) {
+        auto groupOf = optimizer::partitionStates(machine, options.partitions);
+        auto ruleClass = optimizer::ruleClasses(machine);
+        auto stateOrder = options.layout ? optimizer::layoutStates(machine)
+                                         : std::vector<unsigned>{};
+        auto *endTy = runEndType(ctx, numTapes);
+        auto *end = IRBuilder<>(entry, entry->begin())
+                        .CreateAlloca(endTy, nullptr, "run_end");
+        std::vector<BV> args{tapePtr};
+        args.insert(args.end(), startHeads.begin(), startHeads.end());
+        args.insert(args.end(), firstCells.begin(), firstCells.end());
+        args.insert(args.end(),
+                    {B.getInt32(startState), B.getInt64(0), numSteps, end});
+        B.CreateCall(mod.getOrInsertFunction(groupName(groupOf[startState]),
+                                             groupFnType(ctx, numTapes)),
+                     args);
+
+        std::vector<BV> endHeads;
+        for (unsigned t = 0; t < numTapes; ++t) {
+            auto *h = B.CreateLoad(
+                i8Ptr,
+                B.CreateGEP(endTy, end,
+                            {B.getInt32(0), B.getInt32(0), B.getInt32(t)}),
+                "end_head");
+            auto *c = B.CreateLoad(
+                i32,
+                B.CreateGEP(endTy, end,
+                            {B.getInt32(0), B.getInt32(1), B.getInt32(t)}),
+                "end_cell");
+            B.CreateStore(c, h);
+            endHeads.push_back(h);
+        }
+        auto *endState =
+            B.CreateLoad(i32, B.CreateStructGEP(endTy, end, 2), "end_state");
+        auto *endStep =
+            B.CreateLoad(i64, B.CreateStructGEP(endTy, end, 3), "end_step");
+        BV halted = nullptr;
+        if (options.halt)
+            halted = B.CreateLoad(B.getInt1Ty(),
+                                  B.CreateStructGEP(endTy, end, 4), "halted");
+        emitRunEnd(endStep, endState, endHeads[0], halted, stateStrings);
+        B.CreateRet(llvm::ConstantInt::get(i32, 0));
+        finishModule();
+
+        // the groups are independent modules, built on a small pool
+        timeReport::Scope phase("buildGroups");
+        const unsigned groups =
+            *std::max_element(groupOf.begin(), groupOf.end()) + 1;
+        partIrs.assign(groups, "");
+        std::vector<std::exception_ptr> errors(groups);
+        std::atomic<unsigned> nextGroup{0};
+        auto worker = [&]() {
+            for (unsigned g; (g = nextGroup++) < groups;) {
+                try {
+                    partIrs[g] = buildGroup(machine, options, groupOf,
+                                            ruleClass, stateOrder, g);
+                } catch (...) {
+                    errors[g] = std::current_exception();
+                }
+            }
+        };
+        const unsigned threads = std::min(
+            groups, std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> pool;
+        for (unsigned i = 0; i < threads; ++i)
+            pool.emplace_back(worker);
+        for (auto &thread : pool)
+            thread.join();
+        for (auto &error : errors)
+            if (error)
+                std::rethrow_exception(error);
+        return;
     }
-    B.SetInsertPoint(pEnd);
-    B.CreateStore(llvm::ConstantInt::get(i32, 0), currTapeIdx);
 
-    //  4 : main steps-loop (state-machine core) – identical to Rust version
+    // Table dispatch: the machine as constant data, walked by one generic
+    // loop. Rules are reduced to their classes (optimizer::ruleClasses)
+    // and every class to its fused effect per tape:
+    //   dispatch_table[case]      class + 1, 0 without a rule; i8, i16 or
+    //                             i32, whatever holds the classes
+    //   class_next[class]         next state
+    //   class_moves[class * k + t]  head move on tape t
+    //   class_write_start[class]  first write, the writes of a class end
+    //                             where those of the next one start
+    //   class_writes[3 * w]       tape, offset from the head, symbol
+    // Heads live in a small array indexed by tape and cells are read from
+    // memory, nothing is cached across steps.
+    if (table) {
+        const auto ruleClass = optimizer::ruleClasses(machine);
+        std::vector<unsigned> classRule; // first rule of every class
+        for (unsigned r = 0; r < machine.rules.size(); ++r)
+            if (ruleClass[r] == classRule.size())
+                classRule.push_back(r);
+        const unsigned numClasses = classRule.size();
+
+        std::vector<uint32_t> entries(totalCombos * totalStates, 0);
+        for (unsigned num = 0; num < entries.size(); ++num) {
+            auto rule = machine.ruleFor(num % totalStates, num / totalStates);
+            if (rule != machine::Machine::NO_RULE)
+                entries[num] = ruleClass[rule] + 1;
+        }
+        std::vector<uint32_t> next, moves, writeStart{0}, writes;
+        for (unsigned r : classRule) {
+            const Transition &T = machine.rules[r];
+            next.push_back(state2idx.at(T.finalState));
+            for (unsigned t = 0; t < numTapes; ++t) {
+                auto fused = optimizer::fuseSteps(machine, T.steps, t);
+                moves.push_back(fused.move);
+                for (auto [offset, sym] : fused.writes)
+                    writes.insert(writes.end(), {t, uint32_t(offset), sym});
+            }
+            writeStart.push_back(writes.size() / 3);
+        }
+        auto constTable = [&](llvm::Constant *init, const char *name) {
+            return new llvm::GlobalVariable(mod, init->getType(), true,
+                                            GlobalValue::PrivateLinkage,
+                                            init, name);
+        };
+        auto packed = [&](auto elem) {
+            std::vector<decltype(elem)> data(entries.begin(), entries.end());
+            return llvm::ConstantDataArray::get(ctx, data);
+        };
+        llvm::Constant *dispatchInit = numClasses < UINT8_MAX
+                                           ? packed(uint8_t{})
+                                           : numClasses < UINT16_MAX
+                                                 ? packed(uint16_t{})
+                                                 : packed(uint32_t{});
+        auto *dispatchTable = constTable(dispatchInit, "dispatch_table");
+        auto *nextTable =
+            constTable(llvm::ConstantDataArray::get(ctx, next), "class_next");
+        auto *movesTable = constTable(
+            llvm::ConstantDataArray::get(ctx, moves), "class_moves");
+        auto *startTable = constTable(
+            llvm::ConstantDataArray::get(ctx, writeStart),
+            "class_write_start");
+        auto *writesTable = constTable(
+            llvm::ConstantDataArray::get(ctx, writes), "class_writes");
+        auto load = [&](llvm::GlobalVariable *table, BV idx,
+                        const char *name) -> BV {
+            auto *ty = table->getValueType();
+            auto *elem = B.CreateLoad(
+                ty->getArrayElementType(),
+                B.CreateGEP(ty, table, {B.getInt32(0), idx}), name);
+            return B.CreateZExt(elem, i32);
+        };
+
+        auto *headsTy = llvm::ArrayType::get(i8Ptr, numTapes);
+        auto *headSlots = IRBuilder<>(entry, entry->begin())
+                              .CreateAlloca(headsTy, nullptr, "heads");
+        auto headSlot = [&](BV t) {
+            return B.CreateGEP(headsTy, headSlots, {B.getInt32(0), t});
+        };
+        for (unsigned t = 0; t < numTapes; ++t)
+            B.CreateStore(startHeads[t], headSlot(B.getInt32(t)));
+
+        BasicBlock *preheader = B.GetInsertBlock();
+        auto block = [&](const char *name) {
+            return BasicBlock::Create(ctx, name, mainFn);
+        };
+        BasicBlock *stepsLoop = block("steps_loop");
+        BasicBlock *stepsBody = block("steps_loop_body");
+        BasicBlock *ruleBlock = block("rule");
+        BasicBlock *noRule = block("no_rule");
+        BasicBlock *writesLoop = block("writes_loop");
+        BasicBlock *writesBody = block("writes_body");
+        BasicBlock *writesEnd = block("writes_end");
+        BasicBlock *afterStep = block("after_step");
+        BasicBlock *stepsExit = block("steps_loop_end");
+        B.CreateBr(stepsLoop);
+
+        B.SetInsertPoint(stepsLoop);
+        auto *cStep = B.CreatePHI(i64, 2, "step");
+        auto *state = B.CreatePHI(i32, 2, "state");
+        cStep->addIncoming(B.getInt64(0), preheader);
+        state->addIncoming(B.getInt32(startState), preheader);
+        B.CreateCondBr(B.CreateICmpULT(cStep, numSteps, "step_limit_cond"),
+                       stepsBody, stepsExit);
+
+        B.SetInsertPoint(stepsBody);
+        auto *head = B.CreateLoad(i8Ptr, headSlot(B.getInt32(0)), "head");
+        if (options.trace) {
+            buildPrintf(B, printfFn, "Current step: %llu\n", {cStep});
+            buildPrintf(B, printfFn, "Current tape index: %lld\n",
+                        {headIndex(head)});
+        }
+        BV combo = nullptr;
+        for (unsigned t = numTapes; t-- > 0;) {
+            auto *h = t ? B.CreateLoad(i8Ptr, headSlot(B.getInt32(t)))
+                        : static_cast<BV>(head);
+            auto *cell = B.CreateLoad(i32, h, "cell");
+            combo = combo ? B.CreateAdd(B.CreateMul(combo,
+                                                    B.getInt32(totalSyms)),
+                                        cell, "combo")
+                          : cell;
+        }
+        auto *caseNum = B.CreateAdd(
+            B.CreateMul(combo, B.getInt32(totalStates)), state, "case");
+        auto *classPlusOne = load(dispatchTable, caseNum, "entry");
+        B.CreateCondBr(B.CreateICmpNE(classPlusOne, B.getInt32(0)),
+                       ruleBlock, noRule);
+
+        // no_rule: halts, or a step that changes nothing
+        B.SetInsertPoint(noRule);
+        if (options.halt) {
+            if (options.trace)
+                buildPrintf(B, printfFn, "Default Remainder: %llu\n",
+                            {cStep});
+            B.CreateBr(stepsExit);
+        } else {
+            emitCaseEntry(caseNum, combo, state);
+            B.CreateBr(afterStep);
+        }
+
+        B.SetInsertPoint(ruleBlock);
+        emitCaseEntry(caseNum, combo, state);
+        auto *cls = B.CreateSub(classPlusOne, B.getInt32(1), "class");
+        auto *first = load(startTable, cls, "first_write");
+        auto *last = load(startTable, B.CreateAdd(cls, B.getInt32(1)),
+                          "end_write");
+        B.CreateBr(writesLoop);
+
+        B.SetInsertPoint(writesLoop);
+        auto *w = B.CreatePHI(i32, 2, "write");
+        w->addIncoming(first, ruleBlock);
+        B.CreateCondBr(B.CreateICmpULT(w, last), writesBody, writesEnd);
+
+        B.SetInsertPoint(writesBody);
+        {
+            auto *base = B.CreateMul(w, B.getInt32(3));
+            auto *tape = load(writesTable, base, "write_tape");
+            auto *offset = load(writesTable,
+                                B.CreateAdd(base, B.getInt32(1)),
+                                "write_offset");
+            auto *sym = load(writesTable, B.CreateAdd(base, B.getInt32(2)),
+                             "write_sym");
+            auto *h = B.CreateLoad(i8Ptr, headSlot(tape));
+            B.CreateStore(sym, B.CreateGEP(i32, h, {offset}));
+            w->addIncoming(B.CreateAdd(w, B.getInt32(1)), writesBody);
+            B.CreateBr(writesLoop);
+        }
+
+        B.SetInsertPoint(writesEnd);
+        for (unsigned t = 0; t < numTapes; ++t) {
+            auto *move = load(
+                movesTable,
+                B.CreateAdd(B.CreateMul(cls, B.getInt32(numTapes)),
+                            B.getInt32(t)),
+                "move");
+            auto *slot = headSlot(B.getInt32(t));
+            B.CreateStore(
+                B.CreateGEP(i32, B.CreateLoad(i8Ptr, slot), {move}), slot);
+        }
+        auto *nextState = load(nextTable, cls, "next_state");
+        B.CreateBr(afterStep);
+
+        B.SetInsertPoint(afterStep);
+        auto *stepState = B.CreatePHI(i32, 2, "step_state");
+        stepState->addIncoming(nextState, writesEnd);
+        if (!options.halt)
+            stepState->addIncoming(state, noRule);
+        emitHeadStats(head);
+        cStep->addIncoming(B.CreateAdd(cStep, B.getInt64(1)), afterStep);
+        state->addIncoming(stepState, afterStep);
+        B.CreateBr(stepsLoop);
+
+        B.SetInsertPoint(stepsExit);
+        BV halted = nullptr;
+        if (options.halt) {
+            auto *phi = B.CreatePHI(B.getInt1Ty(), 2, "halted");
+            phi->addIncoming(B.getFalse(), stepsLoop);
+            phi->addIncoming(B.getTrue(), noRule);
+            halted = phi;
+        }
+        emitRunEnd(cStep, state,
+                   B.CreateLoad(i8Ptr, headSlot(B.getInt32(0))), halted,
+                   stateStrings);
+        if (!options.profileGenerate.empty())
+            buildProfileWrite(B, mod, mainFn, caseCounters, stateStrings,
+                              symStrings, options.profileGenerate);
+        if (!options.stats.empty())
+            buildStatsWrite(B, mod, mainFn, machine, caseCounters, headStats,
+                            cStep, options.stats);
+        B.CreateRet(B.getInt32(0));
+        finishModule();
+        return;
+    }
+
+    // The switch loop runs `unroll` copies of its body back to back, so
+    // the step budget is checked once per pass: with at least that many
+    // steps left the header takes the whole chain, with fewer it jumps
+    // into the chain just far enough from its end to take exactly the
+    // steps left (Duff's device). Sweeps take any number of steps and go
+    // back to the header, a halt leaves from its copy.
+    const unsigned unroll = std::max(1u, options.unroll);
+    BasicBlock *preheader = B.GetInsertBlock();
     BasicBlock *stepsLoop = BasicBlock::Create(ctx, "steps_loop", mainFn);
-    BasicBlock *stepsBody = BasicBlock::Create(ctx, "steps_loop_body", mainFn);
+    BasicBlock *stepsTail =
+        unroll > 1 ? BasicBlock::Create(ctx, "steps_tail", mainFn) : nullptr;
     BasicBlock *stepsExit = BasicBlock::Create(ctx, "steps_loop_end", mainFn);
-    BasicBlock *afterSwitch = BasicBlock::Create(ctx, "after_switch", mainFn);
     B.CreateBr(stepsLoop);
 
+    // the machine registers: step, every head and its cached cell, state
+    struct Regs {
+        BV step;
+        std::vector<BV> heads, cells;
+        BV state;
+    };
+    auto makePhis = [&](unsigned n) {
+        Regs r;
+        r.step = B.CreatePHI(i64, n, "step");
+        for (unsigned t = 0; t < numTapes; ++t) {
+            r.heads.push_back(B.CreatePHI(i8Ptr, n, "head"));
+            r.cells.push_back(B.CreatePHI(i32, n, "cell"));
+        }
+        r.state = B.CreatePHI(i32, n, "state");
+        return r;
+    };
+    auto addIncoming = [&](const Regs &phis, const Regs &r, BasicBlock *from) {
+        llvm::cast<llvm::PHINode>(phis.step)->addIncoming(r.step, from);
+        for (unsigned t = 0; t < numTapes; ++t) {
+            llvm::cast<llvm::PHINode>(phis.heads[t])
+                ->addIncoming(r.heads[t], from);
+            llvm::cast<llvm::PHINode>(phis.cells[t])
+                ->addIncoming(r.cells[t], from);
+        }
+        llvm::cast<llvm::PHINode>(phis.state)->addIncoming(r.state, from);
+    };
+
     // steps_loop:
     B.SetInsertPoint(stepsLoop);
-    {
-        auto *step = B.CreateLoad(i32, currStepPtr);
-        auto *n = B.CreateLoad(i32, numStepsPtr);
-        auto *ok = B.CreateICmpULT(step, n, "step_limit_cond");
-        B.CreateCondBr(ok, stepsBody, stepsExit);
+    const Regs loopRegs = makePhis(2);
+    addIncoming(loopRegs,
+                {B.getInt64(0), startHeads, firstCells,
+                 B.getInt32(startState)},
+                preheader);
+    auto *stepsLeft = B.CreateSub(numSteps, loopRegs.step, "steps_left");
+
+    // steps_loop_end: where the run ends, tape 1 is the one trace, stats,
+    // checkpoints and halt reports look at
+    B.SetInsertPoint(stepsExit);
+    const Regs endRegs = makePhis(unroll + 1);
+    llvm::PHINode *halted = nullptr;
+    if (options.halt)
+        halted = B.CreatePHI(B.getInt1Ty(), unroll + 1, "halted");
+    BasicBlock *budgetExit = stepsTail ? stepsTail : stepsLoop;
+    addIncoming(endRegs, loopRegs, budgetExit);
+    if (halted)
+        halted->addIncoming(B.getFalse(), budgetExit);
+
+    // the entry of every copy, copy 0 starts right in the header
+    std::vector<BasicBlock *> copyEntry{
+        BasicBlock::Create(ctx, "steps_loop_body", mainFn)};
+    std::vector<Regs> copyRegs{loopRegs};
+    for (unsigned j = 1; j < unroll; ++j) {
+        copyEntry.push_back(BasicBlock::Create(
+            ctx, "steps_loop_body_" + std::to_string(j), mainFn));
+        B.SetInsertPoint(copyEntry[j]);
+        copyRegs.push_back(makePhis(2));
+        addIncoming(copyRegs[j], loopRegs, stepsTail);
+    }
+    B.SetInsertPoint(stepsLoop);
+    B.CreateCondBr(
+        B.CreateICmpUGE(stepsLeft, B.getInt64(unroll), "step_limit_cond"),
+        copyEntry[0], stepsTail ? stepsTail : stepsExit);
+    if (stepsTail) {
+        // fewer than `unroll` steps left: the last ones of the chain
+        B.SetInsertPoint(stepsTail);
+        auto *sw = B.CreateSwitch(stepsLeft, stepsExit, unroll - 1);
+        for (unsigned left = 1; left < unroll; ++left)
+            sw->addCase(B.getInt64(left), copyEntry[unroll - left]);
     }
 
-    // steps_loop_body:
-    B.SetInsertPoint(stepsBody);
+    Function *checkpointFn = nullptr;
+    auto emitCheckpoint = [&](const Regs &r) {
+        B.CreateStore(r.cells[0], r.heads[0]);
+        auto *steps = B.CreateAdd(r.step, B.getInt64(baseSteps));
+        B.CreateCall(checkpointFn, {tapePtr, arrSize, steps, r.state,
+                                    headIndex(r.heads[0])});
+    };
+    if (!options.checkpointPrefix.empty()) {
+        checkpointFn =
+            buildCheckpointFn(mod, machine, options.checkpointPrefix);
+    }
 
-    auto *cStep = B.CreateLoad(i32, currStepPtr);
-    buildPrintf(B, printfFn, "Current step: %d\n", {cStep});
+    // ----- dispatch blocks
+    // One block per class of equal rules (same actions, same next state,
+    // see optimizer::ruleClasses): every symbol of a Star or OR condition
+    // and equal rules of different states share it. Cases without a rule
+    // go to the default destination, so code size follows the number of
+    // rules rather than states * combinations.
+    const auto ruleClass = optimizer::ruleClasses(machine);
+    std::vector<unsigned> classRule; // first rule of every class
+    for (unsigned r = 0; r < machine.rules.size(); ++r)
+        if (ruleClass[r] == classRule.size())
+            classRule.push_back(r);
 
-    auto *cIdx = B.CreateLoad(i32, currTapeIdx);
-    buildPrintf(B, printfFn, "Current tape index: %d\n", {cIdx});
+    // Sweeps: the cases of a state's self-loops that leave the tape alone
+    // go to one block for the state, which skips the whole stretch of
+    // cells that keep the head in the loop and counts the skipped steps.
+    // Every step has to be seen one by one for traces and counters.
+    const bool sweepsOk = options.sweeps && numTapes == 1 && !options.trace &&
+                          !caseCounters && !options.checkpointEvery &&
+                          totalSyms <= 32;
+    const auto sweeps = sweepsOk ? optimizer::sweeps(machine)
+                                 : std::vector<optimizer::Sweep>{};
+    auto *tapeEnd =
+        sweeps.empty()
+            ? nullptr
+            : IRBuilder<>(preheader->getTerminator())
+                  .CreateGEP(i32, tapePtr, {tapeCells}, "tape_end");
 
-    // switch dispatch  (symIdx * totalStates + stateIdx)
-    auto *symIdx = B.CreateLoad(i32, currSymPtr);
-    auto *stateIdx = B.CreateLoad(i32, currStatePtr);
-    auto *lhsMul =
-        B.CreateMul(symIdx, llvm::ConstantInt::get(i32, totalStates));
-    auto *caseNum = B.CreateAdd(lhsMul, stateIdx, "switch_case");
+    // recorded counts per case, all zero without a profile
+    const unsigned numCases = totalCombos * totalStates;
+    std::vector<uint64_t> caseCounts(numCases, 0);
+    if (options.profileUse)
+        for (unsigned num = 0; num < numCases; ++num)
+            caseCounts[num] = options.profileUse->count(
+                states[num % totalStates],
+                machine.comboName(num / totalStates));
 
-    BasicBlock *switchDefault =
-        BasicBlock::Create(ctx, "switch_default", mainFn);
-    llvm::SwitchInst *sw =
-        B.CreateSwitch(caseNum, switchDefault, totalSyms * totalStates);
+    // hottest cases first; a no-op ordering without a profile
+    std::vector<unsigned> caseOrder(numCases);
+    for (unsigned num = 0; num < caseOrder.size(); ++num)
+        caseOrder[num] = num;
+    std::stable_sort(caseOrder.begin(), caseOrder.end(),
+                     [&](unsigned a, unsigned b) {
+                         return caseCounts[a] > caseCounts[b];
+                     });
 
-    // ----- generate N×M basic-blocks
-    std::vector<GlobalValue *> symStrings(totalSyms), stateStrings(totalStates);
-    for (unsigned i = 0; i < totalSyms; ++i)
-        symStrings[i] = B.CreateGlobalString(symbols[i], "sym_" + symbols[i]);
-    for (unsigned i = 0; i < totalStates; ++i)
-        stateStrings[i] = B.CreateGlobalString(states[i], "state_" + states[i]);
+    // what applyProfile needs of every copy
+    struct Copy {
+        llvm::SwitchInst *sw;
+        BasicBlock *afterSwitch;
+        std::vector<BasicBlock *> caseBlocks;
+    };
+    std::vector<Copy> copies;
 
-    std::vector<BasicBlock *> caseBlocks(totalSyms * totalStates);
-    for (unsigned s = 0; s < totalSyms; ++s) {
-        for (unsigned q = 0; q < totalStates; ++q) {
-            unsigned num = s * totalStates + q;
-            std::stringstream ss;
-            ss << "state_" << states[q] << "_sym_" << symbols[s];
-            caseBlocks[num] = BasicBlock::Create(ctx, ss.str(), mainFn);
-            sw->addCase(llvm::ConstantInt::get(i32, num), caseBlocks[num]);
+    // One copy of the body with registers `in`, from the insertion point.
+    // Returns the registers after the step; the insertion point is left at
+    // the end of its after_switch block, without a terminator.
+    auto emitStep = [&](const Regs &in) -> Regs {
+        BV head = in.heads[0];
+        BV cell = in.cells[0];
+        if (checkpointFn && options.checkpointEvery) {
+            BasicBlock *save = BasicBlock::Create(ctx, "checkpoint", mainFn);
+            BasicBlock *dispatch =
+                BasicBlock::Create(ctx, "steps_loop_dispatch", mainFn);
+            // on the grid of the absolute step count, as --run does
+            auto *absolute = B.CreateAdd(in.step, B.getInt64(baseSteps));
+            auto *due = B.CreateAnd(
+                B.CreateICmpNE(in.step, B.getInt64(0)),
+                B.CreateICmpEQ(
+                    B.CreateURem(absolute,
+                                 B.getInt64(options.checkpointEvery)),
+                    B.getInt64(0)));
+            llvm::MDBuilder MDB(ctx);
+            B.CreateCondBr(due, save, dispatch,
+                           MDB.createBranchWeights(1, options.checkpointEvery));
+            B.SetInsertPoint(save);
+            emitCheckpoint(in);
+            B.CreateBr(dispatch);
+            B.SetInsertPoint(dispatch);
         }
-    }
+        if (options.trace) {
+            buildPrintf(B, printfFn, "Current step: %llu\n", {in.step});
+            buildPrintf(B, printfFn, "Current tape index: %lld\n",
+                        {headIndex(head)});
+        }
+        // switch dispatch  (symIdx * totalStates + stateIdx), the symbol
+        // combination of all heads on multi tape machines (tape 1 fastest)
+        BV combo = in.cells[numTapes - 1];
+        for (unsigned t = numTapes - 1; t-- > 0;)
+            combo = B.CreateAdd(B.CreateMul(combo, B.getInt32(totalSyms)),
+                                in.cells[t], "combo");
+        auto *lhsMul =
+            B.CreateMul(combo, llvm::ConstantInt::get(i32, totalStates));
+        auto *caseNum = B.CreateAdd(lhsMul, in.state, "switch_case");
 
-    // emit prints + fallthrough to afterSwitch for every case
-    for (unsigned num = 0; num < caseBlocks.size(); ++num) {
-        B.SetInsertPoint(caseBlocks[num]);
-        unsigned s = num / totalStates;
-        unsigned q = num % totalStates;
-        buildPrintf(B, printfFn, "Symbol: %s State: %s\n",
-                    {symStrings[s], stateStrings[q]});
-        B.CreateBr(afterSwitch);
-    }
+        BasicBlock *switchDefault =
+            BasicBlock::Create(ctx, "switch_default", mainFn);
+        BasicBlock *afterSwitch =
+            BasicBlock::Create(ctx, "after_switch", mainFn);
+        llvm::SwitchInst *sw = B.CreateSwitch(caseNum, switchDefault);
 
-    // “Star beats OR” and duplicate-case
-    // suppression.
-    std::unordered_set<unsigned> alreadyDone;
-    auto sortedTransition = transitions;
-    std::stable_sort(sortedTransition.begin(), sortedTransition.end(),
-                     [](const Transition &A, const Transition &B) {
-                         if (std::holds_alternative<parser::OR>(A.condition) &&
-                             std::holds_alternative<parser::Star>(B.condition))
-                             return true;
-                         return false;
-                     });
-    for (const auto &T : sortedTransition) {
-
-        // Visitor function for variant
-        auto getSybols = overloaded{
-            [&](const parser::Star &) -> const std::vector<std::string> & {
-                return symbols;
-            },
-            [](const parser::OR &orCond) -> const std::vector<std::string> & {
-                return orCond.sym;
-            },
-        };
-        const std::vector<std::string> &symList =
-            std::visit(getSybols, T.condition);
-
-        for (const std::string &sym : symList) {
-            unsigned s = sym2idx.at(sym);
-            unsigned q = state2idx.at(T.initialState);
-            unsigned caseNo = s * totalStates + q;
-            if (!alreadyDone.insert(caseNo).second)
-                continue; // already patched
-
-            // splice before unconditional branch inside caseBlocks[caseNo]
-            B.SetInsertPoint(caseBlocks[caseNo]->getTerminator());
-
-            auto TransitionAction = overloaded{
-                [&](const parser::L) {
-                    auto *idx = B.CreateLoad(i32, currTapeIdx);
-
-                    auto *idx_new =
-                        B.CreateSub(idx, llvm::ConstantInt::get(i32, 1));
-                    B.CreateStore(idx_new, currTapeIdx);
-                },
-                [&](const parser::R) {
-                    auto *idx = B.CreateLoad(i32, currTapeIdx);
-
-                    auto *idx_new =
-                        B.CreateAdd(idx, llvm::ConstantInt::get(i32, 1));
-                    B.CreateStore(idx_new, currTapeIdx);
-                },
-                [&](const parser::X) {
-                    // noop
-                },
-                [&](const parser::P &p) {
-                    unsigned pIdx = sym2idx.at(p.sym);
-                    auto *idx = B.CreateLoad(i32, currTapeIdx);
-                    auto *gep = B.CreateGEP(i32, tapePtr, {idx});
-                    B.CreateStore(llvm::ConstantInt::get(i32, pIdx), gep);
-                },
-            };
-            for (TransitionStep st : T.steps) {
-                std::visit(TransitionAction, st);
-            }
-        } // for sym
-    }     // for transitions
+        std::vector<BasicBlock *> classBlocks;
+        for (unsigned r : classRule) {
+            const Transition &T = machine.rules[r];
+            classBlocks.push_back(BasicBlock::Create(
+                ctx, "rule_" + T.initialState + "_to_" + T.finalState,
+                mainFn));
+        }
+        // the block of every case, nullptr without a rule
+        std::vector<BasicBlock *> caseBlocks(numCases, nullptr);
+        for (unsigned num = 0; num < numCases; ++num) {
+            auto rule = machine.ruleFor(num % totalStates, num / totalStates);
+            if (rule != machine::Machine::NO_RULE)
+                caseBlocks[num] = classBlocks[ruleClass[rule]];
+        }
 
-    // switch_default:
-    B.SetInsertPoint(switchDefault);
-    buildPrintf(B, printfFn, "Default Remainder: %d\n", {cStep});
-    B.CreateBr(afterSwitch);
+        for (unsigned q = 0; q < sweeps.size(); ++q) {
+            if (!sweeps[q].move)
+                continue;
+            const auto &sweep = sweeps[q];
+            auto *block =
+                BasicBlock::Create(ctx, "sweep_" + states[q], mainFn);
+            uint32_t mask = 0;
+            for (unsigned sym = 0; sym < totalSyms; ++sym)
+                if (sweep.symbols[sym]) {
+                    mask |= 1u << sym;
+                    caseBlocks[sym * totalStates + q] = block;
+                }
+            // the step under the head, then the cells behind it in the loop
+            B.SetInsertPoint(block);
+            B.CreateStore(cell, head);
+            auto *limit = B.CreateSub(B.CreateSub(numSteps, in.step),
+                                      B.getInt64(1), "sweep_limit");
+            auto *more = B.CreateCall(buildSweepFn(mod, sweep.move),
+                                      {head, limit, B.getInt32(mask), tapePtr,
+                                       tapeEnd},
+                                      "sweep_cells");
+            auto *taken = B.CreateAdd(more, B.getInt64(1), "sweep_steps");
+            auto *to = B.CreateGEP(
+                i32, head, {B.CreateMul(taken, B.getInt64(sweep.move))},
+                "sweep_head");
+            addIncoming(loopRegs,
+                        {B.CreateAdd(in.step, taken),
+                         {to},
+                         {B.CreateLoad(i32, to, "sweep_cell")},
+                         B.getInt32(q)},
+                        block);
+            B.CreateBr(stepsLoop);
+        }
 
-    // after_switch:
-    B.SetInsertPoint(afterSwitch);
-    auto *nextStep = B.CreateAdd(cStep, llvm::ConstantInt::get(i32, 1));
-    B.CreateStore(nextStep, currStepPtr);
+        for (unsigned num : caseOrder)
+            if (caseBlocks[num])
+                sw->addCase(llvm::ConstantInt::get(i32, num), caseBlocks[num]);
 
-    // crude symbol-index update (exactly the same arithmetic as Rust stub)
-    auto *nextSym = B.CreateAdd(symIdx, llvm::ConstantInt::get(i32, 2));
-    nextSym = B.CreateSRem(nextSym, llvm::ConstantInt::get(i32, totalSyms));
-    B.CreateStore(nextSym, currSymPtr);
-    B.CreateBr(stepsLoop);
+        // after_switch merges the machine registers of every block
+        B.SetInsertPoint(afterSwitch);
+        const Regs next = makePhis(classBlocks.size() + 1);
+
+        // Conditions are already resolved by machine::fromParseTree
+        // (“Star beats OR” and duplicate-case suppression).
+        for (unsigned k = 0; k < classBlocks.size(); ++k) {
+            const Transition &T = machine.rules[classRule[k]];
+            B.SetInsertPoint(classBlocks[k]);
+            emitCaseEntry(caseNum, combo, in.state);
+            std::vector<BV> h = in.heads, c = in.cells;
+            lowerActions(B, machine, T, options.fuseActions, h, c);
+            B.CreateBr(afterSwitch);
+            addIncoming(next,
+                        {in.step, h, c,
+                         llvm::ConstantInt::get(i32,
+                                                state2idx.at(T.finalState))},
+                        classBlocks[k]);
+        }
 
-    // steps_loop_end:
+        // switch_default: a case without a rule halts or, by default, is a
+        // step that changes nothing
+        B.SetInsertPoint(switchDefault);
+        if (options.halt) {
+            if (options.trace)
+                buildPrintf(B, printfFn, "Default Remainder: %llu\n",
+                            {in.step});
+            B.CreateBr(stepsExit);
+            addIncoming(endRegs, in, switchDefault);
+            halted->addIncoming(B.getTrue(), switchDefault);
+        } else {
+            emitCaseEntry(caseNum, combo, in.state);
+            B.CreateBr(afterSwitch);
+            addIncoming(next, in, switchDefault);
+        }
+
+        // after_switch:
+        B.SetInsertPoint(afterSwitch);
+        // head of the step just taken; a halting dispatch never gets here,
+        // which keeps the histogram in line with the interpreter
+        emitHeadStats(head);
+        copies.push_back({sw, afterSwitch, caseBlocks});
+        return {B.CreateAdd(next.step, B.getInt64(1)), next.heads, next.cells,
+                next.state};
+    };
+
+    // the chain, its last copy goes back to the header
+    for (unsigned j = 0; j < unroll; ++j) {
+        B.SetInsertPoint(copyEntry[j]);
+        Regs out = emitStep(copyRegs[j]);
+        const bool last = j + 1 == unroll;
+        B.CreateBr(last ? stepsLoop : copyEntry[j + 1]);
+        addIncoming(last ? loopRegs : copyRegs[j + 1], out,
+                    B.GetInsertBlock());
+    }
+
+    // steps_loop_end: write the cached cells back
     B.SetInsertPoint(stepsExit);
-    buildPrintf(B, printfFn, "Reached end of steps loop.\n");
+    for (unsigned t = 0; t < numTapes; ++t)
+        B.CreateStore(endRegs.cells[t], endRegs.heads[t]);
+    if (checkpointFn)
+        emitCheckpoint(endRegs);
+    emitRunEnd(endRegs.step, endRegs.state, endRegs.heads[0], halted,
+               stateStrings);
+    if (!options.profileGenerate.empty())
+        buildProfileWrite(B, mod, mainFn, caseCounters, stateStrings,
+                          symStrings, options.profileGenerate);
+    if (!options.stats.empty())
+        buildStatsWrite(B, mod, mainFn, machine, caseCounters, headStats,
+                        endRegs.step, options.stats);
     B.CreateRet(llvm::ConstantInt::get(i32, 0));
 
-    // ----- verify & return IR-string
-    // ----------------------------------------
-    if (llvm::verifyModule(mod, &llvm::errs()))
-        throw std::runtime_error("generated module is invalid!");
-    llvm::raw_string_ostream os(ir);
-    mod.print(os, nullptr);
+    if (options.profileUse) {
+        std::vector<int64_t> caseNext(numCases, -1);
+        for (unsigned num = 0; num < numCases; ++num) {
+            auto rule = machine.ruleFor(num % totalStates, num / totalStates);
+            if (rule != machine::Machine::NO_RULE)
+                caseNext[num] = state2idx.at(machine.rules[rule].finalState);
+        }
+        for (const auto &copy : copies)
+            applyProfile(mod, mainFn, copy.sw, stepsLoop, copy.afterSwitch,
+                         copy.caseBlocks, caseCounts, caseNext, totalStates);
+    } else if (options.layout) {
+        const auto stateOrder = optimizer::layoutStates(machine);
+        for (const auto &copy : copies)
+            applyLayout(copy.afterSwitch, copy.caseBlocks, stateOrder,
+                        totalStates);
+    }
+
+    finishModule();
 }
 } // namespace llvmBackend
\ No newline at end of file
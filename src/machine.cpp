@@ -0,0 +1,161 @@
+#include "machine.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+namespace machine {
+
+unsigned Machine::symbolIndex(const std::string &sym) const {
+    auto it = sym2idx.find(sym);
+    if (it == sym2idx.end())
+        throw std::runtime_error("[MACHINE]: Unknown symbol: " + sym);
+    return it->second;
+}
+
+unsigned Machine::stateIndex(const std::string &state) const {
+    auto it = state2idx.find(state);
+    if (it == state2idx.end())
+        throw std::runtime_error("[MACHINE]: Unknown state: " + state);
+    return it->second;
+}
+
+std::string Machine::comboName(unsigned combo) const {
+    if (tapes == 1)
+        return symbols[combo];
+    std::string name = "(";
+    for (unsigned t = 0; t < tapes; ++t)
+        name += (t ? ", " : "") + symbols[comboSymbol(combo, t)];
+    return name + ")";
+}
+
+void Machine::makeHaltState(const std::string &state) {
+    unsigned q = stateIndex(state);
+    std::fill_n(dispatch.begin() + q * numCombos(), numCombos(), NO_RULE);
+}
+
+// largest dispatch table we are willing to build, in cells
+static const uint64_t MAX_DISPATCH = uint64_t(1) << 26;
+
+// The condition of every tape, tape 1 first
+static std::vector<parser::TapeCondition>
+perTape(const parser::Condition &cond) {
+    auto split = overloaded{
+        [](const parser::Tuple &tuple) { return tuple.tapes; },
+        [](const auto &single) {
+            return std::vector<parser::TapeCondition>{single};
+        },
+    };
+    return std::visit(split, cond);
+}
+
+// Every combination of symbols `conds` accept, tape by tape
+static std::vector<unsigned>
+combosOf(const Machine &m, const std::vector<parser::TapeCondition> &conds) {
+    auto getSymbols = overloaded{
+        [&](const parser::Star &) -> const std::vector<std::string> & {
+            return m.symbols;
+        },
+        [](const parser::OR &orCond) -> const std::vector<std::string> & {
+            return orCond.sym;
+        },
+    };
+    std::vector<unsigned> combos{0};
+    unsigned stride = 1;
+    for (const auto &cond : conds) {
+        std::vector<unsigned> grown;
+        for (const auto &sym : std::visit(getSymbols, cond))
+            for (unsigned combo : combos)
+                grown.push_back(combo + m.symbolIndex(sym) * stride);
+        combos = std::move(grown);
+        stride *= m.numSymbols();
+    }
+    return combos;
+}
+
+Machine fromParseTree(const parser::ParseTree &tree) {
+    Machine m;
+    m.symbols = tree.symbols;
+    m.symbols.push_back("X"); // "X" is always last
+    m.states = tree.states;
+    m.rules = tree.transitions;
+    m.tapes = tree.tapes;
+
+    for (unsigned i = 0; i < m.symbols.size(); ++i)
+        m.sym2idx[m.symbols[i]] = i;
+    for (unsigned i = 0; i < m.states.size(); ++i)
+        m.state2idx[m.states[i]] = i;
+    m.initialState = m.stateIndex(tree.initial_state);
+
+    uint64_t cells = m.numStates();
+    for (unsigned t = 0; t < m.tapes; ++t) {
+        cells *= m.numSymbols();
+        if (cells > MAX_DISPATCH)
+            throw std::runtime_error(
+                "[MACHINE]: Too many symbol combinations for " +
+                std::to_string(m.tapes) + " tapes");
+    }
+    m.dispatch.assign(cells, Machine::NO_RULE);
+
+    // OR conditions first, then Star; first writer of a cell wins. With
+    // several tapes: fewer Star tapes first.
+    for (unsigned stars = 0; stars <= m.tapes; ++stars) {
+        for (unsigned r = 0; r < m.rules.size(); ++r) {
+            const auto &T = m.rules[r];
+            auto conds = perTape(T.condition);
+            if (conds.size() != m.tapes)
+                throw std::runtime_error(
+                    "[MACHINE]: Transition on line " + std::to_string(T.line) +
+                    " matches " + std::to_string(conds.size()) +
+                    " tapes, the machine has " + std::to_string(m.tapes));
+            auto isStar = [](const parser::TapeCondition &cond) {
+                return std::holds_alternative<parser::Star>(cond);
+            };
+            if (unsigned(std::count_if(conds.begin(), conds.end(), isStar)) !=
+                stars)
+                continue;
+
+            unsigned q = m.stateIndex(T.initialState);
+            // validate the target early so backends can index blindly
+            m.stateIndex(T.finalState);
+            for (unsigned combo : combosOf(m, conds)) {
+                auto &cell = m.dispatch[q * m.numCombos() + combo];
+                if (cell == Machine::NO_RULE)
+                    cell = r;
+            }
+            for (const auto &st : T.steps) {
+                if (auto *p = std::get_if<parser::P>(&st))
+                    m.symbolIndex(p->sym);
+                if (parser::tapeOf(st) >= m.tapes)
+                    throw std::runtime_error(
+                        "[MACHINE]: Transition on line " +
+                        std::to_string(T.line) + " uses tape " +
+                        std::to_string(parser::tapeOf(st) + 1));
+            }
+        }
+    }
+    return m;
+}
+
+Branches branches(const Machine &m) {
+    std::vector<std::vector<uint32_t>> byCase(m.dispatch.size());
+    for (unsigned r = 0; r < m.rules.size(); ++r) {
+        const auto &T = m.rules[r];
+        const unsigned q = m.stateIndex(T.initialState);
+        for (unsigned combo : combosOf(m, perTape(T.condition))) {
+            const unsigned num = q * m.numCombos() + combo;
+            if (m.dispatch[num] != Machine::NO_RULE)
+                byCase[num].push_back(r);
+        }
+    }
+    Branches b;
+    b.start.push_back(0);
+    for (const auto &rules : byCase) {
+        b.rules.insert(b.rules.end(), rules.begin(), rules.end());
+        b.start.push_back(b.rules.size());
+    }
+    return b;
+}
+
+} // namespace machine
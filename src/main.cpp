@@ -1,20 +1,587 @@
+#include "checkpoint.hpp"
+#include "cppBackend.hpp"
+#include "interpreter.hpp"
 #include "lexer.hpp"
 #include "llvmBackend.hpp"
+#include "nondet.hpp"
+#include "optimizer.hpp"
 #include "parser.hpp"
+#include "profile.hpp"
+#include "server.hpp"
+#include "stats.hpp"
+#include "timeReport.hpp"
 #include "utils.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
 #include <memory>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
 using json = nlohmann::json;
-int main() {
+
+static void usage() {
+    std::cout << "Usage: smc [options] [file.sm...]\n"
+              << "  --emit=ir     LLVM IR to misc/a.ll (default)\n"
+              << "  --emit=bc     LLVM bitcode with a ThinLTO summary to\n"
+              << "                misc/a.bc\n"
+              << "  --emit=cpp    constexpr C++ header to misc/<name>.hpp\n"
+              << "  --emit=lib    re-entrant <prefix>_run(...) in\n"
+              << "                misc/<prefix>.ll and its C header in\n"
+              << "                misc/<prefix>.h, for every file.sm\n"
+              << "  --prefix=<p>  symbol prefix of --emit=lib (default\n"
+              << "                smc_<name>)\n"
+              << "  --run=<n>     interpret n steps on the host\n"
+              << "  --tape=<n>    tape cells for --run (default 64)\n"
+              << "  --exact-tape  size the tape from the number of steps,\n"
+              << "                bounded by analysis of the transitions\n"
+              << "  --tape-runs   keep the --run tape as runs of equal\n"
+              << "                symbols instead of one int per cell\n"
+              << "  --nondet      with --run: follow every transition that\n"
+              << "                matches, breadth first, for up to n steps\n"
+              << "  --accept=<state>\n"
+              << "                --nondet accepts when a branch enters\n"
+              << "                <state>\n"
+              << "  --reject=<state>\n"
+              << "                and drops branches that enter <state>\n"
+              << "  --max-configs=<n>\n"
+              << "                distinct configurations --nondet keeps\n"
+              << "                (default 1048576)\n"
+              << "  --threads=<n> threads of --nondet (default: one per core)\n"
+              << "  -o <file>     output file\n"
+              << "  --minimize    drop unreachable states and unused symbols,\n"
+              << "                merge equivalent states before codegen\n"
+              << "  --no-fuse     lower action lists step by step\n"
+              << "  --no-trace    no per step printf in generated code\n"
+              << "  --no-sweeps   dispatch self-loops cell by cell\n"
+              << "  --no-layout   keep rule blocks in declaration order\n"
+              << "  --halt        stop the generated program at the first\n"
+              << "                (state, symbol) without a transition\n"
+              << "  --halt-state=<state>\n"
+              << "                halt on entering <state> (implies --halt)\n"
+              << "  --profile-generate=<file>\n"
+              << "                count dispatch cases, write them to <file>\n"
+              << "  --profile-use=<file>\n"
+              << "                lay out dispatch for the counts in <file>\n"
+              << "  --stats=<file>\n"
+              << "                case hits and head histogram as JSON, from\n"
+              << "                --run or from the generated program\n"
+              << "  --checkpoint=<prefix>\n"
+              << "                write <prefix>.<steps>.ckpt at the end of\n"
+              << "                the run (--run or generated program)\n"
+              << "  --checkpoint-every=<n>\n"
+              << "                and every n steps\n"
+              << "  --resume=<file.ckpt>\n"
+              << "                start from a checkpoint instead of a blank\n"
+              << "                tape\n"
+              << "  --seek=<n>    print the configuration after n steps,\n"
+              << "                replaying from the nearest --checkpoint\n"
+              << "  --dispatch=auto|switch|table\n"
+              << "                compiled rules or constant tables and a\n"
+              << "                generic loop (auto: tables above\n"
+              << "                --table-states states, default 4096)\n"
+              << "  --table-states=<n>\n"
+              << "                states above which auto dispatch uses\n"
+              << "                tables (default 4096)\n"
+              << "  --unroll=<k>  check the step budget once per k steps of\n"
+              << "                the switch loop (default 1)\n"
+              << "  --partitions=<n>\n"
+              << "                split the steps loop over up to n modules\n"
+              << "                (<out>.part<g>.ll), built in parallel\n"
+              << "  --target-triple=<triple>\n"
+              << "                target of the generated modules (default\n"
+              << "                arm64-apple-macosx13.0.0)\n"
+              << "  --data-layout=<layout>\n"
+              << "                its data layout (default\n"
+              << "                e-m:o-i64:64-i128:128-n32:64-S128)\n"
+              << "  --time-report[=text|json]\n"
+              << "                wall/cpu time, allocations and peak RSS per\n"
+              << "                compiler phase, on stderr\n"
+              << "  --time-trace=<file>\n"
+              << "                the same phases as a Chrome trace\n"
+              << "  --serve=<socket>\n"
+              << "                compile requests from a Unix socket on\n"
+              << "                warm worker threads, until SIGINT or\n"
+              << "                SIGTERM\n"
+              << "  --workers=<n> threads of --serve (default: one per core)\n"
+              << "  --max-connections=<n>\n"
+              << "                connections --serve takes at once\n"
+              << "                (default 64)\n"
+              << "  --max-steps=<n>\n"
+              << "                steps a --serve run may take\n"
+              << "                (default 2^30)\n"
+              << "  --max-tape-cells=<n>\n"
+              << "                cells a --serve run may have\n"
+              << "                (default 2^20)\n"
+              << "  --connect=<socket>\n"
+              << "                have a --serve daemon compile or --run\n"
+              << "                file.sm, print its JSON reply\n"
+              << "  --repeat=<n>  with --connect: send it n times per\n"
+              << "                client, print latency percentiles\n"
+              << "  --clients=<n> connections --repeat sends from at once\n"
+              << "  -h            show this message\n";
+}
+
+int main(int argc, char **argv) {
     std::string fileName = "tests/examples/simple2.sm";
-    auto lexer = std::make_unique<lexer::Lexer>(fileName);
-    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
-    auto llvmBackend =
-        std::make_unique<llvmBackend::LllvmBackend>(std::move(parser));
-    nlohmann::json j;
-    llvmBackend->dumpParseTree(j);
-    dump_json_to_file("misc/example.json", j);
-    llvmBackend->getIr();
-    dump_string_to_file("misc/a.ll", llvmBackend->ir);
-    return 0;
-}
\ No newline at end of file
+    std::vector<std::string> inputs;
+    std::string prefix;
+    std::string emit = "ir";
+    std::string output;
+    bool minimize = false;
+    std::optional<uint64_t> runSteps;
+    uint64_t tapeSize = 64;
+    bool tapeRuns = false;
+    bool nondetRun = false;
+    nondet::Options nondetOptions;
+    std::optional<uint64_t> seekStep;
+    std::vector<std::string> haltStates;
+    std::string statsFile;
+    std::string timeReportFormat;
+    std::string timeTraceFile;
+    server::Options serveOptions;
+    std::string connectSocket;
+    uint64_t repeat = 1;
+    unsigned clients = 1;
+    llvmBackend::CodegenOptions codegen;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else if (arg.rfind("--emit=", 0) == 0) {
+            emit = arg.substr(7);
+        } else if (arg.rfind("--prefix=", 0) == 0) {
+            prefix = arg.substr(9);
+        } else if (arg == "--minimize") {
+            minimize = true;
+        } else if (arg == "--no-fuse") {
+            codegen.fuseActions = false;
+        } else if (arg == "--no-trace") {
+            codegen.trace = false;
+        } else if (arg == "--no-sweeps") {
+            codegen.sweeps = false;
+        } else if (arg == "--no-layout") {
+            codegen.layout = false;
+        } else if (arg.rfind("--profile-generate=", 0) == 0) {
+            codegen.profileGenerate = arg.substr(19);
+        } else if (arg.rfind("--profile-use=", 0) == 0) {
+            codegen.profileUse = profile::load_profile(arg.substr(14));
+        } else if (arg.rfind("--run=", 0) == 0) {
+            runSteps = std::stoull(arg.substr(6));
+        } else if (arg.rfind("--tape=", 0) == 0) {
+            tapeSize = std::stoull(arg.substr(7));
+        } else if (arg == "--tape-runs") {
+            tapeRuns = true;
+        } else if (arg == "--nondet") {
+            nondetRun = true;
+        } else if (arg.rfind("--accept=", 0) == 0) {
+            nondetOptions.accept.push_back(arg.substr(9));
+        } else if (arg.rfind("--reject=", 0) == 0) {
+            nondetOptions.reject.push_back(arg.substr(9));
+        } else if (arg.rfind("--max-configs=", 0) == 0) {
+            nondetOptions.maxConfigs = std::stoull(arg.substr(14));
+        } else if (arg.rfind("--threads=", 0) == 0) {
+            nondetOptions.threads = std::stoul(arg.substr(10));
+        } else if (arg == "--exact-tape") {
+            codegen.exactTape = true;
+        } else if (arg.rfind("--stats=", 0) == 0) {
+            statsFile = arg.substr(8);
+            codegen.stats = statsFile;
+        } else if (arg == "--halt") {
+            codegen.halt = true;
+        } else if (arg.rfind("--halt-state=", 0) == 0) {
+            haltStates.push_back(arg.substr(13));
+            codegen.halt = true;
+        } else if (arg.rfind("--checkpoint=", 0) == 0) {
+            codegen.checkpointPrefix = arg.substr(13);
+        } else if (arg.rfind("--checkpoint-every=", 0) == 0) {
+            codegen.checkpointEvery = std::stoull(arg.substr(19));
+        } else if (arg.rfind("--resume=", 0) == 0) {
+            codegen.resume = checkpoint::load_checkpoint(arg.substr(9));
+        } else if (arg.rfind("--dispatch=", 0) == 0) {
+            using Dispatch = llvmBackend::CodegenOptions::Dispatch;
+            std::string kind = arg.substr(11);
+            if (kind == "auto") {
+                codegen.dispatch = Dispatch::Auto;
+            } else if (kind == "switch") {
+                codegen.dispatch = Dispatch::Switch;
+            } else if (kind == "table") {
+                codegen.dispatch = Dispatch::Table;
+            } else {
+                std::cerr << "Unknown dispatch: " << kind << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("--table-states=", 0) == 0) {
+            codegen.tableStates = std::stoul(arg.substr(15));
+        } else if (arg.rfind("--unroll=", 0) == 0) {
+            codegen.unroll = std::max(1, std::stoi(arg.substr(9)));
+        } else if (arg.rfind("--partitions=", 0) == 0) {
+            codegen.partitions = std::max(1, std::stoi(arg.substr(13)));
+        } else if (arg.rfind("--target-triple=", 0) == 0) {
+            codegen.targetTriple = arg.substr(16);
+        } else if (arg.rfind("--data-layout=", 0) == 0) {
+            codegen.dataLayout = arg.substr(14);
+        } else if (arg.rfind("--seek=", 0) == 0) {
+            seekStep = std::stoull(arg.substr(7));
+        } else if (arg == "--time-report") {
+            timeReportFormat = "text";
+        } else if (arg.rfind("--time-report=", 0) == 0) {
+            timeReportFormat = arg.substr(14);
+            if (timeReportFormat != "text" && timeReportFormat != "json") {
+                std::cerr << "Unknown time report format: "
+                          << timeReportFormat << "\n";
+                return 1;
+            }
+        } else if (arg.rfind("--time-trace=", 0) == 0) {
+            timeTraceFile = arg.substr(13);
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            serveOptions.socketPath = arg.substr(8);
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            serveOptions.workers = std::stoul(arg.substr(10));
+        } else if (arg.rfind("--max-connections=", 0) == 0) {
+            serveOptions.maxConnections = std::stoul(arg.substr(18));
+        } else if (arg.rfind("--max-steps=", 0) == 0) {
+            serveOptions.maxSteps = std::stoull(arg.substr(12));
+        } else if (arg.rfind("--max-tape-cells=", 0) == 0) {
+            serveOptions.maxTapeCells = std::stoull(arg.substr(17));
+        } else if (arg.rfind("--connect=", 0) == 0) {
+            connectSocket = arg.substr(10);
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            repeat = std::max<uint64_t>(1, std::stoull(arg.substr(9)));
+        } else if (arg.rfind("--clients=", 0) == 0) {
+            clients = std::max(1, std::stoi(arg.substr(10)));
+        } else if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!arg.empty() && arg[0] != '-') {
+            fileName = arg;
+            inputs.push_back(arg);
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            usage();
+            return 1;
+        }
+    }
+    if (nondetRun &&
+        (!runSteps || minimize || tapeRuns || codegen.exactTape ||
+         !statsFile.empty() || !codegen.checkpointPrefix.empty() ||
+         codegen.resume || seekStep || !connectSocket.empty())) {
+        // minimize and the tape bound assume the rule dispatch picks
+        std::cerr << "--nondet needs --run and takes no --minimize, "
+                     "--tape-runs, --exact-tape, stats, checkpoints, --seek "
+                     "or --connect\n";
+        return 1;
+    }
+    if (!serveOptions.socketPath.empty()) {
+        server::serve(serveOptions);
+        return 0;
+    }
+    if (!connectSocket.empty()) {
+        if (!codegen.profileGenerate.empty() || codegen.profileUse ||
+            !statsFile.empty() || !codegen.checkpointPrefix.empty() ||
+            codegen.resume || seekStep) {
+            std::cerr << "--connect takes no profiles, stats, checkpoints "
+                         "or --seek\n";
+            return 1;
+        }
+        json request = {
+            {"path", std::filesystem::absolute(fileName).string()},
+            {"emit", runSteps ? "run" : emit},
+            {"minimize", minimize},
+            {"haltStates", haltStates},
+            {"codegen", server::toJson(codegen)}};
+        if (runSteps) {
+            request["steps"] = *runSteps;
+            request["tape"] = tapeSize;
+        }
+        if (!prefix.empty())
+            request["name"] = prefix;
+        if (repeat > 1 || clients > 1) {
+            std::cout << server::bench(connectSocket, request, repeat, clients)
+                             .dump(4)
+                      << std::endl;
+            return 0;
+        }
+        auto reply = server::Client(connectSocket).call(request);
+        std::cout << reply.dump(4) << std::endl;
+        return reply.value("ok", false) ? 0 : 1;
+    }
+    if (!timeReportFormat.empty() || !timeTraceFile.empty())
+        timeReport::get().enable();
+
+    // Everything after option parsing, so that the time report sees every
+    // phase closed.
+    auto compile = [&]() -> int {
+        auto lex = [&](const std::string &file) {
+            timeReport::Scope phase("lexer");
+            return std::make_unique<lexer::Lexer>(file);
+        };
+        // machine level passes shared by every backend
+        auto prepare = [&](machine::Machine &m) {
+            for (const auto &q : haltStates)
+                m.makeHaltState(q);
+            if (!minimize)
+                return;
+            timeReport::Scope phase("minimize");
+            std::cout << optimizer::minimize(m) << std::endl;
+        };
+        if (emit == "lib" && !runSteps && !seekStep) {
+            if (inputs.empty())
+                inputs.push_back(fileName);
+            if (inputs.size() > 1 && (!prefix.empty() || !output.empty())) {
+                std::cerr << "--prefix and -o take a single file.sm\n";
+                return 1;
+            }
+            codegen.trace = false;
+            std::set<std::string> prefixes;
+            for (const auto &file : inputs) {
+                std::string name = prefix;
+                if (name.empty()) {
+                    name = "smc_" + std::filesystem::path(file).stem().string();
+                    for (auto &c : name)
+                        if (!std::isalnum(static_cast<unsigned char>(c)))
+                            c = '_';
+                }
+                auto isWord = [](char c) {
+                    return std::isalnum(static_cast<unsigned char>(c)) ||
+                           c == '_';
+                };
+                if (std::isdigit(static_cast<unsigned char>(name[0])) ||
+                    !std::all_of(name.begin(), name.end(), isWord)) {
+                    std::cerr << "Prefix is not a C identifier: " << name
+                              << "\n";
+                    return 1;
+                }
+                if (!prefixes.insert(name).second) {
+                    std::cerr << "Two machines with prefix " << name << "\n";
+                    return 1;
+                }
+                auto parser = std::make_unique<parser::Parser>(lex(file));
+                std::unique_ptr<llvmBackend::LllvmBackend> llvmBackend;
+                {
+                    timeReport::Scope phase("parse");
+                    llvmBackend = std::make_unique<llvmBackend::LllvmBackend>(
+                        std::move(parser));
+                }
+                prepare(llvmBackend->machine);
+                llvmBackend->options = codegen;
+                llvmBackend->options.library = name;
+                {
+                    timeReport::Scope phase("getIr");
+                    llvmBackend->getIr();
+                }
+                timeReport::Scope phase("writeOutput");
+                auto out = std::filesystem::path(
+                    output.empty() ? "misc/" + name + ".ll" : output);
+                dump_string_to_file(out.string(), llvmBackend->ir);
+                dump_string_to_file(out.replace_extension(".h").string(),
+                                    llvmBackend->header);
+            }
+            return 0;
+        }
+        auto parser = std::make_unique<parser::Parser>(lex(fileName));
+        if (runSteps || seekStep) {
+            machine::Machine m;
+            {
+                timeReport::Scope phase("parse");
+                parser->parse();
+                m = machine::fromParseTree(parser->tree);
+            }
+            prepare(m);
+            if (nondetRun) {
+                nondetOptions.tapeSize = tapeSize;
+                nondetOptions.maxSteps = *runSteps;
+                nondet::Result r;
+                {
+                    timeReport::Scope phase("search");
+                    r = nondet::search(m, nondetOptions);
+                }
+                std::cout << r.verdict << " after " << r.steps << " steps, "
+                          << r.configs << " configurations, widest level "
+                          << r.widest << ", " << r.dead << " dead branches\n";
+                if (r.verdict == nondet::Verdict::Accepted) {
+                    std::cout << "in state " << m.states[r.state]
+                              << (m.tapes == 1 ? ", head at " : ", heads at ");
+                    for (size_t t = 0; t < r.heads.size(); ++t)
+                        std::cout << (t ? ", " : "") << r.heads[t];
+                    std::cout << "\n";
+                    for (const auto &tape : r.tapes) {
+                        for (auto cell : tape)
+                            std::cout << m.symbols[cell] << " ";
+                        std::cout << "\n";
+                    }
+                }
+                std::cout << std::flush;
+                return 0;
+            }
+            // --seek replays from the latest checkpoint not past the step
+            if (seekStep && !codegen.checkpointPrefix.empty()) {
+                auto file =
+                    checkpoint::nearest(codegen.checkpointPrefix, *seekStep);
+                if (file) {
+                    std::cout << "Replaying from " << *file << "\n";
+                    codegen.resume = checkpoint::load_checkpoint(*file);
+                }
+            }
+            if (codegen.exactTape) {
+                auto extent = optimizer::tapeExtent(m);
+                std::cout << extent << std::endl;
+                uint64_t done = codegen.resume ? codegen.resume->steps : 0;
+                uint64_t steps = runSteps.value_or(0);
+                if (seekStep)
+                    steps = *seekStep > done ? *seekStep - done : 0;
+                tapeSize = extent.cells(steps);
+                if (codegen.resume)
+                    tapeSize += codegen.resume->frontier();
+            }
+            if (codegen.resume)
+                tapeSize = std::max(tapeSize, codegen.resume->tapeSize);
+            if (tapeRuns) {
+                if (!statsFile.empty() || !codegen.checkpointPrefix.empty() ||
+                    codegen.resume || seekStep) {
+                    std::cerr << "--tape-runs takes no stats, checkpoints "
+                                 "or --seek\n";
+                    return 1;
+                }
+                interpreter::RunInterpreter interp(m, tapeSize);
+                {
+                    timeReport::Scope phase("interpret");
+                    interp.run(*runSteps);
+                }
+                // a run of n > 1 cells prints as <symbol>^n
+                std::cout << interp.status << " after " << interp.steps
+                          << " steps in state " << m.states[interp.state]
+                          << ", head at " << interp.tape.head() << ", "
+                          << interp.tape.numRuns() << " runs\n";
+                for (const auto &run : interp.tape.runs()) {
+                    std::cout << m.symbols[run.sym];
+                    if (run.count > 1)
+                        std::cout << "^" << run.count;
+                    std::cout << " ";
+                }
+                std::cout << std::endl;
+                return 0;
+            }
+            interpreter::Interpreter interp(m, tapeSize);
+            if (codegen.resume)
+                codegen.resume->restore(interp);
+            if (seekStep) {
+                runSteps = *seekStep > interp.steps ? *seekStep - interp.steps
+                                                    : 0;
+                codegen.checkpointPrefix.clear(); // inspect only
+            }
+            stats::Stats stats(m, tapeSize);
+            {
+                timeReport::Scope phase("interpret");
+                auto *rec = statsFile.empty() ? nullptr : &stats;
+                const auto &prefix = codegen.checkpointPrefix;
+                const uint64_t every = codegen.checkpointEvery;
+                const uint64_t target = interp.steps + *runSteps;
+                // stop on every multiple of `every` (absolute step count)
+                while (interp.steps < target &&
+                       interp.status == interpreter::Status::Running) {
+                    uint64_t stop = target;
+                    if (every)
+                        stop = std::min(stop, (interp.steps / every + 1) *
+                                                  every);
+                    interp.run(stop - interp.steps, rec);
+                    if (!prefix.empty() && every && interp.steps < target &&
+                        interp.status == interpreter::Status::Running)
+                        checkpoint::Checkpoint::capture(interp).save(
+                            checkpoint::fileFor(prefix, interp.steps));
+                }
+                if (!prefix.empty())
+                    checkpoint::Checkpoint::capture(interp).save(
+                        checkpoint::fileFor(prefix, interp.steps));
+            }
+            std::cout << interp.status << " after " << interp.steps
+                      << " steps in state " << m.states[interp.state]
+                      << (m.tapes == 1 ? ", head at " : ", heads at ");
+            for (size_t t = 0; t < interp.heads.size(); ++t)
+                std::cout << (t ? ", " : "") << interp.heads[t];
+            std::cout << "\n";
+            for (const auto &tape : interp.tapes) {
+                for (auto cell : tape)
+                    std::cout << m.symbols[cell] << " ";
+                std::cout << "\n";
+            }
+            std::cout << std::flush;
+            if (!statsFile.empty())
+                dump_json_to_file(statsFile, stats::toJson(m, stats));
+            return 0;
+        }
+        if (emit == "cpp") {
+            auto name = std::filesystem::path(fileName).stem().string();
+            std::unique_ptr<cppBackend::CppBackend> cppBackend;
+            {
+                timeReport::Scope phase("parse");
+                cppBackend =
+                    std::make_unique<cppBackend::CppBackend>(std::move(parser));
+            }
+            prepare(cppBackend->machine);
+            {
+                timeReport::Scope phase("getHeader");
+                cppBackend->getHeader(name);
+            }
+            timeReport::Scope phase("writeOutput");
+            dump_string_to_file(output.empty() ? "misc/" + name + ".hpp"
+                                               : output,
+                                cppBackend->header);
+            return 0;
+        }
+        if (emit != "ir" && emit != "bc") {
+            std::cerr << "Unknown emit kind: " << emit << "\n";
+            return 1;
+        }
+        codegen.bitcode = emit == "bc";
+        std::unique_ptr<llvmBackend::LllvmBackend> llvmBackend;
+        {
+            timeReport::Scope phase("parse");
+            llvmBackend =
+                std::make_unique<llvmBackend::LllvmBackend>(std::move(parser));
+        }
+        {
+            timeReport::Scope phase("dumpParseTree");
+            nlohmann::json j;
+            llvmBackend->dumpParseTree(j);
+            dump_json_to_file("misc/example.json", j);
+        }
+        prepare(llvmBackend->machine);
+        if (codegen.exactTape)
+            std::cout << optimizer::tapeExtent(llvmBackend->machine)
+                      << std::endl;
+        llvmBackend->options = codegen;
+        {
+            timeReport::Scope phase("getIr");
+            llvmBackend->getIr();
+        }
+        timeReport::Scope phase("writeOutput");
+        std::string out = output;
+        if (out.empty())
+            out = codegen.bitcode ? "misc/a.bc" : "misc/a.ll";
+        dump_string_to_file(out, llvmBackend->ir);
+        // misc/a.ll -> misc/a.part0.ll, ...
+        auto dot = out.rfind('.');
+        if (dot == std::string::npos ||
+            out.find('/', dot) != std::string::npos)
+            dot = out.size();
+        for (unsigned g = 0; g < llvmBackend->partIrs.size(); ++g)
+            dump_string_to_file(out.substr(0, dot) + ".part" +
+                                    std::to_string(g) + out.substr(dot),
+                                llvmBackend->partIrs[g]);
+        return 0;
+    };
+    int status = compile();
+
+    const auto &report = timeReport::get();
+    if (timeReportFormat == "text")
+        std::cerr << report << std::endl;
+    else if (timeReportFormat == "json")
+        std::cerr << timeReport::toJson(report).dump(4) << std::endl;
+    if (!timeTraceFile.empty())
+        dump_json_to_file(timeTraceFile, timeReport::toChromeTrace(report));
+    return status;
+}
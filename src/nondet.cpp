@@ -0,0 +1,396 @@
+#include "nondet.hpp"
+#include "optimizer.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+namespace nondet {
+
+using machine::Machine;
+
+std::ostream &operator<<(std::ostream &os, Verdict verdict) {
+    switch (verdict) {
+    case Verdict::Accepted:
+        return os << "accepted";
+    case Verdict::Rejected:
+        return os << "rejected";
+    case Verdict::Undecided:
+        return os << "undecided";
+    }
+    return os;
+}
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+FingerprintSet::FingerprintSet(uint64_t capacity) : limit(capacity) {
+    uint64_t size = 2;
+    while (size < 2 * capacity)
+        size *= 2;
+    slots = std::make_unique<std::atomic<uint64_t>[]>(size);
+    for (uint64_t i = 0; i < size; ++i)
+        slots[i].store(0, std::memory_order_relaxed);
+    mask = size - 1;
+}
+
+FingerprintSet::Insert FingerprintSet::insert(uint64_t fingerprint) {
+    // 0 marks an empty slot
+    if (!fingerprint)
+        fingerprint = 1;
+    for (uint64_t i = fingerprint & mask;; i = (i + 1) & mask) {
+        uint64_t seen = slots[i].load(std::memory_order_relaxed);
+        while (!seen) {
+            // racing inserts may overshoot the limit by a few, the table
+            // stays at most half full for all of them
+            if (count.load(std::memory_order_relaxed) >= limit)
+                return Insert::Full;
+            if (slots[i].compare_exchange_weak(seen, fingerprint,
+                                               std::memory_order_relaxed)) {
+                ++count;
+                return Insert::Added;
+            }
+        }
+        if (seen == fingerprint)
+            return Insert::Present;
+    }
+}
+
+bool FingerprintSet::contains(uint64_t fingerprint) const {
+    if (!fingerprint)
+        fingerprint = 1;
+    for (uint64_t i = fingerprint & mask;; i = (i + 1) & mask) {
+        uint64_t seen = slots[i].load(std::memory_order_relaxed);
+        if (!seen || seen == fingerprint)
+            return seen;
+    }
+}
+
+namespace {
+
+// Branches of one configuration, a level at a time
+class Search {
+  private:
+    const Machine &m;
+    const uint64_t tapeSize;
+    machine::Branches choices;
+    // ops[rule * tapes + tape], as in interpreter::Interpreter
+    std::vector<optimizer::FusedSteps> ops;
+    std::vector<unsigned> next;
+    // by state
+    std::vector<bool> accepting;
+    std::vector<bool> rejecting;
+
+  public:
+    FingerprintSet seen;
+    // a configuration did not fit into `seen`
+    bool full = false;
+
+    Search(const Machine &m, const Options &options)
+        : m(m), tapeSize(options.tapeSize), choices(machine::branches(m)),
+          accepting(m.numStates()), rejecting(m.numStates()),
+          seen(options.maxConfigs) {
+        for (const auto &T : m.rules) {
+            for (unsigned t = 0; t < m.tapes; ++t)
+                ops.push_back(optimizer::fuseSteps(m, T.steps, t));
+            next.push_back(m.stateIndex(T.finalState));
+        }
+        for (const auto &name : options.accept)
+            accepting[m.stateIndex(name)] = true;
+        for (const auto &name : options.reject) {
+            const unsigned q = m.stateIndex(name);
+            if (accepting[q])
+                throw std::runtime_error("[NONDET]: State " + name +
+                                         " both accepts and rejects");
+            rejecting[q] = true;
+        }
+    }
+
+    bool accepts(unsigned state) const { return accepting[state]; }
+    bool rejects(unsigned state) const { return rejecting[state]; }
+
+    // the Zobrist key of `sym` in cell `at`; blank cells add nothing
+    uint64_t zobrist(uint64_t at, unsigned sym) const {
+        return sym == m.blank() ? 0 : splitmix64(at * m.numSymbols() + sym);
+    }
+
+    uint64_t fingerprint(const Config &c) const {
+        uint64_t h = splitmix64(c.state);
+        for (int64_t head : c.heads)
+            h = splitmix64(h ^ head);
+        return c.tapeHash ^ h;
+    }
+
+    // blank tapes: one page and one node per level, all shared
+    Config initial() const {
+        Config c;
+        const uint64_t cells = m.tapes * tapeSize;
+        auto page = std::make_shared<Page>();
+        page->fill(m.blank());
+        c.root = page;
+        for (uint64_t covered = PAGE_CELLS; covered < cells;
+             covered <<= FANOUT_BITS) {
+            auto node = std::make_shared<Config::Node>();
+            node->fill(c.root);
+            c.root = node;
+            ++c.depth;
+        }
+        c.heads.assign(m.tapes, 0);
+        c.state = m.initialState;
+        return c;
+    }
+
+    void write(Config &c, uint64_t at, unsigned sym) const {
+        const unsigned old = c.cell(at);
+        if (old == sym)
+            return;
+        // copy what other configurations share on the way to the page
+        std::shared_ptr<void> *child = &c.root;
+        for (unsigned level = c.depth; level-- > 0;) {
+            auto *node = static_cast<Config::Node *>(child->get());
+            if (child->use_count() > 1) {
+                auto copy = std::make_shared<Config::Node>(*node);
+                node = copy.get();
+                *child = std::move(copy);
+            }
+            child = &(*node)[Config::slot(at, level)];
+        }
+        auto *page = static_cast<Page *>(child->get());
+        if (child->use_count() > 1) {
+            auto copy = std::make_shared<Page>(*page);
+            page = copy.get();
+            *child = std::move(copy);
+        }
+        (*page)[at % PAGE_CELLS] = sym;
+        c.tapeHash ^= zobrist(at, old) ^ zobrist(at, sym);
+    }
+
+    // Appends the successors of `c` that no earlier level has seen to
+    // `out`, and their fingerprints to `fingerprints`; successors that
+    // meet within the level are left to the caller. Returns the number of
+    // branches that died: a halt, a step off a tape or a rejecting state.
+    // The first successor in an accepting state goes to `accepted`.
+    uint64_t expand(const Config &c, std::vector<Config> &out,
+                    std::vector<uint64_t> &fingerprints,
+                    std::optional<Config> &accepted) const {
+        const int64_t size = tapeSize;
+        unsigned combo = 0;
+        for (unsigned t = m.tapes; t-- > 0;) {
+            if (c.heads[t] < 0 || c.heads[t] >= size)
+                return 1;
+            combo = combo * m.numSymbols() + c.cell(t * tapeSize + c.heads[t]);
+        }
+        const unsigned num = c.state * m.numCombos() + combo;
+        const uint32_t first = choices.start[num];
+        const uint32_t last = choices.start[num + 1];
+        if (first == last)
+            return 1;
+        uint64_t dead = 0;
+        for (uint32_t i = first; i < last; ++i) {
+            const uint32_t rule = choices.rules[i];
+            const auto *op = &ops[rule * m.tapes];
+            bool inside = true;
+            for (unsigned t = 0; t < m.tapes; ++t)
+                inside &= c.heads[t] + op[t].minOffset >= 0 &&
+                          c.heads[t] + op[t].maxOffset < size;
+            if (!inside || rejecting[next[rule]]) {
+                ++dead;
+                continue;
+            }
+            Config child = c;
+            for (unsigned t = 0; t < m.tapes; ++t) {
+                for (auto [offset, sym] : op[t].writes)
+                    write(child, t * tapeSize + child.heads[t] + offset, sym);
+                child.heads[t] += op[t].move;
+            }
+            child.state = next[rule];
+            if (accepting[child.state]) {
+                if (!accepted)
+                    accepted = std::move(child);
+                continue;
+            }
+            const uint64_t print = fingerprint(child);
+            if (seen.contains(print))
+                continue;
+            out.push_back(std::move(child));
+            fingerprints.push_back(print);
+        }
+        return dead;
+    }
+
+    void report(const Config &c, Result &result) const {
+        result.state = c.state;
+        result.heads = c.heads;
+        result.tapes.assign(m.tapes, std::vector<int32_t>(tapeSize));
+        for (unsigned t = 0; t < m.tapes; ++t)
+            for (uint64_t i = 0; i < tapeSize; ++i)
+                result.tapes[t][i] = c.cell(t * tapeSize + i);
+    }
+};
+
+// configurations one thread takes at a time; levels of fewer than two
+// chunks are expanded without threads
+constexpr size_t CHUNK = 1024;
+
+// Threads that stay up for the whole search and help the caller with
+// each level.
+class Crew {
+  private:
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable finished;
+    const std::function<void()> *job = nullptr;
+    uint64_t round = 0;
+    unsigned busy = 0;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    void work() {
+        for (uint64_t done = 0;;) {
+            const std::function<void()> *next;
+            {
+                std::unique_lock lock(mutex);
+                start.wait(lock, [&] { return stopping || round != done; });
+                if (stopping)
+                    return;
+                done = round;
+                next = job;
+            }
+            (*next)();
+            std::lock_guard lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+  public:
+    // `helpers` threads besides the caller
+    explicit Crew(unsigned helpers) {
+        for (unsigned i = 0; i < helpers; ++i)
+            threads.emplace_back([this] { work(); });
+    }
+    ~Crew() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // Runs `f` on every thread and the caller, returns once all are done.
+    // `f` must not throw.
+    void run(const std::function<void()> &f) {
+        {
+            std::lock_guard lock(mutex);
+            job = &f;
+            ++round;
+            busy = threads.size();
+        }
+        start.notify_all();
+        f();
+        std::unique_lock lock(mutex);
+        finished.wait(lock, [&] { return busy == 0; });
+    }
+};
+
+} // namespace
+
+Result search(const Machine &m, const Options &options) {
+    if (!options.tapeSize)
+        throw std::runtime_error("[NONDET]: Tape size must be positive");
+    if (!options.maxConfigs)
+        throw std::runtime_error("[NONDET]: Need room for a configuration");
+    Search s(m, options);
+    const unsigned threads =
+        options.threads ? options.threads
+                        : std::max(1u, std::thread::hardware_concurrency());
+
+    Result result;
+    std::vector<Config> level{s.initial()};
+    if (s.accepts(level[0].state)) {
+        result.verdict = Verdict::Accepted;
+        s.report(level[0], result);
+        return result;
+    }
+    if (s.rejects(level[0].state))
+        level.clear();
+    else
+        s.seen.insert(s.fingerprint(level[0]));
+
+    std::optional<Crew> crew;
+    while (!level.empty() && result.steps < options.maxSteps && !s.full) {
+        result.widest = std::max<uint64_t>(result.widest, level.size());
+        const size_t chunks = (level.size() + CHUNK - 1) / CHUNK;
+        // per chunk, merged in chunk order below
+        std::vector<std::vector<Config>> outs(chunks);
+        std::vector<std::vector<uint64_t>> fingerprints(chunks);
+        std::vector<std::optional<Config>> accepted(chunks);
+        std::vector<uint64_t> dead(chunks);
+        std::vector<std::exception_ptr> errors(chunks);
+        std::atomic<size_t> nextChunk{0};
+        const std::function<void()> worker = [&]() {
+            for (size_t i; (i = nextChunk++) < chunks;) {
+                try {
+                    const size_t end = std::min(level.size(), (i + 1) * CHUNK);
+                    for (size_t j = i * CHUNK; j < end; ++j)
+                        dead[i] += s.expand(level[j], outs[i], fingerprints[i],
+                                            accepted[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            }
+        };
+        if (threads < 2 || chunks < 2) {
+            worker();
+        } else {
+            if (!crew)
+                crew.emplace(threads - 1);
+            crew->run(worker);
+        }
+        for (auto &error : errors)
+            if (error)
+                std::rethrow_exception(error);
+
+        ++result.steps;
+        for (size_t i = 0; i < chunks; ++i) {
+            result.dead += dead[i];
+            if (accepted[i] && result.verdict != Verdict::Accepted) {
+                result.verdict = Verdict::Accepted;
+                s.report(*accepted[i], result);
+            }
+        }
+        if (result.verdict == Verdict::Accepted)
+            break;
+        // children that meet go to the first chunk that made them, so the
+        // next level is the same on any number of threads
+        level.clear();
+        for (size_t i = 0; i < chunks && !s.full; ++i) {
+            for (size_t j = 0; j < outs[i].size(); ++j) {
+                auto added = s.seen.insert(fingerprints[i][j]);
+                if (added == FingerprintSet::Insert::Full) {
+                    s.full = true;
+                    break;
+                }
+                if (added == FingerprintSet::Insert::Added)
+                    level.push_back(std::move(outs[i][j]));
+            }
+        }
+    }
+    // with a full set some branches were dropped, not refuted
+    if (level.empty() && !s.full && result.verdict != Verdict::Accepted)
+        result.verdict = Verdict::Rejected;
+    result.configs = s.seen.size();
+    return result;
+}
+
+} // namespace nondet
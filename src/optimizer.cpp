@@ -0,0 +1,602 @@
+#include "optimizer.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <optional>
+#include <queue>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+namespace optimizer {
+
+using machine::Machine;
+
+std::ostream &operator<<(std::ostream &os, const MinimizeReport &report) {
+    Indent indent{2};
+    os << "Minimize {\n";
+    os << indent << "states: " << report.statesBefore << " -> "
+       << report.statesAfter << " (" << report.unreachableStates
+       << " unreachable, " << report.mergedStates << " merged)\n";
+    os << indent << "symbols: " << report.symbolsBefore << " -> "
+       << report.symbolsAfter << "\n";
+    os << indent << "dispatch cells: " << report.dispatchBefore() << " -> "
+       << report.dispatchAfter() << "\n";
+    os << "}";
+    return os;
+}
+
+// Printed symbols of a rule, by index.
+static std::vector<unsigned> printedSymbols(const Machine &m,
+                                            const parser::Transition &T) {
+    std::vector<unsigned> out;
+    for (const auto &st : T.steps)
+        if (auto *p = std::get_if<parser::P>(&st))
+            out.push_back(m.symbolIndex(p->sym));
+    return out;
+}
+
+FusedSteps fuseSteps(const Machine &m,
+                     const std::vector<parser::TransitionStep> &steps,
+                     unsigned tape) {
+    FusedSteps fused;
+    int32_t head = 0;
+    auto apply = overloaded{
+        [&](const parser::L &) { --head; },
+        [&](const parser::R &) { ++head; },
+        [&](const parser::X &) {},
+        [&](const parser::P &p) {
+            fused.writes[head] = m.symbolIndex(p.sym);
+        },
+    };
+    for (const auto &st : steps) {
+        if (parser::tapeOf(st) != tape)
+            continue;
+        std::visit(apply, st);
+        fused.minOffset = std::min(fused.minOffset, head);
+        fused.maxOffset = std::max(fused.maxOffset, head);
+    }
+    fused.move = head;
+    return fused;
+}
+
+std::vector<FusedSteps::Run> FusedSteps::runs() const {
+    std::vector<Run> out;
+    for (auto [offset, sym] : writes) {
+        if (out.empty() ||
+            out.back().offset + int32_t(out.back().syms.size()) != offset)
+            out.push_back({offset, {}});
+        out.back().syms.push_back(sym);
+    }
+    return out;
+}
+
+std::vector<std::vector<unsigned>> stronglyConnected(const Machine &m) {
+    const unsigned n = m.numStates();
+    std::vector<std::vector<unsigned>> succ(n);
+    for (unsigned q = 0; q < n; ++q) {
+        for (unsigned c = 0; c < m.numCombos(); ++c) {
+            auto r = m.ruleFor(q, c);
+            if (r != Machine::NO_RULE)
+                succ[q].push_back(m.stateIndex(m.rules[r].finalState));
+        }
+        std::sort(succ[q].begin(), succ[q].end());
+        succ[q].erase(std::unique(succ[q].begin(), succ[q].end()),
+                      succ[q].end());
+    }
+
+    // Tarjan with an explicit stack, machines can have a lot of states
+    std::vector<int64_t> index(n, -1), low(n, 0);
+    std::vector<bool> onStack(n, false);
+    std::vector<unsigned> stack;
+    std::vector<std::pair<unsigned, size_t>> dfs; // state, next successor
+    std::vector<std::vector<unsigned>> out;
+    int64_t counter = 0;
+    auto visit = [&](unsigned q) {
+        index[q] = low[q] = counter++;
+        stack.push_back(q);
+        onStack[q] = true;
+        dfs.push_back({q, 0});
+    };
+    for (unsigned root = 0; root < n; ++root) {
+        if (index[root] >= 0)
+            continue;
+        visit(root);
+        while (!dfs.empty()) {
+            auto [q, pos] = dfs.back();
+            if (pos < succ[q].size()) {
+                ++dfs.back().second;
+                unsigned next = succ[q][pos];
+                if (index[next] < 0)
+                    visit(next);
+                else if (onStack[next])
+                    low[q] = std::min(low[q], index[next]);
+                continue;
+            }
+            dfs.pop_back();
+            if (!dfs.empty())
+                low[dfs.back().first] =
+                    std::min(low[dfs.back().first], low[q]);
+            if (low[q] != index[q])
+                continue;
+            out.emplace_back();
+            unsigned member;
+            do {
+                member = stack.back();
+                stack.pop_back();
+                onStack[member] = false;
+                out.back().push_back(member);
+            } while (member != q);
+        }
+    }
+    return out;
+}
+
+std::vector<unsigned> partitionStates(const Machine &m, unsigned parts) {
+    auto sccs = stronglyConnected(m);
+    // cost of a state: its dispatch cases with a rule, at least one
+    std::vector<uint64_t> cost(m.numStates(), 1);
+    uint64_t total = 0;
+    for (unsigned q = 0; q < m.numStates(); ++q) {
+        uint64_t cases = 0;
+        for (unsigned c = 0; c < m.numCombos(); ++c)
+            cases += m.ruleFor(q, c) != Machine::NO_RULE;
+        cost[q] = std::max<uint64_t>(cases, 1);
+        total += cost[q];
+    }
+    const uint64_t target = (total + parts - 1) / std::max(parts, 1u);
+    std::vector<unsigned> group(m.numStates(), 0);
+    unsigned g = 0;
+    uint64_t filled = 0;
+    // sources first, so a run mostly moves forward through the groups
+    for (auto it = sccs.rbegin(); it != sccs.rend(); ++it) {
+        if (filled >= target && g + 1 < parts) {
+            ++g;
+            filled = 0;
+        }
+        for (unsigned q : *it) {
+            group[q] = g;
+            filled += cost[q];
+        }
+    }
+    return group;
+}
+
+std::vector<unsigned> layoutStates(const Machine &m) {
+    const unsigned n = m.numStates();
+    auto sccs = stronglyConnected(m);
+    std::vector<unsigned> comp(n);
+    for (unsigned i = 0; i < sccs.size(); ++i)
+        for (unsigned q : sccs[i])
+            comp[q] = i;
+    // successor -> dispatch cases leading there, self-loops left out
+    std::vector<std::map<unsigned, uint64_t>> cases(n);
+    for (unsigned q = 0; q < n; ++q)
+        for (unsigned c = 0; c < m.numCombos(); ++c)
+            if (auto r = m.ruleFor(q, c); r != Machine::NO_RULE)
+                if (unsigned next = m.stateIndex(m.rules[r].finalState);
+                    next != q)
+                    ++cases[q][next];
+
+    // components reachable from the initial state, sources first, then
+    // the others in the same order
+    std::vector<bool> reached(n, false);
+    std::vector<unsigned> work{m.initialState};
+    reached[m.initialState] = true;
+    while (!work.empty()) {
+        unsigned q = work.back();
+        work.pop_back();
+        for (auto [next, count] : cases[q])
+            if (!reached[next]) {
+                reached[next] = true;
+                work.push_back(next);
+            }
+    }
+    std::vector<unsigned> comps;
+    for (bool wantReached : {true, false})
+        for (size_t i = sccs.size(); i-- > 0;)
+            if (reached[sccs[i][0]] == wantReached)
+                comps.push_back(i);
+
+    // cases into every unplaced state from the placed ones; a component
+    // starts at the state entered on the most of them
+    std::vector<uint64_t> into(n, 0);
+    std::vector<bool> placed(n, false);
+    std::vector<unsigned> order;
+    order.reserve(n);
+    for (unsigned i : comps) {
+        auto &members = sccs[i];
+        std::sort(members.begin(), members.end());
+        // highest `into` first, then the initial state, then by index
+        std::priority_queue<std::tuple<uint64_t, bool, int64_t>> heap;
+        for (unsigned q : members)
+            heap.push({into[q], q == m.initialState, -int64_t(q)});
+        auto place = [&](unsigned q) {
+            placed[q] = true;
+            order.push_back(q);
+            for (auto [next, count] : cases[q])
+                if (!placed[next]) {
+                    into[next] += count;
+                    if (comp[next] == i)
+                        heap.push({into[next], next == m.initialState,
+                                   -int64_t(next)});
+                }
+        };
+        while (!heap.empty()) {
+            auto [entered, initial, neg] = heap.top();
+            heap.pop();
+            unsigned q = -neg;
+            // stale entry: placed already or counted again since
+            if (placed[q] || entered != into[q])
+                continue;
+            // follow the chain while it stays in the component
+            for (int64_t cur = q; cur >= 0;) {
+                place(cur);
+                int64_t best = -1;
+                uint64_t bestCases = 0;
+                for (auto [next, count] : cases[cur])
+                    if (!placed[next] && comp[next] == i &&
+                        count > bestCases) {
+                        best = next;
+                        bestCases = count;
+                    }
+                cur = best;
+            }
+        }
+    }
+    return order;
+}
+
+// Identity of a rule's action list. Uses the fused form so that lists
+// like R-L-R and R compare equal, but keeps the cells a list visits,
+// which the bounds checks test: R-L and X differ at the edge of a tape.
+static std::string stepsKey(const Machine &m, const parser::Transition &T) {
+    std::string key;
+    for (unsigned t = 0; t < m.tapes; ++t) {
+        auto fused = fuseSteps(m, T.steps, t);
+        key += std::to_string(fused.move) + "[" +
+               std::to_string(fused.minOffset) + "," +
+               std::to_string(fused.maxOffset) + "]:";
+        for (auto [offset, sym] : fused.writes)
+            key += std::to_string(offset) + "=" + std::to_string(sym) + ",";
+        key += ";";
+    }
+    return key;
+}
+
+std::vector<unsigned> ruleClasses(const Machine &m) {
+    std::map<std::string, unsigned> ids;
+    std::vector<unsigned> out;
+    out.reserve(m.rules.size());
+    for (const auto &T : m.rules) {
+        auto key = T.finalState + "|" + stepsKey(m, T);
+        out.push_back(ids.emplace(key, ids.size()).first->second);
+    }
+    return out;
+}
+
+std::vector<Sweep> sweeps(const Machine &m) {
+    if (m.tapes != 1)
+        return {};
+    std::vector<Sweep> out(m.numStates());
+    for (unsigned q = 0; q < m.numStates(); ++q) {
+        Sweep sweep;
+        sweep.symbols.assign(m.numSymbols(), false);
+        bool ok = true;
+        for (unsigned s = 0; s < m.numSymbols() && ok; ++s) {
+            auto r = m.ruleFor(q, s);
+            if (r == Machine::NO_RULE ||
+                m.stateIndex(m.rules[r].finalState) != q)
+                continue;
+            auto fused = fuseSteps(m, m.rules[r].steps);
+            // printing the symbol that is already there changes nothing
+            bool keeps =
+                fused.writes.empty() ||
+                (fused.writes.size() == 1 && fused.writes.count(0) &&
+                 fused.writes.at(0) == s);
+            if (!keeps || fused.move == 0)
+                continue;
+            // loops with different moves are not one stretch
+            ok = !sweep.move || sweep.move == fused.move;
+            sweep.move = fused.move;
+            sweep.symbols[s] = true;
+            sweep.minOffset = std::min(sweep.minOffset, fused.minOffset);
+            sweep.maxOffset = std::max(sweep.maxOffset, fused.maxOffset);
+        }
+        if (ok)
+            out[q] = sweep;
+    }
+    return out;
+}
+
+// a + b * n for a run of n steps. Bounds only ever grow, so the maximum
+// of two of them can be taken term by term.
+struct Linear {
+    int64_t a = 0;
+    int64_t b = 0;
+
+    Linear operator+(int64_t k) const { return {a + k, b}; }
+};
+
+static Linear max(Linear x, Linear y) {
+    return {std::max(x.a, y.a), std::max(x.b, y.b)};
+}
+
+// fixed + perStep * steps, saturated
+static uint64_t line(uint64_t fixed, uint64_t perStep, uint64_t steps) {
+    constexpr uint64_t MAX = std::numeric_limits<uint64_t>::max();
+    if (perStep && steps > (MAX - fixed) / perStep)
+        return MAX;
+    return fixed + perStep * steps;
+}
+
+uint64_t TapeBound::cells(uint64_t steps) const {
+    return std::min(line(fixed, perStep, steps), line(1, reach, steps));
+}
+
+uint64_t TapeExtent::cells(uint64_t steps) const {
+    uint64_t out = 1;
+    for (const auto &tape : tapes)
+        out = std::max(out, tape.cells(steps));
+    return out;
+}
+
+bool TapeExtent::bounded() const {
+    return std::all_of(tapes.begin(), tapes.end(),
+                       [](const TapeBound &tape) { return tape.bounded(); });
+}
+
+std::ostream &operator<<(std::ostream &os, const TapeExtent &extent) {
+    Indent indent{2};
+    os << "TapeExtent {\n";
+    for (size_t t = 0; t < extent.tapes.size(); ++t) {
+        const auto &tape = extent.tapes[t];
+        os << indent << "tape " << t + 1 << ": ";
+        if (tape.bounded())
+            os << tape.cells(std::numeric_limits<uint64_t>::max())
+               << " cells\n";
+        else if (tape.reach <= tape.perStep)
+            os << "1 + " << tape.reach << " * n cells for n steps\n";
+        else if (tape.fixed == 1)
+            os << "1 + " << tape.perStep << " * n cells for n steps\n";
+        else
+            os << "min(" << tape.fixed << " + " << tape.perStep << " * n, 1 + "
+               << tape.reach << " * n) cells for n steps\n";
+    }
+    os << "}";
+    return os;
+}
+
+TapeExtent tapeExtent(const Machine &m) {
+    auto sccs = stronglyConnected(m);
+    std::vector<unsigned> comp(m.numStates());
+    for (unsigned i = 0; i < sccs.size(); ++i)
+        for (unsigned q : sccs[i])
+            comp[q] = i;
+    std::vector<FusedSteps> ops;
+    for (const auto &T : m.rules)
+        for (unsigned t = 0; t < m.tapes; ++t)
+            ops.push_back(fuseSteps(m, T.steps, t));
+
+    TapeExtent extent;
+    for (unsigned t = 0; t < m.tapes; ++t) {
+        // head and frontier (furthest cell touched) on entering a
+        // component, over every path that gets there
+        struct Position {
+            Linear head, frontier;
+        };
+        std::vector<std::optional<Position>> entry(sccs.size());
+        entry[comp[m.initialState]] = Position{};
+        Linear furthest;
+        int64_t reach = 0;
+        // sources first, a component is entered after all its predecessors
+        for (size_t i = sccs.size(); i-- > 0;) {
+            if (!entry[i])
+                continue;
+            // The rules inside the component. A sweep reads no blank on
+            // tape t, moves right and writes at most on the cell it leaves:
+            // it cannot pass the last written cell by more than one move,
+            // as every cell it steps on must have been written before.
+            bool cyclic = false, sweep = true;
+            int64_t maxMove = 0, maxReach = 0;
+            auto forEachCase = [&](auto &&fn) {
+                for (unsigned q : sccs[i])
+                    for (unsigned c = 0; c < m.numCombos(); ++c)
+                        if (auto r = m.ruleFor(q, c); r != Machine::NO_RULE)
+                            fn(c, comp[m.stateIndex(m.rules[r].finalState)],
+                               ops[r * m.tapes + t]);
+            };
+            forEachCase([&](unsigned c, unsigned next, const FusedSteps &f) {
+                reach = std::max<int64_t>(reach, f.maxOffset);
+                if (next != i)
+                    return;
+                cyclic = true;
+                maxMove = std::max<int64_t>(maxMove, f.move);
+                maxReach = std::max<int64_t>(maxReach, f.maxOffset);
+                sweep = sweep && m.comboSymbol(c, t) != m.blank() &&
+                        f.move > 0 && f.maxOffset <= f.move &&
+                        (f.writes.empty() || f.writes.rbegin()->first <= 0);
+            });
+            // where the component is left from
+            Position in = *entry[i], out = in;
+            if (cyclic && maxMove <= 0) {
+                out.frontier = max(in.frontier, in.head + maxReach);
+            } else if (cyclic && sweep) {
+                out.head = max(in.head, in.frontier + maxMove);
+                out.frontier = in.frontier + maxMove;
+            } else if (cyclic) {
+                // all drifting components on a path share the n steps
+                out.head = {in.head.a, std::max(in.head.b, maxMove)};
+                out.frontier = max(in.frontier, out.head + maxReach);
+            }
+            furthest = max(furthest, out.frontier);
+            forEachCase([&](unsigned, unsigned next, const FusedSteps &f) {
+                if (next == i)
+                    return;
+                Position p{out.head + f.move,
+                           max(out.frontier, out.head + f.maxOffset)};
+                entry[next] = entry[next] ? Position{max(entry[next]->head,
+                                                         p.head),
+                                                     max(entry[next]->frontier,
+                                                         p.frontier)}
+                                          : p;
+            });
+        }
+        TapeBound bound;
+        bound.fixed = std::max<int64_t>(furthest.a, 0) + 1;
+        bound.perStep = furthest.b;
+        bound.reach = reach;
+        extent.tapes.push_back(bound);
+    }
+    return extent;
+}
+
+MinimizeReport minimize(Machine &m) {
+    MinimizeReport report;
+    report.statesBefore = m.numStates();
+    report.symbolsBefore = m.numSymbols();
+    report.tapes = m.tapes;
+
+    // ---- 1. reachable states and symbols that can show up on the tape.
+    // Both grow together: a reachable rule makes its target reachable and
+    // its printed symbols readable. A combination of symbols (one per
+    // tape) can be read once all of its symbols can.
+    std::vector<bool> liveState(m.numStates(), false);
+    std::vector<bool> liveSym(m.numSymbols(), false);
+    liveState[m.initialState] = true;
+    liveSym[m.blank()] = true;
+    auto liveCombo = [&](unsigned combo) {
+        for (unsigned t = 0; t < m.tapes; ++t)
+            if (!liveSym[m.comboSymbol(combo, t)])
+                return false;
+        return true;
+    };
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (unsigned q = 0; q < m.numStates(); ++q) {
+            if (!liveState[q])
+                continue;
+            for (unsigned c = 0; c < m.numCombos(); ++c) {
+                auto r = m.ruleFor(q, c);
+                if (r == Machine::NO_RULE || !liveCombo(c))
+                    continue;
+                const auto &T = m.rules[r];
+                unsigned next = m.stateIndex(T.finalState);
+                if (!liveState[next])
+                    changed = liveState[next] = true;
+                for (unsigned p : printedSymbols(m, T))
+                    if (!liveSym[p])
+                        changed = liveSym[p] = true;
+            }
+        }
+    }
+    std::vector<unsigned> states, syms, combos;
+    for (unsigned q = 0; q < m.numStates(); ++q)
+        if (liveState[q])
+            states.push_back(q);
+    for (unsigned s = 0; s < m.numSymbols(); ++s)
+        if (liveSym[s])
+            syms.push_back(s);
+    // in order, so the i-th live combination is combination i of the
+    // rebuilt machine
+    for (unsigned c = 0; c < m.numCombos(); ++c)
+        if (liveCombo(c))
+            combos.push_back(c);
+    report.unreachableStates = m.numStates() - states.size();
+
+    // ---- 2. Moore style partition refinement. Start from blocks of states
+    // with identical action lists per combination, then split by the block of
+    // the next state until nothing changes.
+    std::vector<unsigned> block(m.numStates(), 0);
+    unsigned numBlocks = 0;
+    {
+        std::map<std::vector<std::string>, unsigned> ids;
+        for (unsigned q : states) {
+            std::vector<std::string> sig;
+            for (unsigned c : combos) {
+                auto r = m.ruleFor(q, c);
+                if (r == Machine::NO_RULE)
+                    sig.push_back("-");
+                else
+                    sig.push_back(stepsKey(m, m.rules[r]));
+            }
+            auto [it, _] = ids.emplace(sig, ids.size());
+            block[q] = it->second;
+        }
+        numBlocks = ids.size();
+    }
+    while (true) {
+        std::map<std::vector<int64_t>, unsigned> ids;
+        std::vector<unsigned> refined(m.numStates(), 0);
+        for (unsigned q : states) {
+            std::vector<int64_t> sig{block[q]};
+            for (unsigned c : combos) {
+                auto r = m.ruleFor(q, c);
+                if (r == Machine::NO_RULE)
+                    sig.push_back(-1);
+                else
+                    sig.push_back(block[m.stateIndex(m.rules[r].finalState)]);
+            }
+            auto [it, _] = ids.emplace(sig, ids.size());
+            refined[q] = it->second;
+        }
+        block = refined;
+        if (ids.size() == numBlocks)
+            break;
+        numBlocks = ids.size();
+    }
+    report.mergedStates = states.size() - numBlocks;
+
+    // ---- 3. rebuild with the first state of every block as representative
+    std::vector<int64_t> rep(numBlocks, -1);
+    for (unsigned q : states)
+        if (rep[block[q]] < 0)
+            rep[block[q]] = q;
+
+    Machine out;
+    for (unsigned s : syms)
+        out.symbols.push_back(m.symbols[s]);
+    for (unsigned b = 0; b < numBlocks; ++b)
+        out.states.push_back(m.states[rep[b]]);
+    for (unsigned i = 0; i < out.symbols.size(); ++i)
+        out.sym2idx[out.symbols[i]] = i;
+    for (unsigned i = 0; i < out.states.size(); ++i)
+        out.state2idx[out.states[i]] = i;
+    out.initialState = block[m.initialState];
+    out.tapes = m.tapes;
+    out.dispatch.assign(out.numStates() * out.numCombos(), Machine::NO_RULE);
+
+    for (unsigned b = 0; b < numBlocks; ++b) {
+        std::map<int32_t, int32_t> renumbered;
+        for (unsigned c = 0; c < combos.size(); ++c) {
+            auto r = m.ruleFor(rep[b], combos[c]);
+            if (r == Machine::NO_RULE)
+                continue;
+            auto [it, fresh] = renumbered.emplace(r, out.rules.size());
+            if (fresh) {
+                parser::Transition T = m.rules[r];
+                T.initialState = out.states[b];
+                T.finalState =
+                    out.states[block[m.stateIndex(T.finalState)]];
+                if (m.tapes == 1)
+                    T.condition = parser::OR{{}};
+                out.rules.push_back(T);
+            }
+            // the condition only lists the symbols that survived. Tuples
+            // keep their source form, the dispatch table is what counts.
+            if (m.tapes == 1)
+                std::get<parser::OR>(out.rules[it->second].condition)
+                    .sym.push_back(out.symbols[c]);
+            out.dispatch[b * out.numCombos() + c] = it->second;
+        }
+    }
+    m = std::move(out);
+
+    report.statesAfter = m.numStates();
+    report.symbolsAfter = m.numSymbols();
+    return report;
+}
+
+} // namespace optimizer
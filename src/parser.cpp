@@ -1,6 +1,14 @@
 #include "parser.hpp"
 #include "lexer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <map>
 #include <optional>
+#include <set>
+#include <thread>
 #include <variant>
 
 using json = nlohmann::json;
@@ -24,6 +32,10 @@ std::optional<TransitionStep> fromTokenAndValue(const lexer::Token &token,
     }
 }
 
+unsigned tapeOf(const TransitionStep &step) {
+    return std::visit([](auto &&st) { return st.tape; }, step);
+}
+
 // helper function to convert a range to a JSON array
 template <class Range> auto to_json_array(const Range &r) {
     json arr = json::array();
@@ -41,24 +53,242 @@ void to_json(json &j, const TransitionStep &step) {
 }
 void to_json(json &j, const Star &star) { j = "*"; }
 void to_json(json &j, const OR &orCond) { j["OR"] = to_json_array(orCond.sym); }
+void to_json(json &j, const TapeCondition &cond) {
+    std::visit([&j](auto &&arg) { to_json(j, arg); }, cond);
+}
+void to_json(json &j, const Tuple &tuple) {
+    j["TUPLE"] = to_json_array(tuple.tapes);
+}
 void to_json(json &j, const Condition &cond) {
     std::visit([&j](auto &&arg) { to_json(j, arg); }, cond);
 }
-void to_json(json &j, const R &r) { j = "R"; }
-void to_json(json &j, const L &l) { j = "L"; }
-void to_json(json &j, const X &x) { j = "X"; }
-void to_json(json &j, const P &p) { j["P"] = p.sym; }
+// tape 1 is implied, others are spelled like in the source: "R2"
+static std::string withTape(const std::string &action, unsigned tape) {
+    return tape ? action + std::to_string(tape + 1) : action;
+}
+void to_json(json &j, const R &r) { j = withTape("R", r.tape); }
+void to_json(json &j, const L &l) { j = withTape("L", l.tape); }
+void to_json(json &j, const X &x) { j = withTape("X", x.tape); }
+void to_json(json &j, const P &p) { j[withTape("P", p.tape)] = p.sym; }
 void to_json(json &j, const Transition &tr) {
     j["initialState"] = tr.initialState;
     to_json(j["condition"], tr.condition);
     j["steps"] = to_json_array(tr.steps);
     j["finalState"] = tr.finalState;
+    j["line"] = tr.line;
+}
+void to_json(json &j, const MFunction &fn) {
+    j["name"] = fn.name;
+    j["params"] = fn.params;
+    j["body"] = to_json_array(fn.body);
+    j["line"] = fn.line;
 }
 void to_json(json &j, const ParseTree &tree) {
     j["initialState"] = tree.initial_state;
     j["states"] = tree.states;
     j["symbols"] = tree.symbols;
+    j["tapes"] = tree.tapes;
     j["transitions"] = to_json_array(tree.transitions);
+    if (!tree.functions.empty())
+        j["functions"] = to_json_array(tree.functions);
+}
+
+bool Parser::parallel_transition_list() {
+    if (!currHasType(lexer::TokenType::IDENT))
+        return false;
+    const unsigned threads =
+        parseThreads ? parseThreads
+                     : std::max(1u, std::thread::hardware_concurrency());
+    if (threads < 2)
+        return false;
+    auto pieces = lexer->split(curr_token.range.start, threads, pieceBytes);
+    if (pieces.size() < 2)
+        return false;
+
+    // every piece ends where the source does, at its EOF
+    std::vector<ParseTree> trees(pieces.size());
+    std::vector<std::exception_ptr> errors(pieces.size());
+    lexer::Location end;
+    std::atomic<unsigned> nextPiece{0};
+    auto worker = [&]() {
+        for (unsigned i; (i = nextPiece++) < pieces.size();) {
+            try {
+                Parser piece(std::move(pieces[i]));
+                piece.tree.tapes = tree.tapes;
+                // blank lines the transition before the cut would have
+                // taken
+                piece.skip_newlines();
+                piece.transition_list();
+                piece.consume(lexer::TokenType::EOF_TOKEN);
+                trees[i] = std::move(piece.tree);
+                if (i + 1 == trees.size())
+                    end = piece.curr_token.range.start;
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < std::min<size_t>(threads, pieces.size()); ++i)
+        pool.emplace_back(worker);
+    for (auto &thread : pool)
+        thread.join();
+    for (auto &error : errors)
+        if (error)
+            std::rethrow_exception(error);
+
+    size_t total = tree.transitions.size();
+    for (const auto &piece : trees)
+        total += piece.transitions.size();
+    tree.transitions.reserve(total);
+    for (auto &piece : trees) {
+        std::move(piece.transitions.begin(), piece.transitions.end(),
+                  std::back_inserter(tree.transitions));
+        std::move(piece.calls.begin(), piece.calls.end(),
+                  std::back_inserter(tree.calls));
+    }
+    lexer->seek(end);
+    nextToken();
+    nextToken();
+    return true;
+}
+
+std::string to_string(const Term &term) {
+    if (term.args.empty())
+        return term.name;
+    std::string text = term.name + "(";
+    for (size_t i = 0; i < term.args.size(); ++i)
+        text += (i ? "," : "") + to_string(term.args[i]);
+    return text + ")";
+}
+
+void expand_functions(ParseTree &tree) {
+    auto abort = [](const std::string &msg) {
+        throw std::runtime_error("[PARSER]: " + msg);
+    };
+    std::set<std::string> declared(tree.states.begin(), tree.states.end());
+    std::map<std::string, const MFunction *> functions;
+    for (const auto &fn : tree.functions) {
+        if (!functions.emplace(fn.name, &fn).second)
+            abort("m-function " + fn.name + " is defined twice");
+        if (declared.count(fn.name))
+            abort("m-function " + fn.name + " has the name of a state");
+    }
+
+    // An instance: the function, its arguments and the name of its entry
+    struct Instance {
+        const MFunction *fn;
+        std::map<std::string, std::string> bindings;
+        std::string name;
+        std::set<std::string> locals;
+        unsigned depth;
+    };
+    std::set<std::string> expanded;
+    std::deque<Instance> work;
+    size_t newStates = 0;
+
+    // Name of the state or symbol `term` stands for inside `in` (nullptr at
+    // the top level). Calls are memoized by their resolved arguments,
+    // which is what lets every caller of f(b,0) share one instance.
+    std::function<std::string(const Term &, const Instance *)> resolve =
+        [&](const Term &term, const Instance *in) -> std::string {
+        if (term.args.empty()) {
+            if (!in)
+                return term.name;
+            if (auto it = in->bindings.find(term.name);
+                it != in->bindings.end())
+                return it->second;
+            if (term.name == in->fn->name)
+                return in->name;
+            if (in->locals.count(term.name))
+                return in->name + "." + term.name;
+            return term.name;
+        }
+        auto fn = functions.find(term.name);
+        if (fn == functions.end())
+            abort("Unknown m-function: " + term.name);
+        if (fn->second->params.size() != term.args.size())
+            abort("m-function " + term.name + " takes " +
+                  std::to_string(fn->second->params.size()) +
+                  " arguments, got " + std::to_string(term.args.size()));
+        Instance next{fn->second, {}, "", {}, in ? in->depth + 1 : 0};
+        std::string name = term.name + "(";
+        for (size_t i = 0; i < term.args.size(); ++i) {
+            auto arg = resolve(term.args[i], in);
+            next.bindings[fn->second->params[i]] = arg;
+            name += (i ? "," : "") + arg;
+        }
+        next.name = name + ")";
+        if (expanded.insert(next.name).second) {
+            // every other state the body starts a transition in is local
+            const MFunction &f = *fn->second;
+            for (const auto &tr : f.body)
+                next.locals.insert(tr.initialState);
+            next.locals.erase(f.name);
+            for (const auto &param : f.params)
+                next.locals.erase(param);
+            newStates += 1 + next.locals.size();
+            if (next.depth > ParseTree::MAX_INSTANCE_DEPTH)
+                abort("m-function calls nest deeper than " +
+                      std::to_string(ParseTree::MAX_INSTANCE_DEPTH) +
+                      " instances, is " + term.name + " recursive?");
+            if (newStates > ParseTree::MAX_INSTANCE_STATES)
+                abort("m-function calls expand to more than " +
+                      std::to_string(ParseTree::MAX_INSTANCE_STATES) +
+                      " states, is " + term.name + " recursive?");
+            work.push_back(next);
+        }
+        return next.name;
+    };
+
+    for (const auto &call : tree.calls)
+        resolve(call, nullptr);
+    while (!work.empty()) {
+        const Instance in = work.front();
+        work.pop_front();
+        const MFunction &fn = *in.fn;
+        tree.states.push_back(in.name);
+        for (const auto &local : in.locals)
+            tree.states.push_back(in.name + "." + local);
+
+        auto symbol = [&](std::string &sym) {
+            if (auto it = in.bindings.find(sym); it != in.bindings.end())
+                sym = it->second;
+        };
+        auto substitute = overloaded{
+            [&](OR &cond) {
+                for (auto &sym : cond.sym)
+                    symbol(sym);
+            },
+            [](Star &) {},
+        };
+        for (size_t i = 0; i < fn.body.size(); ++i) {
+            Transition tr = fn.body[i];
+            if (in.bindings.count(tr.initialState))
+                abort("m-function " + fn.name + ": parameter " +
+                      tr.initialState + " cannot start a transition (line " +
+                      std::to_string(tr.line) + ")");
+            tr.initialState = resolve(Term{tr.initialState, {}}, &in);
+            std::visit(overloaded{[&](Tuple &tuple) {
+                                      for (auto &cond : tuple.tapes)
+                                          std::visit(substitute, cond);
+                                  },
+                                  [&](auto &cond) { substitute(cond); }},
+                       tr.condition);
+            for (auto &step : tr.steps)
+                if (auto *p = std::get_if<P>(&step))
+                    symbol(p->sym);
+            tr.finalState = resolve(fn.targets[i], &in);
+            // any other plain target is a state of the machine
+            const auto &target = fn.targets[i];
+            if (target.args.empty() && !in.bindings.count(target.name) &&
+                target.name != fn.name && !in.locals.count(target.name) &&
+                !declared.count(target.name))
+                abort("m-function " + fn.name + ": unknown state " +
+                      target.name + " (line " + std::to_string(tr.line) + ")");
+            tree.transitions.push_back(tr);
+        }
+    }
 }
 
 } // namespace parser
\ No newline at end of file
@@ -0,0 +1,31 @@
+#include "profile.hpp"
+#include "utils.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace profile {
+
+Profile load_profile(const std::string &filename) {
+    Profile prof;
+    std::stringstream ss(read_file_to_string(filename));
+    std::string line;
+    for (uint32_t lineNo = 1; std::getline(ss, line); ++lineNo) {
+        auto hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        std::stringstream ls(line);
+        std::string state, sym;
+        uint64_t count;
+        if (!(ls >> state))
+            continue; // blank line
+        if (!(ls >> sym >> count))
+            throw std::runtime_error("[PROFILE]: " + filename + ":" +
+                                     std::to_string(lineNo) +
+                                     ": expected '<state> <symbol> <count>'");
+        prof.counts[{state, sym}] += count;
+    }
+    return prof;
+}
+
+} // namespace profile
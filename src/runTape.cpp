@@ -0,0 +1,69 @@
+#include "runTape.hpp"
+
+namespace runTape {
+
+void RunTape::write(int32_t sym) {
+    if (cur.sym == sym)
+        return;
+    // split the run around the head: before | the cell | after
+    if (pos > 0)
+        left.push_back({cur.sym, pos});
+    if (pos + 1 < cur.count)
+        right.push_back({cur.sym, cur.count - pos - 1});
+    cur = {sym, 1};
+    pos = 0;
+    // and join the cell with neighbours that hold the same symbol
+    if (!left.empty() && left.back().sym == sym) {
+        pos = left.back().count;
+        cur.count += pos;
+        left.pop_back();
+    }
+    if (!right.empty() && right.back().sym == sym) {
+        cur.count += right.back().count;
+        right.pop_back();
+    }
+}
+
+void RunTape::move(int64_t by) {
+    headCell += by;
+    for (uint64_t d = by > 0 ? by : 0; d;) {
+        const uint64_t room = cur.count - 1 - pos;
+        if (d <= room) {
+            pos += d;
+            return;
+        }
+        d -= room + 1;
+        left.push_back(cur);
+        cur = right.back();
+        right.pop_back();
+        pos = 0;
+    }
+    for (uint64_t d = by < 0 ? -by : 0; d;) {
+        if (d <= pos) {
+            pos -= d;
+            return;
+        }
+        d -= pos + 1;
+        right.push_back(cur);
+        cur = left.back();
+        left.pop_back();
+        pos = cur.count - 1;
+    }
+}
+
+std::vector<RunTape::Run> RunTape::runs() const {
+    std::vector<Run> out(left);
+    out.push_back(cur);
+    out.insert(out.end(), right.rbegin(), right.rend());
+    return out;
+}
+
+std::vector<int32_t> RunTape::dense() const {
+    std::vector<int32_t> out;
+    out.reserve(cells);
+    for (const auto &run : runs())
+        out.insert(out.end(), run.count, run.sym);
+    return out;
+}
+
+} // namespace runTape
@@ -0,0 +1,601 @@
+#include "server.hpp"
+#include "cppBackend.hpp"
+#include "interpreter.hpp"
+#include "lexer.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <future>
+#include <list>
+#include <llvm/IR/LLVMContext.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace server {
+
+using json = nlohmann::json;
+using llvmBackend::CodegenOptions;
+
+static std::runtime_error systemError(const std::string &what) {
+    return std::runtime_error("[SERVER]: " + what + ": " +
+                              std::strerror(errno));
+}
+
+static sockaddr_un socketAddress(const std::string &path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("[SERVER]: Socket path too long: " + path);
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return addr;
+}
+
+static void writeAll(int fd, const std::string &data) {
+    for (size_t done = 0; done < data.size();) {
+        auto n = ::write(fd, data.data() + done, data.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw systemError("write");
+        done += n;
+    }
+}
+
+// Next line of `fd` without its newline; false at the end of the stream.
+// `buffer` keeps what was read past the line.
+static bool readLine(int fd, std::string &buffer, std::string &line) {
+    size_t scanned = 0;
+    for (;;) {
+        auto nl = buffer.find('\n', scanned);
+        if (nl != std::string::npos) {
+            line = buffer.substr(0, nl);
+            buffer.erase(0, nl + 1);
+            return true;
+        }
+        scanned = buffer.size();
+        char chunk[1 << 16];
+        auto n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buffer.append(chunk, n);
+    }
+}
+
+static std::string base64(const std::string &data) {
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < data.size(); i += 3) {
+        uint32_t bits = uint8_t(data[i]) << 16;
+        if (i + 1 < data.size())
+            bits |= uint8_t(data[i + 1]) << 8;
+        if (i + 2 < data.size())
+            bits |= uint8_t(data[i + 2]);
+        out += digits[bits >> 18];
+        out += digits[(bits >> 12) & 63];
+        out += i + 1 < data.size() ? digits[(bits >> 6) & 63] : '=';
+        out += i + 2 < data.size() ? digits[bits & 63] : '=';
+    }
+    return out;
+}
+
+json toJson(const CodegenOptions &options) {
+    using Dispatch = CodegenOptions::Dispatch;
+    const char *dispatch = options.dispatch == Dispatch::Switch  ? "switch"
+                           : options.dispatch == Dispatch::Table ? "table"
+                                                                 : "auto";
+    return {{"fuse", options.fuseActions},
+            {"trace", options.trace},
+            {"sweeps", options.sweeps},
+            {"layout", options.layout},
+            {"halt", options.halt},
+            {"exactTape", options.exactTape},
+            {"dispatch", dispatch},
+            {"tableStates", options.tableStates},
+            {"unroll", options.unroll},
+            {"partitions", options.partitions},
+            {"targetTriple", options.targetTriple},
+            {"dataLayout", options.dataLayout}};
+}
+
+CodegenOptions codegenFromJson(const json &j) {
+    using Dispatch = CodegenOptions::Dispatch;
+    CodegenOptions options;
+    options.fuseActions = j.value("fuse", options.fuseActions);
+    options.trace = j.value("trace", options.trace);
+    options.sweeps = j.value("sweeps", options.sweeps);
+    options.layout = j.value("layout", options.layout);
+    options.halt = j.value("halt", options.halt);
+    options.exactTape = j.value("exactTape", options.exactTape);
+    auto dispatch = j.value("dispatch", std::string("auto"));
+    if (dispatch == "switch")
+        options.dispatch = Dispatch::Switch;
+    else if (dispatch == "table")
+        options.dispatch = Dispatch::Table;
+    else if (dispatch != "auto")
+        throw std::runtime_error("[SERVER]: Unknown dispatch: " + dispatch);
+    options.tableStates = j.value("tableStates", options.tableStates);
+    options.unroll = std::max(1u, j.value("unroll", options.unroll));
+    options.partitions =
+        std::max(1u, j.value("partitions", options.partitions));
+    options.targetTriple = j.value("targetTriple", options.targetTriple);
+    options.dataLayout = j.value("dataLayout", options.dataLayout);
+    return options;
+}
+
+// `smc_<stem>` of the request's file, like the command line
+static std::string libraryPrefix(const json &request) {
+    std::string name = request.value("name", std::string());
+    if (name.empty()) {
+        auto path = request.value("path", std::string("machine.sm"));
+        name = "smc_" + std::filesystem::path(path).stem().string();
+        for (auto &c : name)
+            if (!std::isalnum(static_cast<unsigned char>(c)))
+                c = '_';
+    }
+    auto isWord = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    };
+    if (std::isdigit(static_cast<unsigned char>(name[0])) ||
+        !std::all_of(name.begin(), name.end(), isWord))
+        throw std::runtime_error("[SERVER]: Prefix is not a C identifier: " +
+                                 name);
+    return name;
+}
+
+static json compile(const json &request, const json &codegen,
+                    llvm::LLVMContext &ctx, const Options &limits) {
+    auto lexer = request.contains("source")
+                     ? std::make_unique<lexer::Lexer>(
+                           request["source"].get<std::string>(), false)
+                     : std::make_unique<lexer::Lexer>(
+                           request["path"].get<std::string>());
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    const auto emit = request.value("emit", std::string("ir"));
+    // machine level passes shared by every backend, as on the command line
+    json reply = {{"ok", true}};
+    auto prepare = [&](machine::Machine &m) {
+        for (const auto &q : request.value("haltStates", json::array()))
+            m.makeHaltState(q.get<std::string>());
+        if (!request.value("minimize", false))
+            return;
+        std::ostringstream report;
+        report << optimizer::minimize(m);
+        reply["minimize"] = report.str();
+    };
+    auto options = codegenFromJson(codegen);
+
+    if (emit == "run") {
+        parser->parse();
+        auto m = machine::fromParseTree(parser->tree);
+        prepare(m);
+        const uint64_t steps = request.value("steps", uint64_t(0));
+        uint64_t tapeSize = request.value("tape", uint64_t(64));
+        if (steps > limits.maxSteps)
+            throw std::runtime_error("[SERVER]: " + std::to_string(steps) +
+                                     " steps are more than the " +
+                                     std::to_string(limits.maxSteps) +
+                                     " a run may take");
+        if (options.exactTape)
+            tapeSize = optimizer::tapeExtent(m).cells(steps);
+        // the reply spells out every cell, so this bounds it as well
+        if (tapeSize > limits.maxTapeCells)
+            throw std::runtime_error("[SERVER]: A tape of " +
+                                     std::to_string(tapeSize) +
+                                     " cells is more than the " +
+                                     std::to_string(limits.maxTapeCells) +
+                                     " a run may have");
+        interpreter::Interpreter interp(m, tapeSize);
+        interp.run(steps);
+        std::ostringstream status;
+        status << interp.status;
+        json tapes = json::array();
+        for (const auto &tape : interp.tapes) {
+            json cells = json::array();
+            for (auto cell : tape)
+                cells.push_back(m.symbols[cell]);
+            tapes.push_back(std::move(cells));
+        }
+        reply["status"] = status.str();
+        reply["steps"] = interp.steps;
+        reply["state"] = m.states[interp.state];
+        reply["heads"] = interp.heads;
+        reply["tapes"] = std::move(tapes);
+        return reply;
+    }
+    if (emit == "cpp") {
+        cppBackend::CppBackend backend(std::move(parser));
+        prepare(backend.machine);
+        auto name = request.value("name", std::string());
+        if (name.empty())
+            name = std::filesystem::path(
+                       request.value("path", std::string("machine.sm")))
+                       .stem()
+                       .string();
+        backend.getHeader(name);
+        reply["header"] = std::move(backend.header);
+        return reply;
+    }
+    if (emit != "ir" && emit != "bc" && emit != "lib")
+        throw std::runtime_error("[SERVER]: Unknown emit kind: " + emit);
+    llvmBackend::LllvmBackend backend(std::move(parser));
+    prepare(backend.machine);
+    backend.options = options;
+    backend.options.bitcode = emit == "bc";
+    if (emit == "lib") {
+        backend.options.trace = false;
+        backend.options.library = libraryPrefix(request);
+    }
+    backend.context = &ctx;
+    backend.getIr();
+    if (emit == "lib") {
+        reply["ir"] = std::move(backend.ir);
+        reply["header"] = std::move(backend.header);
+        return reply;
+    }
+    const bool bitcode = backend.options.bitcode;
+    reply[bitcode ? "bc" : "ir"] =
+        bitcode ? base64(backend.ir) : std::move(backend.ir);
+    json parts = json::array();
+    for (auto &part : backend.partIrs)
+        parts.push_back(bitcode ? base64(part) : std::move(part));
+    reply["parts"] = std::move(parts);
+    return reply;
+}
+
+json handle(const json &request, llvm::LLVMContext &ctx,
+            const Options &limits) {
+    try {
+        if (!request.is_object() ||
+            (!request.contains("path") && !request.contains("source")))
+            throw std::runtime_error(
+                "[SERVER]: A request needs a path or a source");
+        return compile(request, request.value("codegen", json::object()),
+                       ctx, limits);
+    } catch (const std::exception &e) {
+        return {{"ok", false}, {"error", e.what()}};
+    }
+}
+
+namespace {
+
+// Worker threads with a warm context each, taking requests in arrival
+// order from every connection.
+class Pool {
+  private:
+    struct Job {
+        const json *request;
+        std::promise<json> reply;
+    };
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Job> jobs;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+    const Options &options;
+
+    void work() {
+        const unsigned recycleAfter = options.recycleAfter;
+        auto ctx = std::make_unique<llvm::LLVMContext>();
+        unsigned used = 0;
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock lock(mutex);
+                ready.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            if (recycleAfter && used++ == recycleAfter) {
+                ctx = std::make_unique<llvm::LLVMContext>();
+                used = 1;
+            }
+            job.reply.set_value(handle(*job.request, *ctx, options));
+        }
+    }
+
+  public:
+    Pool(unsigned workers, const Options &options) : options(options) {
+        for (unsigned i = 0; i < workers; ++i)
+            threads.emplace_back([this] { work(); });
+    }
+    ~Pool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // Blocks until a worker has run `request`.
+    json submit(const json &request) {
+        std::promise<json> reply;
+        auto result = reply.get_future();
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back({&request, std::move(reply)});
+        }
+        ready.notify_one();
+        return result.get();
+    }
+};
+
+// One thread per connection, which only reads requests and writes
+// replies. Requests of a connection run one after another, so replies
+// come back in order. The caller closes `fd`.
+static void serveConnection(int fd, Pool &pool) {
+    std::string buffer, line;
+    try {
+        while (readLine(fd, buffer, line)) {
+            if (line.empty())
+                continue;
+            json reply;
+            try {
+                reply = pool.submit(json::parse(line));
+            } catch (const json::parse_error &e) {
+                reply = {{"ok", false},
+                         {"error", std::string("[SERVER]: ") + e.what()}};
+            }
+            // symbol names come from the source, which need not be UTF-8
+            writeAll(fd, reply.dump(-1, ' ', false,
+                                    json::error_handler_t::replace) +
+                             "\n");
+        }
+    } catch (const std::exception &) {
+        // the client went away mid reply
+    }
+}
+
+// Written to by a finishing connection and by the stop signal handler, so
+// the accept loop wakes up for either.
+static int wakeFd = -1;
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void wakeUp() {
+    char byte = 0;
+    // a full pipe already wakes the loop
+    (void)!::write(wakeFd, &byte, 1);
+}
+
+static void requestStop(int) {
+    const int saved = errno;
+    stopRequested = 1;
+    wakeUp();
+    errno = saved;
+}
+
+// The connection threads, at most `limit` at once. Finished ones are
+// joined by the accept loop, the rest when it stops. While it lives,
+// SIGINT and SIGTERM ask the loop to stop.
+class Connections {
+  private:
+    struct Connection {
+        std::thread thread;
+        int fd;
+        bool done = false;
+    };
+    std::mutex mutex;
+    std::list<Connection> live;
+    const unsigned limit;
+    int wake[2];
+
+  public:
+    explicit Connections(unsigned limit) : limit(std::max(1u, limit)) {
+        if (::pipe(wake) < 0)
+            throw systemError("pipe");
+        for (int end : wake)
+            ::fcntl(end, F_SETFL, ::fcntl(end, F_GETFL) | O_NONBLOCK);
+        wakeFd = wake[1];
+        std::signal(SIGINT, requestStop);
+        std::signal(SIGTERM, requestStop);
+    }
+    ~Connections() {
+        {
+            // readers see the end of their stream, replies still in
+            // flight fail to send
+            std::lock_guard lock(mutex);
+            for (auto &c : live)
+                if (!c.done)
+                    ::shutdown(c.fd, SHUT_RDWR);
+        }
+        for (auto &c : live)
+            c.thread.join();
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        ::close(wake[0]);
+        ::close(wake[1]);
+    }
+
+    // Blocks until the listening socket `fd` has a connection and there
+    // is room for it, or a stop was requested. Finished threads are
+    // joined on the way. Returns false to stop.
+    bool wait(int fd) {
+        for (;;) {
+            if (stopRequested)
+                return false;
+            bool room;
+            {
+                std::lock_guard lock(mutex);
+                for (auto it = live.begin(); it != live.end();) {
+                    if (it->done) {
+                        it->thread.join();
+                        it = live.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                room = live.size() < limit;
+            }
+            // with every slot taken, new connections wait in the backlog
+            pollfd fds[2] = {{wake[0], POLLIN, 0},
+                             {fd, short(room ? POLLIN : 0), 0}};
+            if (::poll(fds, 2, -1) < 0 && errno != EINTR)
+                throw systemError("poll");
+            for (char drain[64]; ::read(wake[0], drain, sizeof(drain)) > 0;) {
+            }
+            if ((fds[1].revents & POLLIN) && !stopRequested)
+                return true;
+        }
+    }
+
+    void start(int fd, Pool &pool) {
+        std::lock_guard lock(mutex);
+        auto &c = live.emplace_back();
+        c.fd = fd;
+        c.thread = std::thread([this, &c, &pool] {
+            serveConnection(c.fd, pool);
+            std::lock_guard lock(mutex);
+            // under the lock, so ~Connections never shuts down a reused fd
+            ::close(c.fd);
+            c.done = true;
+            wakeUp();
+        });
+    }
+};
+
+} // namespace
+
+void serve(const Options &options) {
+    // a client that hangs up must not take the server with it
+    std::signal(SIGPIPE, SIG_IGN);
+    const auto addr = socketAddress(options.socketPath);
+    if (std::filesystem::is_socket(options.socketPath))
+        std::filesystem::remove(options.socketPath);
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw systemError("socket");
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) <
+            0 ||
+        ::listen(fd, SOMAXCONN) < 0) {
+        auto error = systemError("cannot listen on " + options.socketPath);
+        ::close(fd);
+        throw error;
+    }
+    const unsigned workers =
+        options.workers ? options.workers
+                        : std::max(1u, std::thread::hardware_concurrency());
+    Pool pool(workers, options);
+    try {
+        // declared after the pool, so its threads are joined first
+        Connections connections(options.maxConnections);
+        while (connections.wait(fd)) {
+            int conn = ::accept(fd, nullptr, nullptr);
+            if (conn < 0 && (errno == EINTR || errno == ECONNABORTED))
+                continue;
+            if (conn < 0)
+                throw systemError("accept");
+            connections.start(conn, pool);
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+    std::filesystem::remove(options.socketPath);
+}
+
+Client::Client(const std::string &socketPath) {
+    const auto addr = socketAddress(socketPath);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        throw systemError("socket");
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                  sizeof(addr)) < 0) {
+        auto error = systemError("cannot connect to " + socketPath);
+        ::close(fd);
+        throw error;
+    }
+}
+
+Client::~Client() { ::close(fd); }
+
+json Client::call(const json &request) {
+    writeAll(fd, request.dump() + "\n");
+    std::string line;
+    if (!readLine(fd, buffer, line))
+        throw std::runtime_error("[SERVER]: Connection closed");
+    return json::parse(line);
+}
+
+json bench(const std::string &socketPath, const json &request,
+           uint64_t count, unsigned clients) {
+    clients = std::max(1u, clients);
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<uint64_t> errors(clients, 0);
+    std::vector<std::exception_ptr> failures(clients);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            try {
+                Client client(socketPath);
+                for (uint64_t i = 0; i < count; ++i) {
+                    auto t0 = std::chrono::steady_clock::now();
+                    auto reply = client.call(request);
+                    latencies[c].push_back(
+                        std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - t0)
+                            .count());
+                    errors[c] += !reply.value("ok", false);
+                }
+            } catch (...) {
+                failures[c] = std::current_exception();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    for (auto &failure : failures)
+        if (failure)
+            std::rethrow_exception(failure);
+
+    std::vector<double> all;
+    for (const auto &l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) {
+        if (all.empty())
+            return 0.0;
+        return all[std::min<size_t>(all.size() - 1, p * all.size())];
+    };
+    uint64_t failed = 0;
+    for (auto e : errors)
+        failed += e;
+    return {{"requests", all.size()},
+            {"clients", clients},
+            {"errors", failed},
+            {"p50Us", percentile(0.50)},
+            {"p90Us", percentile(0.90)},
+            {"p99Us", percentile(0.99)},
+            {"maxUs", all.empty() ? 0.0 : all.back()},
+            {"perSecond", seconds > 0 ? all.size() / seconds : 0.0}};
+}
+
+} // namespace server
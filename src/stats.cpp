@@ -0,0 +1,55 @@
+#include "stats.hpp"
+#include <numeric>
+#include <stdexcept>
+
+namespace stats {
+
+uint64_t Stats::steps() const {
+    return std::accumulate(caseHits.begin(), caseHits.end(), uint64_t(0));
+}
+
+void Stats::merge(const Stats &other) {
+    if (caseHits.size() != other.caseHits.size() ||
+        bucketWidth != other.bucketWidth)
+        throw std::runtime_error("[STATS]: Cannot merge stats of different "
+                                 "machines or tape sizes");
+    for (size_t i = 0; i < caseHits.size(); ++i)
+        caseHits[i] += other.caseHits[i];
+    for (size_t i = 0; i < headHistogram.size(); ++i)
+        headHistogram[i] += other.headHistogram[i];
+    minHead = std::min(minHead, other.minHead);
+    maxHead = std::max(maxHead, other.maxHead);
+}
+
+nlohmann::json toJson(const machine::Machine &m, const Stats &stats) {
+    nlohmann::json j;
+    j["steps"] = stats.steps();
+    j["cases"] = nlohmann::json::array();
+    for (unsigned q = 0; q < m.numStates(); ++q) {
+        for (unsigned c = 0; c < m.numCombos(); ++c) {
+            auto r = m.ruleFor(q, c);
+            if (r == machine::Machine::NO_RULE)
+                continue;
+            j["cases"].push_back({
+                {"state", m.states[q]},
+                {"symbol", m.comboName(c)},
+                {"rule", r},
+                {"line", m.rules[r].line},
+                {"hits", stats.caseHits[q * m.numCombos() + c]},
+            });
+        }
+    }
+    auto &head = j["head"];
+    if (stats.steps() == 0) {
+        head["min"] = nullptr;
+        head["max"] = nullptr;
+    } else {
+        head["min"] = stats.minHead;
+        head["max"] = stats.maxHead;
+    }
+    head["bucketWidth"] = stats.bucketWidth;
+    head["histogram"] = stats.headHistogram;
+    return j;
+}
+
+} // namespace stats
@@ -0,0 +1,72 @@
+#include "task.hpp"
+#include <algorithm>
+#include <utility>
+
+namespace task {
+
+using interpreter::Status;
+
+MachineTask::MachineTask(MachineTask &&other) noexcept
+    : coro(std::exchange(other.coro, nullptr)) {}
+
+MachineTask &MachineTask::operator=(MachineTask &&other) noexcept {
+    if (this != &other) {
+        if (coro)
+            coro.destroy();
+        coro = std::exchange(other.coro, nullptr);
+    }
+    return *this;
+}
+
+MachineTask::~MachineTask() {
+    if (coro)
+        coro.destroy();
+}
+
+bool MachineTask::resume() {
+    if (done())
+        return false;
+    coro.resume();
+    if (auto error = coro.promise().error)
+        std::rethrow_exception(error);
+    return !coro.done();
+}
+
+MachineTask run(interpreter::Interpreter interp, uint64_t maxSteps,
+                uint64_t slice) {
+    const uint64_t end = interp.steps + maxSteps;
+    slice = std::max<uint64_t>(slice, 1);
+    while (interp.status == Status::Running && interp.steps < end) {
+        interp.run(std::min(slice, end - interp.steps));
+        // the slice that ends the run returns with it
+        if (interp.status != Status::Running || interp.steps == end)
+            break;
+        co_await std::suspend_always{};
+    }
+}
+
+MachineTask run(const machine::Machine &m, uint64_t tapeSize,
+                uint64_t maxSteps, uint64_t slice) {
+    return run(interpreter::Interpreter(m, tapeSize), maxSteps, slice);
+}
+
+uint64_t roundRobin(std::vector<MachineTask> &tasks) {
+    std::vector<MachineTask *> ready;
+    for (auto &t : tasks)
+        if (!t.done())
+            ready.push_back(&t);
+    uint64_t slices = 0;
+    while (!ready.empty()) {
+        // resume every ready task once, keep those with steps left
+        size_t kept = 0;
+        for (auto *t : ready) {
+            ++slices;
+            if (t->resume())
+                ready[kept++] = t;
+        }
+        ready.resize(kept);
+    }
+    return slices;
+}
+
+} // namespace task
@@ -0,0 +1,159 @@
+#include "timeReport.hpp"
+#include "utils.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <sys/resource.h>
+
+// Allocation counters behind --time-report. Replacing the global
+// operator new is the only way to see allocations made inside LLVM and
+// nlohmann without touching them. Until the report is enabled an
+// allocation only reads `counting`, which no thread writes to, so the
+// worker threads of --nondet and --serve do not fight over the counters.
+static std::atomic<bool> counting{false};
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+
+static void *allocate(std::size_t size) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        allocBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+namespace timeReport {
+
+TimeReport &get() {
+    static TimeReport report;
+    return report;
+}
+
+void TimeReport::enable() {
+    enabled = true;
+    origin = std::chrono::steady_clock::now();
+    counting.store(true, std::memory_order_relaxed);
+}
+
+static double cpuNowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static uint64_t peakRssKb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+Scope::Scope(const std::string &name) {
+    auto &report = get();
+    if (!report.enabled)
+        return;
+    index = report.phases.size();
+    Phase phase;
+    phase.name = name;
+    phase.depth = report.depth++;
+    report.phases.push_back(phase);
+    allocsStart = allocCount.load(std::memory_order_relaxed);
+    bytesStart = allocBytes.load(std::memory_order_relaxed);
+    cpuStart = cpuNowUs();
+    wallStart = std::chrono::steady_clock::now();
+}
+
+Scope::~Scope() {
+    if (index < 0)
+        return;
+    auto wallEnd = std::chrono::steady_clock::now();
+    double cpuEnd = cpuNowUs();
+    auto &report = get();
+    auto &phase = report.phases[index];
+    using us = std::chrono::duration<double, std::micro>;
+    phase.startUs = us(wallStart - report.origin).count();
+    phase.wallUs = us(wallEnd - wallStart).count();
+    phase.cpuUs = cpuEnd - cpuStart;
+    phase.allocs = allocCount.load(std::memory_order_relaxed) - allocsStart;
+    phase.allocBytes =
+        allocBytes.load(std::memory_order_relaxed) - bytesStart;
+    phase.peakRssKb = peakRssKb();
+    --report.depth;
+}
+
+std::ostream &operator<<(std::ostream &os, const TimeReport &report) {
+    auto flags = os.flags();
+    os << "Time report {\n";
+    os << Indent(2) << std::left << std::setw(24) << "phase" << std::right
+       << std::setw(11) << "wall ms" << std::setw(11) << "cpu ms"
+       << std::setw(10) << "allocs" << std::setw(12) << "alloc KiB"
+       << std::setw(14) << "peak RSS KiB" << "\n";
+    os << std::fixed << std::setprecision(3);
+    for (const auto &p : report.phases) {
+        std::stringstream name;
+        name << Indent(2 * p.depth) << p.name;
+        os << Indent(2) << std::left << std::setw(24) << name.str()
+           << std::right << std::setw(11) << p.wallUs / 1e3 << std::setw(11)
+           << p.cpuUs / 1e3 << std::setw(10) << p.allocs << std::setw(12)
+           << p.allocBytes / 1024 << std::setw(14) << p.peakRssKb << "\n";
+    }
+    os << "}";
+    os.flags(flags);
+    return os;
+}
+
+nlohmann::json toJson(const TimeReport &report) {
+    nlohmann::json j;
+    j["phases"] = nlohmann::json::array();
+    for (const auto &p : report.phases)
+        j["phases"].push_back({
+            {"name", p.name},
+            {"depth", p.depth},
+            {"startUs", p.startUs},
+            {"wallUs", p.wallUs},
+            {"cpuUs", p.cpuUs},
+            {"allocs", p.allocs},
+            {"allocBytes", p.allocBytes},
+            {"peakRssKb", p.peakRssKb},
+        });
+    return j;
+}
+
+nlohmann::json toChromeTrace(const TimeReport &report) {
+    nlohmann::json j;
+    j["displayTimeUnit"] = "ms";
+    j["traceEvents"] = nlohmann::json::array();
+    for (const auto &p : report.phases)
+        j["traceEvents"].push_back({
+            {"name", p.name},
+            {"cat", "smc"},
+            {"ph", "X"},
+            {"ts", p.startUs},
+            {"dur", p.wallUs},
+            {"pid", 1},
+            {"tid", 1},
+            {"args",
+             {{"cpuUs", p.cpuUs},
+              {"allocs", p.allocs},
+              {"allocBytes", p.allocBytes},
+              {"peakRssKb", p.peakRssKb}}},
+        });
+    return j;
+}
+
+} // namespace timeReport
@@ -17,7 +17,7 @@ std::string read_file_to_string(const std::string &filename) {
 
 void dump_string_to_file(const std::string &filename,
                          const std::string &content) {
-    std::ofstream file(filename);
+    std::ofstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Failed to open file: " + filename);
     }
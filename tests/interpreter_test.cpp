@@ -0,0 +1,513 @@
+#include "checkpoint.hpp"
+#include "interpreter.hpp"
+#include "machine.hpp"
+#include "nondet.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+#include "task.hpp"
+#include "test_utils.hpp"
+#include "utils.hpp"
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+// binary counter, least significant bit first, sentinel in cell 0
+static const std::string counter = "STATES: [s], inc, back\n"
+                                   "SYMBOLS: 0, 1, e\n"
+                                   "TRANSITIONS:\n"
+                                   "s, *, P(e)-R, inc\n"
+                                   "inc, 1, P(0)-R, inc\n"
+                                   "inc, 0 | X, P(1)-L, back\n"
+                                   "back, 0 | 1, L, back\n"
+                                   "back, e, R, inc\n";
+
+//========================================================================
+// Test Fixtures
+//========================================================================
+
+struct TestInterpreter : public ::testing::Test {
+
+    // source, steps, tape size, expected status, expected steps taken
+    std::vector<std::tuple<std::string, uint64_t, uint64_t,
+                           interpreter::Status, uint64_t>>
+        testCases;
+
+    TestInterpreter() {
+        testCases = {
+            {counter, 100, 16, interpreter::Status::Running, 100},
+            // no rule for (a, 0): halts after the first print
+            {"STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, X, P(0), a\n", 10,
+             4, interpreter::Status::Halted, 1},
+            // walks to the last cell of a 4 cell tape, then stops
+            {"STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, *, R, a\n", 10, 4,
+             interpreter::Status::OutOfTape, 3},
+            // the action list would reach past the tape: nothing happens
+            {"STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, *, L-R, a\n", 10, 4,
+             interpreter::Status::OutOfTape, 0},
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestInterpreter, sample_test) {
+    for (auto [src, maxSteps, tapeSize, status, steps] : testCases) {
+        auto m = machineFromSource(src);
+        interpreter::Interpreter interp(m, tapeSize);
+        ASSERT_EQ(status, interp.run(maxSteps));
+        ASSERT_EQ(steps, interp.steps);
+    }
+}
+
+TEST_F(TestInterpreter, counter_value) {
+    auto m = machineFromSource(counter);
+    interpreter::Interpreter interp(m, 16);
+    // count up to 5: 1, 2 (3 steps), 3, 4 (5 steps), 5
+    interp.run(1 + 2 + 4 + 2 + 6 + 2);
+    std::vector<int32_t> expected = {2, 1, 0, 1};
+    for (size_t i = 0; i < expected.size(); ++i)
+        ASSERT_EQ(expected[i], interp.tapes[0][i]);
+}
+
+TEST_F(TestInterpreter, halt_state) {
+    auto m = machineFromSource(counter);
+    // back is entered right after the first carry free increment
+    m.makeHaltState("back");
+    interpreter::Interpreter interp(m, 16);
+    ASSERT_EQ(interpreter::Status::Halted, interp.run(1000));
+    ASSERT_EQ(2u, interp.steps);
+    ASSERT_EQ("back", m.states[interp.state]);
+}
+
+TEST_F(TestInterpreter, multi_tape) {
+    // writes 111 behind a sentinel on tape 1, then copies it to tape 2
+    auto m = machineFromSource("STATES: [s], w1, w2, w3, rew, copy, done\n"
+                               "SYMBOLS: 1, e\n"
+                               "TAPES: 2\n"
+                               "TRANSITIONS:\n"
+                               "s, (*, *), P(e)-R-P2(e)-R2, w1\n"
+                               "w1, (*, *), P(1)-R, w2\n"
+                               "w2, (*, *), P(1)-R, w3\n"
+                               "w3, (*, *), P(1)-L, rew\n"
+                               "rew, (1, *), L, rew\n"
+                               "rew, (e, *), R, copy\n"
+                               "copy, (1, *), P2(1)-R-R2, copy\n"
+                               "copy, (X, *), X, done\n");
+    interpreter::Interpreter interp(m, 8);
+    ASSERT_EQ(interpreter::Status::Halted, interp.run(100));
+    ASSERT_EQ(11u, interp.steps);
+    ASSERT_EQ((std::vector<int64_t>{4, 4}), interp.heads);
+    ASSERT_EQ(interp.tapes[0], interp.tapes[1]);
+    ASSERT_EQ(m.symbolIndex("1"), unsigned(interp.tapes[1][3]));
+}
+
+TEST_F(TestInterpreter, sweeps) {
+    // q and f run across their cells two at a time (tests/examples)
+    auto m = machineFromSource("STATES: [b], o, q, p, f\n"
+                               "SYMBOLS: 0, 1, e, x\n"
+                               "TRANSITIONS:\n"
+                               "b, *, P(e)-R-P(e)-R-P(0)-R-R-P(0)-L-L, o\n"
+                               "o, 1, R-P(x)-L-L-L, o\n"
+                               "o, 0, X, q\n"
+                               "q, 0 | 1, R-R, q\n"
+                               "q, X, P(1)-L, p\n"
+                               "p, x, P(X)-R, q\n"
+                               "p, e, R, f\n"
+                               "p, X, L-L, p\n"
+                               "f, *, R-R, f\n"
+                               "f, X, P(0)-L-L, o\n");
+    // runs recording stats take every step on its own
+    for (uint64_t steps = 0; steps < 400; steps += 7) {
+        interpreter::Interpreter fast(m, 48), slow(m, 48);
+        stats::Stats stats(m, 48);
+        ASSERT_EQ(slow.run(steps, &stats), fast.run(steps));
+        ASSERT_EQ(slow.steps, fast.steps);
+        ASSERT_EQ(slow.state, fast.state);
+        ASSERT_EQ(slow.heads, fast.heads);
+        ASSERT_EQ(slow.tapes, fast.tapes);
+    }
+}
+
+TEST_F(TestInterpreter, run_tape) {
+    // random writes and moves, checked against a plain vector
+    runTape::RunTape tape(64, 0);
+    std::vector<int32_t> cells(64, 0);
+    int64_t head = 0;
+    uint32_t seed = 12345;
+    auto next = [&seed](uint32_t n) {
+        seed = seed * 1103515245 + 12345;
+        return (seed >> 16) % n;
+    };
+    for (int i = 0; i < 5000; ++i) {
+        if (next(2)) {
+            int32_t sym = next(3);
+            tape.write(sym);
+            cells[head] = sym;
+        } else {
+            int64_t to = next(64);
+            tape.move(to - head);
+            head = to;
+        }
+        ASSERT_EQ(head, tape.head());
+        ASSERT_EQ(cells[head], tape.read());
+        ASSERT_EQ(cells, tape.dense());
+        // neighbour runs differ
+        auto runs = tape.runs();
+        for (size_t r = 1; r < runs.size(); ++r)
+            ASSERT_NE(runs[r - 1].sym, runs[r].sym);
+        ASSERT_EQ(runs.size(), tape.numRuns());
+    }
+}
+
+TEST_F(TestInterpreter, run_interpreter) {
+    auto sweeping = machineFromSource("STATES: [b], o, q, p, f\n"
+                                      "SYMBOLS: 0, 1, e, x\n"
+                                      "TRANSITIONS:\n"
+                                      "b, *, P(e)-R-P(e)-R-P(0)-R-R-P(0)-L-L, "
+                                      "o\n"
+                                      "o, 1, R-P(x)-L-L-L, o\n"
+                                      "o, 0, X, q\n"
+                                      "q, 0 | 1, R-R, q\n"
+                                      "q, X, P(1)-L, p\n"
+                                      "p, x, P(X)-R, q\n"
+                                      "p, e, R, f\n"
+                                      "p, X, L-L, p\n"
+                                      "f, *, R-R, f\n"
+                                      "f, X, P(0)-L-L, o\n");
+    std::vector<std::pair<machine::Machine, uint64_t>> machines = {
+        {machineFromSource(counter), 16}, {sweeping, 48}};
+    for (auto [src, steps, tapeSize, status, taken] : testCases)
+        machines.push_back({machineFromSource(src), tapeSize});
+    for (const auto &[m, tapeSize] : machines) {
+        for (uint64_t steps = 0; steps < 1200; steps += 13) {
+            interpreter::Interpreter dense(m, tapeSize);
+            interpreter::RunInterpreter runs(m, tapeSize);
+            ASSERT_EQ(dense.run(steps), runs.run(steps));
+            ASSERT_EQ(dense.steps, runs.steps);
+            ASSERT_EQ(dense.state, runs.state);
+            ASSERT_EQ(dense.heads[0], runs.tape.head());
+            ASSERT_EQ(dense.tapes[0], runs.tape.dense());
+        }
+    }
+
+    // a counter on a tape far too big to hold cell by cell
+    interpreter::RunInterpreter big(machineFromSource(counter), 1ull << 40);
+    ASSERT_EQ(interpreter::Status::Running, big.run(100000));
+    ASSERT_GT(20u, big.tape.numRuns());
+}
+
+// guesses two cells, then checks that both hold 1
+static const std::string guess = "STATES: [s], a, b, c, d, yes\n"
+                                 "SYMBOLS: 0, 1\n"
+                                 "TRANSITIONS:\n"
+                                 "s, X, P(0)-R, a\n"
+                                 "s, X, P(1)-R, a\n"
+                                 "a, X, P(0)-R, b\n"
+                                 "a, X, P(1)-R, b\n"
+                                 "b, X, L, c\n"
+                                 "c, 1, L, d\n"
+                                 "d, 1, R, yes\n";
+
+struct TestNondet : public ::testing::Test {
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestNondet, sample_test) {
+    auto m = machineFromSource(guess);
+    nondet::Options options;
+    options.accept = {"yes"};
+    options.tapeSize = 4;
+    options.maxSteps = 100;
+    auto r = nondet::search(m, options);
+    ASSERT_EQ(nondet::Verdict::Accepted, r.verdict);
+    ASSERT_EQ(5u, r.steps);
+    ASSERT_EQ(m.stateIndex("yes"), r.state);
+    ASSERT_EQ(std::vector<int64_t>{1}, r.heads);
+    ASSERT_EQ(std::vector<int32_t>({1, 1, 2, 2}), r.tapes[0]);
+
+    // the second guess steps off a two cell tape
+    options.tapeSize = 2;
+    r = nondet::search(m, options);
+    ASSERT_EQ(nondet::Verdict::Rejected, r.verdict);
+    ASSERT_EQ(2u, r.steps);
+    ASSERT_EQ(4u, r.dead);
+
+    // every branch through d is refuted
+    options.tapeSize = 4;
+    options.reject = {"d"};
+    ASSERT_EQ(nondet::Verdict::Rejected, nondet::search(m, options).verdict);
+    options.reject = {"yes"};
+    EXPECT_THROW(nondet::search(m, options), std::runtime_error);
+    options.reject.clear();
+
+    // bounds
+    options.maxSteps = 3;
+    r = nondet::search(m, options);
+    ASSERT_EQ(nondet::Verdict::Undecided, r.verdict);
+    ASSERT_EQ(3u, r.steps);
+    ASSERT_EQ(4u, r.widest);
+    options.maxSteps = 100;
+    options.maxConfigs = 4;
+    ASSERT_EQ(nondet::Verdict::Undecided, nondet::search(m, options).verdict);
+
+    // the start state may decide on its own
+    options.accept = {"s"};
+    r = nondet::search(m, options);
+    ASSERT_EQ(nondet::Verdict::Accepted, r.verdict);
+    ASSERT_EQ(0u, r.steps);
+}
+
+TEST_F(TestNondet, parallel) {
+    // every word over 0, 1 that fits on the tape, 2^15 of them at the
+    // widest level
+    auto m = machineFromSource("STATES: [s]\n"
+                               "SYMBOLS: 0, 1\n"
+                               "TRANSITIONS:\n"
+                               "s, X, P(0)-R, s\n"
+                               "s, X, P(1)-R, s\n");
+    nondet::Options options;
+    options.tapeSize = 16;
+    options.maxSteps = 100;
+    for (unsigned threads : {1, 4}) {
+        options.threads = threads;
+        auto r = nondet::search(m, options);
+        ASSERT_EQ(nondet::Verdict::Rejected, r.verdict);
+        ASSERT_EQ(16u, r.steps);
+        ASSERT_EQ(65535u, r.configs);
+        ASSERT_EQ(32768u, r.widest);
+        ASSERT_EQ(65536u, r.dead);
+    }
+
+    // branches that meet again are only kept once, and a machine that
+    // never gets anywhere new runs out of branches
+    auto wander = machineFromSource("STATES: [s]\n"
+                                    "SYMBOLS: 0\n"
+                                    "TRANSITIONS:\n"
+                                    "s, *, R, s\n"
+                                    "s, *, L, s\n");
+    options.threads = 4;
+    auto r = nondet::search(wander, options);
+    ASSERT_EQ(nondet::Verdict::Rejected, r.verdict);
+    ASSERT_EQ(16u, r.configs); // one per head position
+}
+
+TEST_F(TestNondet, merging_branches) {
+    // writes bits, wanders back and forth over them, and accepts once it
+    // has walked left over five bits onto the start; children of different
+    // parents meet on every level, and 32 tapes accept at once
+    auto m = machineFromSource("STATES: [s], g, b1, b2, b3, b4, b5, yes\n"
+                               "SYMBOLS: 0, 1, e\n"
+                               "TRANSITIONS:\n"
+                               "s, X, P(e)-R, g\n"
+                               "g, *, P(0)-R, g\n"
+                               "g, *, P(1)-R, g\n"
+                               "g, *, L, g\n"
+                               "g, 0 | 1, L, b1\n"
+                               "b1, 0 | 1, L, b2\n"
+                               "b2, 0 | 1, L, b3\n"
+                               "b3, 0 | 1, L, b4\n"
+                               "b4, 0 | 1, L, b5\n"
+                               "b5, e, X, yes\n");
+    nondet::Options options;
+    options.accept = {"yes"};
+    options.tapeSize = 10;
+    options.maxSteps = 100;
+    options.threads = 1;
+    const auto first = nondet::search(m, options);
+    ASSERT_EQ(nondet::Verdict::Accepted, first.verdict);
+    ASSERT_EQ(13u, first.steps);
+    ASSERT_LT(2 * 1024u, first.widest); // wide enough for several chunks
+    for (unsigned threads : {2, 3, 8}) {
+        options.threads = threads;
+        auto r = nondet::search(m, options);
+        ASSERT_EQ(first.steps, r.steps) << threads;
+        ASSERT_EQ(first.configs, r.configs) << threads;
+        ASSERT_EQ(first.widest, r.widest) << threads;
+        ASSERT_EQ(first.dead, r.dead) << threads;
+        ASSERT_EQ(first.heads, r.heads) << threads;
+        ASSERT_EQ(first.tapes, r.tapes) << threads;
+    }
+}
+
+TEST_F(TestNondet, fingerprint_set) {
+    nondet::FingerprintSet set(3);
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Added, set.insert(0));
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Present, set.insert(0));
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Added, set.insert(1ull << 40));
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Added, set.insert(7));
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Present, set.insert(7));
+    ASSERT_EQ(nondet::FingerprintSet::Insert::Full, set.insert(8));
+    ASSERT_EQ(3u, set.size());
+    ASSERT_TRUE(set.contains(1ull << 40));
+    ASSERT_FALSE(set.contains(8));
+}
+
+struct TestStats : public ::testing::Test {
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestStats, sample_test) {
+    auto m = machineFromSource(counter);
+    stats::Stats single(m, 16);
+    interpreter::Interpreter(m, 16).run(1000, &single);
+    ASSERT_EQ(1000u, single.steps());
+    ASSERT_EQ(0, single.minHead);
+    ASSERT_EQ(8, single.maxHead); // the count stays below 2^8
+
+    // two runs of the same machine merge into twice the counts
+    stats::Stats merged(m, 16);
+    for (int run = 0; run < 2; ++run) {
+        stats::Stats local(m, 16);
+        interpreter::Interpreter(m, 16).run(1000, &local);
+        merged.merge(local);
+    }
+    ASSERT_EQ(2000u, merged.steps());
+    for (size_t i = 0; i < merged.caseHits.size(); ++i)
+        ASSERT_EQ(2 * single.caseHits[i], merged.caseHits[i]);
+
+    // no step, no head range; a head left of the tape counts in bucket 0
+    stats::Stats none(m, 16);
+    ASSERT_TRUE(stats::toJson(m, none)["head"]["min"].is_null());
+    none.hit(0, -3);
+    ASSERT_EQ(1u, none.headHistogram[0]);
+
+    auto j = stats::toJson(m, merged);
+    ASSERT_EQ(2000u, j["steps"].get<uint64_t>());
+    for (const auto &c : j["cases"])
+        ASSERT_GT(c["line"].get<uint32_t>(), 3u); // after TRANSITIONS:
+}
+
+struct TestCheckpoint : public ::testing::Test {
+  protected:
+    std::string prefix;
+    void SetUp() override {
+        prefix = (std::filesystem::temp_directory_path() / "smc_ckpt_test")
+                     .string();
+    }
+    void TearDown() override {
+        for (uint64_t steps : {100, 200, 250})
+            std::filesystem::remove(checkpoint::fileFor(prefix, steps));
+    }
+};
+
+TEST_F(TestCheckpoint, sample_test) {
+    auto m = machineFromSource(counter);
+    interpreter::Interpreter straight(m, 16);
+    straight.run(300);
+
+    // 250 steps, checkpoint, then resume on a fresh interpreter
+    interpreter::Interpreter first(m, 16);
+    first.run(250);
+    checkpoint::Checkpoint::capture(first).save(
+        checkpoint::fileFor(prefix, 250));
+    auto ckpt = checkpoint::load_checkpoint(checkpoint::fileFor(prefix, 250));
+    ASSERT_EQ(250u, ckpt.steps);
+    ASSERT_EQ(1u, ckpt.runs.size()); // sentinel and bits are contiguous
+
+    interpreter::Interpreter resumed(m, 16);
+    ckpt.restore(resumed);
+    resumed.run(50);
+    ASSERT_EQ(straight.steps, resumed.steps);
+    ASSERT_EQ(straight.state, resumed.state);
+    ASSERT_EQ(straight.heads, resumed.heads);
+    ASSERT_EQ(straight.tapes, resumed.tapes);
+
+    // seek picks the latest checkpoint not past the step
+    checkpoint::Checkpoint::capture(first).save(
+        checkpoint::fileFor(prefix, 100));
+    checkpoint::Checkpoint::capture(first).save(
+        checkpoint::fileFor(prefix, 200));
+    ASSERT_EQ(checkpoint::fileFor(prefix, 200),
+              checkpoint::nearest(prefix, 249).value());
+    ASSERT_EQ(checkpoint::fileFor(prefix, 250),
+              checkpoint::nearest(prefix, 1000).value());
+    ASSERT_FALSE(checkpoint::nearest(prefix, 99).has_value());
+}
+
+TEST_F(TestCheckpoint, compressed_runs) {
+    checkpoint::Checkpoint ckpt;
+    ckpt.state = "inc";
+    ckpt.tapeSize = 32;
+    ckpt.runs = {{3, {"1", "1", "1", "1", "0", "1"}}, {20, {"e"}}};
+    const auto file = checkpoint::fileFor(prefix, 100);
+    ckpt.save(file);
+    ASSERT_NE(std::string::npos,
+              read_file_to_string(file).find("run 3 1^4 0 1\n"));
+    auto loaded = checkpoint::load_checkpoint(file);
+    ASSERT_EQ(2u, loaded.runs.size());
+    ASSERT_EQ(ckpt.runs[0].syms, loaded.runs[0].syms);
+    ASSERT_EQ(ckpt.runs[1].syms, loaded.runs[1].syms);
+
+    // version 1 spells every cell out
+    dump_string_to_file(file, "smc-checkpoint 1\nstate inc\ntape 32\n"
+                              "run 3 1 1 0\n");
+    ASSERT_EQ((std::vector<std::string>{"1", "1", "0"}),
+              checkpoint::load_checkpoint(file).runs[0].syms);
+    // a count past the tape is rejected
+    dump_string_to_file(file, "smc-checkpoint 2\nstate inc\ntape 32\n"
+                              "run 3 1^33\n");
+    ASSERT_THROW(checkpoint::load_checkpoint(file), std::runtime_error);
+}
+
+struct TestMachineTask : public ::testing::Test {
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestMachineTask, sample_test) {
+    auto m = machineFromSource(counter);
+    interpreter::Interpreter straight(m, 16);
+    straight.run(1000);
+
+    for (uint64_t slice : {1, 7, 1000, 5000}) {
+        auto task = task::run(m, 16, 1000, slice);
+        ASSERT_EQ(0u, task.interpreter().steps); // nothing before resume()
+        uint64_t slices = 1;
+        while (task.resume()) {
+            ASSERT_EQ(slices * slice, task.interpreter().steps);
+            ++slices;
+        }
+        ASSERT_TRUE(task.done());
+        ASSERT_EQ((1000 + slice - 1) / slice, slices);
+        ASSERT_FALSE(task.resume());
+        const auto &interp = task.interpreter();
+        ASSERT_EQ(straight.steps, interp.steps);
+        ASSERT_EQ(straight.state, interp.state);
+        ASSERT_EQ(straight.heads, interp.heads);
+        ASSERT_EQ(straight.tapes, interp.tapes);
+    }
+
+    // a halting run ends with the slice that finds it halted
+    auto halting = m;
+    halting.makeHaltState("back");
+    auto task = task::run(halting, 16, 1000, 1);
+    ASSERT_TRUE(task.resume());
+    ASSERT_TRUE(task.resume());
+    ASSERT_FALSE(task.resume());
+    ASSERT_EQ(interpreter::Status::Halted, task.interpreter().status);
+    ASSERT_EQ(2u, task.interpreter().steps);
+
+    // tasks move, resuming where they left off
+    auto moved = task::run(m, 16, 1000, 300);
+    moved.resume();
+    std::vector<task::MachineTask> tasks;
+    tasks.push_back(std::move(moved));
+    ASSERT_TRUE(moved.done());
+    tasks.push_back(task::run(interpreter::Interpreter(m, 4), 1000, 64));
+    tasks.push_back(task::run(m, 16, 0, 10));
+    // 3 slices left for the moved one, the small tape runs out in its
+    // first and the empty run ends in its first
+    ASSERT_EQ(5u, task::roundRobin(tasks));
+    ASSERT_EQ(straight.tapes, tasks[0].interpreter().tapes);
+    ASSERT_EQ(interpreter::Status::OutOfTape, tasks[1].interpreter().status);
+    ASSERT_EQ(0u, tasks[2].interpreter().steps);
+}
@@ -320,6 +320,30 @@ TEST_F(TestCorrectSources, sample_test) {
     }
 }
 
+TEST_F(TestCorrectSources, split_test) {
+    // pieces cut at line starts lex to the tokens of the whole source,
+    // locations included, with an EOF only at the very end
+    for (auto [fileName, expectedTokenList] : fileTokenPairs) {
+        for (unsigned pieces : {1, 2, 3, 7}) {
+            auto whole = std::make_unique<lexer::Lexer>(fileName);
+            auto split = whole->split({0, 1, 1}, pieces, 1);
+            ASSERT_LE(split.size(), pieces);
+            std::vector<lexer::Token> tokenList;
+            for (size_t i = 0; i < split.size(); ++i) {
+                while (auto token = split[i]->get_token()) {
+                    if (token->kind == lexer::TokenType::EOF_TOKEN) {
+                        if (i + 1 == split.size())
+                            tokenList.push_back(token.value());
+                        break;
+                    }
+                    tokenList.push_back(token.value());
+                }
+            }
+            ASSERT_EQ(tokenList, expectedTokenList);
+        }
+    }
+}
+
 struct TestInvalidSources : public ::testing::Test {
 
     // Can add multiple cases to test
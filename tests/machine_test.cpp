@@ -0,0 +1,120 @@
+#include "cppBackend.hpp"
+#include "machine.hpp"
+#include "parser.hpp"
+#include "test_utils.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+//========================================================================
+// Test Fixtures
+//========================================================================
+
+struct TestMachineDispatch : public ::testing::Test {
+
+    // source, state, symbol, expected rule
+    std::vector<std::tuple<std::string, std::string, std::string, int32_t>>
+        testCases;
+
+    TestMachineDispatch() {
+        std::string starLast = "STATES: [a], b\n"
+                               "SYMBOLS: 0, 1\n"
+                               "TRANSITIONS:\n"
+                               "a, *, P(0), b\n"
+                               "a, 1, R, a\n"
+                               "a, 1, L, a\n";
+        testCases = {
+            {starLast, "a", "0", 0},  // star covers 0
+            {starLast, "a", "1", 1},  // OR beats Star, first OR wins
+            {starLast, "a", "X", 0},  // star covers blank as well
+            {starLast, "b", "0", -1}, // no transition at all
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestMachineDispatch, sample_test) {
+    for (auto [src, state, sym, rule] : testCases) {
+        auto m = machineFromSource(src);
+        ASSERT_EQ(m.symbols.back(), "X");
+        ASSERT_EQ(rule, m.ruleFor(m.stateIndex(state), m.symbolIndex(sym)));
+    }
+}
+
+TEST_F(TestMachineDispatch, multi_tape) {
+    auto m = machineFromSource("STATES: [a]\n"
+                               "SYMBOLS: 0\n"
+                               "TAPES: 2\n"
+                               "TRANSITIONS:\n"
+                               "a, (*, *), R, a\n"
+                               "a, (*, 0), L, a\n"
+                               "a, (0, 0), X, a\n");
+    ASSERT_EQ(4u, m.numCombos());
+    // combo = sym1 + sym2 * 2 over symbols 0, X; fewer Star tapes win
+    ASSERT_EQ(2, m.ruleFor(0, 0)); // (0, 0)
+    ASSERT_EQ(1, m.ruleFor(0, 1)); // (X, 0)
+    ASSERT_EQ(0, m.ruleFor(0, 2)); // (0, X)
+    ASSERT_EQ("(X, 0)", m.comboName(1));
+}
+
+TEST_F(TestMachineDispatch, branches) {
+    auto m = machineFromSource(std::get<0>(testCases[0]));
+    auto b = machine::branches(m);
+    auto rulesOf = [&](const std::string &state, const std::string &sym) {
+        unsigned num = m.stateIndex(state) * m.numCombos() +
+                       m.symbolIndex(sym);
+        return std::vector<uint32_t>(b.rules.begin() + b.start[num],
+                                     b.rules.begin() + b.start[num + 1]);
+    };
+    ASSERT_EQ(std::vector<uint32_t>({0}), rulesOf("a", "0"));
+    ASSERT_EQ(std::vector<uint32_t>({0, 1, 2}), rulesOf("a", "1"));
+    ASSERT_EQ(std::vector<uint32_t>{}, rulesOf("b", "0"));
+    // a halt state keeps no choice
+    m.makeHaltState("a");
+    b = machine::branches(m);
+    ASSERT_EQ(std::vector<uint32_t>{}, rulesOf("a", "1"));
+}
+
+struct TestInvalidMachine : public ::testing::Test {
+
+    std::vector<std::string> testCases;
+
+    TestInvalidMachine() {
+        testCases = {
+            "STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, 1, R, a\n", // symbol
+            "STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, 0, R, b\n", // state
+            "STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\na, 0, P(2), a\n",
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestInvalidMachine, sample_test) {
+    for (auto src : testCases) {
+        EXPECT_THROW(machineFromSource(src), std::runtime_error);
+    }
+}
+
+TEST(TestCppBackend, sample_test) {
+    auto lexer = std::make_unique<lexer::Lexer>("tests/examples/simple.sm");
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    cppBackend::CppBackend backend(std::move(parser));
+    backend.getHeader("simple");
+    const auto &h = backend.header;
+    EXPECT_NE(h.find("struct simple {"), std::string::npos);
+    EXPECT_NE(h.find("template <class M, class Tape>"), std::string::npos);
+    // a: *, b: 0 and b: 1 over symbols 0, 1, X
+    EXPECT_NE(h.find("0, 0, 0, 1, 2, -1"), std::string::npos);
+    // the furthest cell each rule visits, checked before it runs
+    EXPECT_NE(h.find("maxOffset = {{\n        0, 1, 1\n"), std::string::npos);
+    EXPECT_NE(h.find("if (!reaches<M>(rule, 0, head, len))"),
+              std::string::npos);
+}
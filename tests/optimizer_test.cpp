@@ -0,0 +1,309 @@
+#include "interpreter.hpp"
+#include "machine.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "test_utils.hpp"
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+//========================================================================
+// Test Fixtures
+//========================================================================
+
+struct TestMinimize : public ::testing::Test {
+
+    // source, states after, symbols after
+    std::vector<std::tuple<std::string, uint32_t, uint32_t>> testCases;
+
+    TestMinimize() {
+        testCases = {
+            // d is unreachable, 2 is never printed
+            {"STATES: [a], b, d\n"
+             "SYMBOLS: 0, 1, 2\n"
+             "TRANSITIONS:\n"
+             "a, *, P(0)-R, b\n"
+             "b, *, P(1)-R, a\n"
+             "d, 2, P(2), d\n",
+             2, 3},
+            // b and c behave the same, both collapse into one state
+            {"STATES: [a], b, c\n"
+             "SYMBOLS: 0\n"
+             "TRANSITIONS:\n"
+             "a, X, P(0)-R, b\n"
+             "a, 0, R, c\n"
+             "b, *, R, a\n"
+             "c, *, R, a\n",
+             2, 2},
+            // c's R-L visits a cell b's X does not, so they stay apart
+            {"STATES: [a], b, c\n"
+             "SYMBOLS: 0\n"
+             "TRANSITIONS:\n"
+             "a, X, P(0)-R, b\n"
+             "a, 0, R, c\n"
+             "b, *, X, a\n"
+             "c, *, R-L, a\n",
+             3, 2},
+            // one state counter loop: nothing to do
+            {"STATES: [a]\n"
+             "SYMBOLS: 0\n"
+             "TRANSITIONS:\n"
+             "a, *, P(0)-R, a\n",
+             1, 2},
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestMinimize, sample_test) {
+    for (auto [src, statesAfter, symbolsAfter] : testCases) {
+        auto m = machineFromSource(src);
+        auto report = optimizer::minimize(m);
+        ASSERT_EQ(statesAfter, report.statesAfter);
+        ASSERT_EQ(symbolsAfter, report.symbolsAfter);
+        ASSERT_EQ(statesAfter, m.numStates());
+        ASSERT_EQ(m.dispatch.size(), report.dispatchAfter());
+        ASSERT_EQ(m.symbols.back(), "X");
+        // every surviving rule points at a surviving state
+        for (const auto &T : m.rules) {
+            ASSERT_NO_THROW(m.stateIndex(T.initialState));
+            ASSERT_NO_THROW(m.stateIndex(T.finalState));
+        }
+    }
+}
+
+struct TestFuseSteps : public ::testing::Test {
+
+    // action list, net move, writes as (offset, symbol), number of runs
+    std::vector<std::tuple<std::string, int32_t,
+                           std::map<int32_t, unsigned>, size_t>>
+        testCases;
+
+    TestFuseSteps() {
+        // symbols: 0, 1, e, x, X
+        testCases = {
+            {"P(e)-R-P(e)-R-P(0)-R-R-P(0)-L-L", 2,
+             {{0, 2}, {1, 2}, {2, 0}, {4, 0}}, 2},
+            {"R-L-X-L-R", 0, {}, 0},             // cancels out
+            {"P(0)-P(1)-R-R-R", 3, {{0, 1}}, 1}, // overwritten print
+            {"L-P(x)-R-R-P(x)-L", 0, {{-1, 3}, {1, 3}}, 2},
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestFuseSteps, sample_test) {
+    for (auto [actions, move, writes, runs] : testCases) {
+        auto m = machineFromSource("STATES: [a]\nSYMBOLS: 0, 1, e, x\n"
+                                   "TRANSITIONS:\na, *, " +
+                                   actions + ", a\n");
+        auto fused = optimizer::fuseSteps(m, m.rules[0].steps);
+        ASSERT_EQ(move, fused.move);
+        ASSERT_EQ(writes, fused.writes);
+        ASSERT_EQ(runs, fused.runs().size());
+    }
+}
+
+struct TestPartition : public ::testing::Test {
+
+    // a -> {b <-> c} -> d, d loops on itself
+    std::string source;
+
+    TestPartition() {
+        source = "STATES: [a], b, c, d\n"
+                 "SYMBOLS: 0\n"
+                 "TRANSITIONS:\n"
+                 "a, *, R, b\n"
+                 "b, 0, R, c\n"
+                 "b, X, P(0), d\n"
+                 "c, *, L, b\n"
+                 "d, *, R, d\n";
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestPartition, sample_test) {
+    auto m = machineFromSource(source);
+    auto sccs = optimizer::stronglyConnected(m);
+    ASSERT_EQ(3u, sccs.size());
+    // successors first
+    ASSERT_EQ(std::vector<unsigned>{m.stateIndex("d")}, sccs[0]);
+    ASSERT_EQ(2u, sccs[1].size());
+    ASSERT_EQ(std::vector<unsigned>{m.stateIndex("a")}, sccs[2]);
+
+    auto one = optimizer::partitionStates(m, 1);
+    ASSERT_EQ(std::vector<unsigned>(m.numStates(), 0), one);
+    // b and c never end up in different groups, groups follow the flow
+    for (unsigned parts = 2; parts <= 8; ++parts) {
+        auto groupOf = optimizer::partitionStates(m, parts);
+        ASSERT_EQ(groupOf[m.stateIndex("b")], groupOf[m.stateIndex("c")]);
+        ASSERT_LE(groupOf[m.stateIndex("a")], groupOf[m.stateIndex("b")]);
+        ASSERT_LE(groupOf[m.stateIndex("b")], groupOf[m.stateIndex("d")]);
+        ASSERT_LT(groupOf[m.stateIndex("d")], parts);
+    }
+}
+
+TEST_F(TestPartition, layout) {
+    auto names = [](const machine::Machine &m) {
+        std::vector<std::string> out;
+        for (unsigned q : optimizer::layoutStates(m))
+            out.push_back(m.states[q]);
+        return out;
+    };
+    ASSERT_EQ(std::vector<std::string>({"a", "b", "c", "d"}),
+              names(machineFromSource(source)));
+    // loops stay together whatever the declaration order, the source u
+    // that is never reached goes last
+    auto m = machineFromSource("STATES: [s], p, a, q, b, u\n"
+                               "SYMBOLS: 0\n"
+                               "TRANSITIONS:\n"
+                               "s, *, R, a\n"
+                               "p, *, R, q\n"
+                               "a, *, R, b\n"
+                               "q, *, L, p\n"
+                               "b, 0, R, p\n"
+                               "b, X, L, a\n"
+                               "u, *, R, s\n");
+    ASSERT_EQ(std::vector<std::string>({"s", "a", "b", "p", "q", "u"}),
+              names(m));
+}
+
+struct TestRuleClasses : public ::testing::Test {
+
+    std::string source;
+
+    TestRuleClasses() {
+        // a and c share their first rule, X-R-L-R to c is a's R to c
+        source = "STATES: [a], b, c\n"
+                 "SYMBOLS: 0\n"
+                 "TRANSITIONS:\n"
+                 "a, 0, P(0)-R, b\n"
+                 "a, X, R, c\n"
+                 "b, *, X-R-L-R, c\n"
+                 "c, 0, P(0)-R, b\n"
+                 "c, X, R, b\n";
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestRuleClasses, sample_test) {
+    auto m = machineFromSource(source);
+    auto classes = optimizer::ruleClasses(m);
+    ASSERT_EQ(std::vector<unsigned>({0, 1, 1, 0, 2}), classes);
+    // same net effect, different reach
+    m = machineFromSource("STATES: [a]\nSYMBOLS: 0\nTRANSITIONS:\n"
+                          "a, 0, R-L, a\n"
+                          "a, X, X, a\n");
+    ASSERT_EQ(std::vector<unsigned>({0, 1}), optimizer::ruleClasses(m));
+}
+
+struct TestTapeExtent : public ::testing::Test {
+
+    std::string header = "STATES: [s], a, b, c\n"
+                         "SYMBOLS: 0, 1\n"
+                         "TRANSITIONS:\n";
+    // cells the machine needs whatever the steps, 0 when unbounded
+    std::vector<std::pair<std::string, uint64_t>> machines;
+
+    TestTapeExtent() {
+        machines = {
+            // acyclic, then stays put
+            {"s, *, P(1)-R-P(1)-R-P(1)-L-L, a\n"
+             "a, *, R-R, b\n"
+             "b, *, X, b\n",
+             3},
+            // a sweep over the written cells ends one past them
+            {"s, *, P(1)-R-P(1)-R-P(1)-L-L, a\n"
+             "a, 1, R, a\n"
+             "a, X, P(0), b\n",
+             4},
+            // back and forth over a growing block
+            {"s, *, R-P(1), a\n"
+             "a, 1, L, a\n"
+             "a, X, R, b\n"
+             "b, 1, R, b\n"
+             "b, X, P(1)-L, a\n",
+             0},
+            // runs right
+            {"s, *, R, s\n", 0},
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestTapeExtent, sample_test) {
+    for (const auto &[rules, cells] : machines) {
+        auto m = machineFromSource(header + rules);
+        auto extent = optimizer::tapeExtent(m);
+        ASSERT_EQ(cells != 0, extent.bounded()) << rules;
+        if (cells) {
+            ASSERT_EQ(cells, extent.cells(1000)) << rules;
+        }
+        // the bound is enough for every run
+        for (uint64_t steps = 0; steps < 40; ++steps) {
+            interpreter::Interpreter interp(m, extent.cells(steps));
+            interp.run(steps);
+            ASSERT_NE(interpreter::Status::OutOfTape, interp.status)
+                << rules << steps;
+        }
+    }
+    // a machine that runs right needs one cell per step
+    auto m = machineFromSource(header + "s, *, R, s\n");
+    ASSERT_EQ(11u, optimizer::tapeExtent(m).cells(10));
+}
+
+struct TestSweeps : public ::testing::Test {
+
+    std::string source;
+
+    TestSweeps() {
+        // a sweeps right over 0 and 1, reprinting 1 changes nothing; b
+        // loops with two different moves; c only sweeps over the 0s it
+        // would print
+        source = "STATES: [a], b, c\n"
+                 "SYMBOLS: 0, 1\n"
+                 "TRANSITIONS:\n"
+                 "a, 0, R-R-L, a\n"
+                 "a, 1, P(1)-R, a\n"
+                 "a, X, L, b\n"
+                 "b, 0, L, b\n"
+                 "b, 1, R, b\n"
+                 "b, X, R, c\n"
+                 "c, *, P(0)-L, c\n";
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestSweeps, sample_test) {
+    auto m = machineFromSource(source);
+    auto sweeps = optimizer::sweeps(m);
+    ASSERT_EQ(3u, sweeps.size());
+    const auto &a = sweeps[m.stateIndex("a")];
+    ASSERT_EQ(1, a.move);
+    ASSERT_EQ(std::vector<bool>({true, true, false}), a.symbols);
+    ASSERT_EQ(2, a.maxOffset);
+    ASSERT_EQ(0, sweeps[m.stateIndex("b")].move);
+    const auto &c = sweeps[m.stateIndex("c")];
+    ASSERT_EQ(-1, c.move);
+    ASSERT_EQ(std::vector<bool>({true, false, false}), c.symbols);
+}
@@ -3,6 +3,7 @@
 #include <stdexcept>
 #include <string>
 #include <tuple>
+#include <variant>
 #include <vector>
 
 //========================================================================
@@ -135,4 +136,211 @@ TEST_F(TestParserSymbolList, sample_test) {
         parser->symbols_list();
         ASSERT_EQ(symbols, parser->tree.symbols);
     }
-}
\ No newline at end of file
+}
+struct TestParseTapes : public ::testing::Test {
+    const std::string header = "STATES: [a], b\nSYMBOLS: 0, 1\nTAPES: 2\n"
+                               "TRANSITIONS:\n";
+    // transitions that a two tape machine rejects
+    std::vector<std::string> invalid;
+
+    TestParseTapes() {
+        invalid = {
+            {"a, 0, R, b\n"},            // one condition for two tapes
+            {"a, (0, 1, X), R, b\n"},    // three conditions
+            {"a, (0, 1), R3, b\n"},      // no third tape
+            {"a, (0, 1), Q2, b\n"},      // not an action
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestParseTapes, sample_test) {
+    auto src = header + "a, (0 | 1, *), P2(1)-R2-L, b\n";
+    auto lexer = std::make_unique<lexer::Lexer>(src, false);
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    parser->parse();
+    ASSERT_EQ(2u, parser->tree.tapes);
+    const auto &T = parser->tree.transitions[0];
+    const auto &tuple = std::get<parser::Tuple>(T.condition);
+    ASSERT_EQ(2u, tuple.tapes.size());
+    ASSERT_TRUE(std::holds_alternative<parser::Star>(tuple.tapes[1]));
+    ASSERT_EQ(3u, T.steps.size());
+    ASSERT_EQ("1", std::get<parser::P>(T.steps[0]).sym);
+    ASSERT_EQ(1u, parser::tapeOf(T.steps[0]));
+    ASSERT_EQ(1u, parser::tapeOf(T.steps[1]));
+    ASSERT_EQ(0u, parser::tapeOf(T.steps[2])); // plain actions: tape 1
+
+    for (const auto &tr : invalid) {
+        auto lexer = std::make_unique<lexer::Lexer>(header + tr, false);
+        auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+        EXPECT_THROW(parser->parse(), std::runtime_error);
+    }
+}
+
+struct TestParseFunctions : public ::testing::Test {
+    // find(C, B, a): right to the first `a` then C, B at the first blank;
+    // pe(C, a): print `a` on the first blank then C
+    const std::string header = "STATES: [b], c, done, none\n"
+                               "SYMBOLS: 0, 1\n"
+                               "FUNCTIONS:\n"
+                               "find(C, B, a):\n"
+                               "find, a, X, C\n"
+                               "find, X, L, back\n"
+                               "back, *, X, B\n"
+                               "find, *, R, find\n"
+                               "pe(C, a):\n"
+                               "pe, X, P(a), C\n"
+                               "pe, *, R, pe\n"
+                               "grow(C):\n"
+                               "grow, *, R, grow(grow(C))\n"
+                               "out(a):\n"
+                               "out, a, R, out\n"
+                               "out, *, X, done\n"
+                               "stray(C):\n"
+                               "stray, *, R, nowhere\n"
+                               "TRANSITIONS:\n";
+    // calls that do not expand
+    std::vector<std::string> invalid;
+
+    TestParseFunctions() {
+        invalid = {
+            {"b, *, R, grow(c)\n"},      // new arguments on every level
+            {"b, *, R, find(c, none)\n"}, // one argument short
+            {"b, *, R, lost(c)\n"},       // no such m-function
+            {"b, *, R, stray(c)\n"},      // no such state
+        };
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestParseFunctions, sample_test) {
+    // both callers of find(pe(done,1),none,1) share one instance
+    auto src = header + "b, 0, P(1), find(pe(done, 1), none, 1)\n"
+                        "b, *, P(0), c\n"
+                        "c, *, L, find(pe(done, 1), none, 1)\n";
+    auto lexer = std::make_unique<lexer::Lexer>(src, false);
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    parser->parse();
+    const auto &tree = parser->tree;
+    std::vector<std::string> states{"b",
+                                    "c",
+                                    "done",
+                                    "none",
+                                    "pe(done,1)",
+                                    "find(pe(done,1),none,1)",
+                                    "find(pe(done,1),none,1).back"};
+    ASSERT_EQ(states, tree.states);
+    ASSERT_EQ(3u + 4u + 2u, tree.transitions.size());
+    ASSERT_EQ("find(pe(done,1),none,1)", tree.transitions[0].finalState);
+    // arguments are instantiated before the call that takes them
+    ASSERT_EQ("1", std::get<parser::P>(tree.transitions[3].steps[0]).sym);
+    // find's first rule, parameters substituted
+    const auto &T = tree.transitions[5];
+    ASSERT_EQ("find(pe(done,1),none,1)", T.initialState);
+    ASSERT_EQ(std::vector<std::string>{"1"},
+              std::get<parser::OR>(T.condition).sym);
+    ASSERT_EQ("pe(done,1)", T.finalState);
+    ASSERT_EQ("none", tree.transitions[7].finalState);
+
+    for (const auto &tr : invalid) {
+        auto lexer = std::make_unique<lexer::Lexer>(header + tr, false);
+        auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+        EXPECT_THROW(parser->parse(), std::runtime_error);
+    }
+}
+
+TEST_F(TestParseFunctions, global_target) {
+    // a body that ends in a state of the machine goes to that state
+    auto src = header + "b, *, R, out(1)\n";
+    auto lexer = std::make_unique<lexer::Lexer>(src, false);
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    parser->parse();
+    const auto &tree = parser->tree;
+    std::vector<std::string> states{"b", "c", "done", "none", "out(1)"};
+    ASSERT_EQ(states, tree.states);
+    ASSERT_EQ(3u, tree.transitions.size());
+    ASSERT_EQ("out(1)", tree.transitions[1].finalState);
+    ASSERT_EQ("done", tree.transitions[2].finalState);
+}
+
+struct TestParallelTransitions : public ::testing::Test {
+    // the transitions of a 3 state counter over and over, with comments,
+    // blank lines and m-function calls in between
+    std::string source;
+
+    TestParallelTransitions() {
+        source = "STATES: [s], inc, back\n"
+                 "SYMBOLS: 0, 1, e\n"
+                 "FUNCTIONS:\n"
+                 "pe(C, a):\n"
+                 "pe, X, P(a), C\n"
+                 "pe, *, R, pe\n"
+                 "TRANSITIONS:\n";
+        for (int i = 0; i < 200; ++i) {
+            source += "s, *, P(e)-R, inc\n"
+                      "inc, 1, P(0)-R, inc\n"
+                      "# a comment\n"
+                      "  inc, 0 | X, P(1)-L, back\n"
+                      "\n"
+                      "back, 0 | 1, L, pe(back, " +
+                      std::to_string(i % 2) + ")\n";
+        }
+    }
+
+    static std::unique_ptr<parser::Parser>
+    parserFor(const std::string &src, unsigned threads) {
+        auto lexer = std::make_unique<lexer::Lexer>(src, false);
+        auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+        parser->parseThreads = threads;
+        parser->pieceBytes = 64;
+        return parser;
+    }
+
+    static std::string errorOf(const std::string &src, unsigned threads) {
+        try {
+            parserFor(src, threads)->parse();
+        } catch (const std::runtime_error &e) {
+            return e.what();
+        }
+        return "";
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestParallelTransitions, sample_test) {
+    auto sequential = parserFor(source, 1);
+    sequential->parse();
+    json expected;
+    parser::to_json(expected, sequential->tree);
+    ASSERT_EQ(800u + 2u * 2u, sequential->tree.transitions.size());
+    ASSERT_EQ(11u, sequential->tree.transitions[2].line);
+
+    for (unsigned threads : {2, 3, 8}) {
+        auto parallel = parserFor(source, threads);
+        parallel->parse();
+        json j;
+        parser::to_json(j, parallel->tree);
+        ASSERT_EQ(expected, j);
+    }
+
+    // the first error in the source wins, at the same location
+    auto broken = source;
+    broken.replace(broken.find("inc, 1", broken.size() / 2), 6, "inc, (1");
+    broken.replace(broken.rfind("inc, 1"), 6, "inc 1");
+    const auto error = errorOf(broken, 1);
+    ASSERT_NE("", error);
+    ASSERT_EQ(error, errorOf(broken, 4));
+
+    auto stray = source + "* , R, s\n";
+    ASSERT_NE("", errorOf(stray, 1));
+    ASSERT_EQ(errorOf(stray, 1), errorOf(stray, 4));
+}
@@ -0,0 +1,69 @@
+#include "server.hpp"
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <string>
+
+using json = nlohmann::json;
+
+//========================================================================
+// Test Fixtures
+//========================================================================
+
+struct TestServerHandle : public ::testing::Test {
+
+    // walks right forever, so a run ends on its step budget
+    std::string walker = "STATES: [a]\n"
+                         "SYMBOLS: 0\n"
+                         "TRANSITIONS:\n"
+                         "a, *, R, a\n";
+    llvm::LLVMContext ctx;
+    server::Options limits;
+
+    TestServerHandle() {
+        limits.maxSteps = 1000;
+        limits.maxTapeCells = 100;
+    }
+
+    json run(uint64_t steps, uint64_t tape) {
+        return {{"source", walker},
+                {"emit", "run"},
+                {"steps", steps},
+                {"tape", tape}};
+    }
+
+  protected:
+    void SetUp() override {}
+    void TearDown() override {}
+};
+
+TEST_F(TestServerHandle, run_within_limits) {
+    auto reply = server::handle(run(50, 64), ctx, limits);
+    ASSERT_TRUE(reply["ok"].get<bool>()) << reply.dump();
+    EXPECT_EQ(50u, reply["steps"].get<uint64_t>());
+    EXPECT_EQ(64u, reply["tapes"][0].size());
+}
+
+TEST_F(TestServerHandle, run_past_limits) {
+    auto tooLong = server::handle(run(1001, 64), ctx, limits);
+    EXPECT_FALSE(tooLong["ok"].get<bool>());
+    EXPECT_NE(tooLong["error"].get<std::string>().find("steps"),
+              std::string::npos);
+
+    auto tooWide = server::handle(run(50, 101), ctx, limits);
+    EXPECT_FALSE(tooWide["ok"].get<bool>());
+    EXPECT_NE(tooWide["error"].get<std::string>().find("cells"),
+              std::string::npos);
+
+    // the exact tape grows with the steps, past the bound here
+    auto exact = run(1000, 64);
+    exact["codegen"] = {{"exactTape", true}};
+    auto reply = server::handle(exact, ctx, limits);
+    EXPECT_FALSE(reply["ok"].get<bool>());
+}
+
+TEST_F(TestServerHandle, bad_request) {
+    EXPECT_FALSE(server::handle({{"emit", "run"}}, ctx, limits)["ok"]);
+    auto unknown = run(1, 1);
+    unknown["emit"] = "asm";
+    EXPECT_FALSE(server::handle(unknown, ctx, limits)["ok"]);
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_UTILS_HPP
+#define TEST_UTILS_HPP
+#include "lexer.hpp"
+#include "machine.hpp"
+#include "parser.hpp"
+#include <memory>
+#include <string>
+
+// The machine of .sm source text, as the tests write it inline.
+inline machine::Machine machineFromSource(const std::string &src) {
+    auto lexer = std::make_unique<lexer::Lexer>(src, false);
+    auto parser = std::make_unique<parser::Parser>(std::move(lexer));
+    parser->parse();
+    return machine::fromParseTree(parser->tree);
+}
+
+#endif